@@ -0,0 +1,719 @@
+#include "apu.h"
+#include "telemetry.h"
+#include <algorithm> // For fill/min
+#include <cmath>
+#include <cstring>
+
+// Duty cycle waveforms, one bit per step (12.5%, 25%, 50%, 75%)
+static const uint8_t dutyPatterns[4] = { 0x01, 0x81, 0x87, 0x7E };
+
+// Noise divisors indexed by NR43 bits 0-2
+static const int noiseDivisors[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+// Bits that always read back as 1, indexed from 0xFF10
+static const uint8_t readMasks[0x30] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF, // unused, NR21-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF, // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF, // unused, NR41-NR44
+    0x00, 0x00, 0x70,             // NR50-NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, // unused
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // wave RAM
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+// Windowed sinc low-pass, cutoff just below the 48 kHz Nyquist frequency (shared by all instances)
+using ResampleTable = std::array<std::array<float, RESAMPLER_TAPS>, RESAMPLER_PHASES + 1>;
+
+static const ResampleTable& resampleTable() {
+    static const ResampleTable table = [] {
+        const double pi = 3.14159265358979323846;
+        const double cutoff = 0.9 * (APU_OUTPUT_RATE / 2.0) / APU_INTERNAL_RATE;
+        ResampleTable filter;
+
+        for (int phase = 0; phase <= RESAMPLER_PHASES; ++phase) {
+            double fraction = static_cast<double>(phase) / RESAMPLER_PHASES;
+            double sum = 0.0;
+            for (int tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+                double distance = fraction + RESAMPLER_TAPS / 2 - 1 - tap;
+                double x = 2.0 * cutoff * distance;
+                double sinc = (x == 0.0) ? 1.0 : std::sin(pi * x) / (pi * x);
+                double position = (distance + RESAMPLER_TAPS / 2.0) / RESAMPLER_TAPS;
+                double window = 0.42 - 0.5 * std::cos(2.0 * pi * position) + 0.08 * std::cos(4.0 * pi * position);
+                filter[phase][tap] = static_cast<float>(sinc * window);
+                sum += sinc * window;
+            }
+            for (int tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+                filter[phase][tap] = static_cast<float>(filter[phase][tap] / sum);
+            }
+        }
+        return filter;
+    }();
+    return table;
+}
+
+// Constructor
+APU::APU() : muted(false), telemetry(nullptr) {
+    reset();
+}
+
+// Reset function
+void APU::reset(uint64_t cycle) {
+    registers.fill(0);
+    square1 = {};
+    square2 = {};
+    wave = {};
+    noise = {};
+    noise.lfsr = 0x7FFF;
+    noise.period = noiseDivisors[0];
+
+    powered = true;
+    sequencerStep = 0;
+    lastSyncCycle = cycle;
+    cycleRemainder = 0;
+    blockPosition = 0;
+    resetOutput();
+
+    // Post boot ROM state
+    registers[0x14] = 0x77; // NR50
+    registers[0x15] = 0xF3; // NR51
+}
+
+void APU::resetOutput() {
+    std::fill(std::begin(historyLeft), std::end(historyLeft), 0.0f);
+    std::fill(std::begin(historyRight), std::end(historyRight), 0.0f);
+    historyLength = RESAMPLER_TAPS;
+    resamplePosition = RESAMPLER_TAPS / 2 - 1;
+    capacitorLeft = capacitorRight = 0.0f;
+
+    ringWrite = 0; // Stale ring contents are never read, no need to clear them
+    ringRead = 0;
+    droppedFrames = 0;
+}
+
+// Save the APU state (the resampler keeps running, so output stays continuous)
+void APU::saveState(APUState& state) const {
+    state.registers = registers;
+    state.square1 = square1;
+    state.square2 = square2;
+    state.wave = wave;
+    state.noise = noise;
+    state.powered = powered;
+    state.sequencerStep = sequencerStep;
+    state.lastSyncCycle = lastSyncCycle;
+    state.cycleRemainder = cycleRemainder;
+    state.blockPosition = blockPosition;
+}
+
+void APU::loadState(const APUState& state) {
+    registers = state.registers;
+    square1 = state.square1;
+    square2 = state.square2;
+    wave = state.wave;
+    noise = state.noise;
+    powered = state.powered;
+    sequencerStep = state.sequencerStep;
+    lastSyncCycle = state.lastSyncCycle;
+    cycleRemainder = state.cycleRemainder;
+    blockPosition = state.blockPosition;
+}
+
+// Direct machine to machine copy of the save state fields (no intermediate APUState)
+void APU::copyFrom(const APU& other) {
+    registers = other.registers;
+    square1 = other.square1;
+    square2 = other.square2;
+    wave = other.wave;
+    noise = other.noise;
+    powered = other.powered;
+    sequencerStep = other.sequencerStep;
+    lastSyncCycle = other.lastSyncCycle;
+    cycleRemainder = other.cycleRemainder;
+    blockPosition = other.blockPosition;
+    resetOutput();
+}
+
+// Catch up to the given CPU cycle
+void APU::sync(uint64_t cycle) {
+    if (cycle <= lastSyncCycle) {
+        return;
+    }
+
+    uint64_t elapsed = cycle - lastSyncCycle + cycleRemainder;
+    lastSyncCycle = cycle;
+    cycleRemainder = elapsed % APU_CYCLES_PER_SAMPLE;
+    if (elapsed >= APU_CYCLES_PER_SAMPLE) {
+        StageTimer timer(telemetry, TelemetryStage::APU);
+        generate(static_cast<int>(elapsed / APU_CYCLES_PER_SAMPLE));
+    }
+}
+
+void APU::endFrame(uint64_t cycle) {
+    sync(cycle);
+}
+
+// Generate samples in blocks that never cross a frame sequencer tick
+void APU::generate(int samples) {
+    while (samples > 0) {
+        int count = std::min(samples, APU_BLOCK_SIZE - blockPosition);
+        if (!muted) {
+            renderBlock(count);
+        }
+        blockPosition += count;
+        samples -= count;
+
+        if (blockPosition == APU_BLOCK_SIZE) {
+            blockPosition = 0;
+            if (powered) {
+                clockSequencer();
+            }
+        }
+    }
+}
+
+// Render and mix all channels; their parameters are constant within a block
+void APU::renderBlock(int samples) {
+    std::fill(mixLeft, mixLeft + samples, 0.0f);
+    std::fill(mixRight, mixRight + samples, 0.0f);
+
+    if (powered) {
+        renderSquare(square1, samples);
+        mixChannel(samples, 0x10, 0x01);
+        renderSquare(square2, samples);
+        mixChannel(samples, 0x20, 0x02);
+        renderWave(samples);
+        mixChannel(samples, 0x40, 0x04);
+        renderNoise(samples);
+        mixChannel(samples, 0x80, 0x08);
+
+        // NR50 master volume, scaled so four full channels reach 1.0
+        uint8_t nr50 = registers[0x14];
+        float leftVolume = (((nr50 >> 4) & 0x07) + 1) / 32.0f;
+        float rightVolume = ((nr50 & 0x07) + 1) / 32.0f;
+        for (int i = 0; i < samples; ++i) {
+            mixLeft[i] *= leftVolume;
+            mixRight[i] *= rightVolume;
+        }
+    }
+
+    resampleBlock(samples);
+}
+
+void APU::renderSquare(SquareChannel& channel, int samples) {
+    if (!channel.enabled || !channel.dacEnabled) {
+        std::fill(channelBuffer, channelBuffer + samples, 0.0f);
+        return;
+    }
+
+    uint32_t period = (2048 - channel.frequency) * 4; // Cycles per duty step
+    uint32_t increment = (static_cast<uint32_t>(APU_CYCLES_PER_SAMPLE) << 16) / period;
+    uint8_t pattern = dutyPatterns[channel.duty];
+    float high = channel.volume / 7.5f - 1.0f;
+    float low = -1.0f;
+    uint32_t phase = channel.phase;
+
+    for (int i = 0; i < samples; ++i) {
+        uint32_t step = ((phase + i * increment) >> 16) & 0x07;
+        channelBuffer[i] = ((pattern >> step) & 1) ? high : low;
+    }
+    channel.phase = phase + samples * increment;
+}
+
+void APU::renderWave(int samples) {
+    if (!wave.enabled || !wave.dacEnabled) {
+        std::fill(channelBuffer, channelBuffer + samples, 0.0f);
+        return;
+    }
+
+    // Unpack the 32 4-bit samples with the volume shift applied
+    static const int volumeShifts[4] = { 4, 0, 1, 2 };
+    float levels[32];
+    for (int i = 0; i < 16; ++i) {
+        uint8_t value = registers[0x20 + i];
+        levels[i * 2] = ((value >> 4) >> volumeShifts[wave.volumeShift]) / 7.5f - 1.0f;
+        levels[i * 2 + 1] = ((value & 0x0F) >> volumeShifts[wave.volumeShift]) / 7.5f - 1.0f;
+    }
+
+    uint32_t period = (2048 - wave.frequency) * 2; // Cycles per wave sample
+    uint32_t increment = (static_cast<uint32_t>(APU_CYCLES_PER_SAMPLE) << 16) / period;
+    uint32_t phase = wave.phase;
+
+    for (int i = 0; i < samples; ++i) {
+        channelBuffer[i] = levels[((phase + i * increment) >> 16) & 0x1F];
+    }
+    wave.phase = phase + samples * increment;
+}
+
+void APU::renderNoise(int samples) {
+    if (!noise.enabled || !noise.dacEnabled) {
+        std::fill(channelBuffer, channelBuffer + samples, 0.0f);
+        return;
+    }
+
+    float high = noise.volume / 7.5f - 1.0f;
+    float low = -1.0f;
+    uint16_t lfsr = noise.lfsr;
+    int counter = noise.counter;
+
+    // The LFSR is inherently serial, but only advances a few times per sample
+    for (int i = 0; i < samples; ++i) {
+        counter -= APU_CYCLES_PER_SAMPLE;
+        while (counter <= 0) {
+            counter += noise.period;
+            uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+            lfsr = (lfsr >> 1) | (bit << 14);
+            if (noise.narrow) {
+                lfsr = (lfsr & ~0x40) | (bit << 6);
+            }
+        }
+        channelBuffer[i] = (lfsr & 1) ? low : high;
+    }
+
+    noise.lfsr = lfsr;
+    noise.counter = counter;
+}
+
+// Add the channel buffer to the left/right mix according to NR51
+void APU::mixChannel(int samples, uint8_t leftMask, uint8_t rightMask) {
+    uint8_t nr51 = registers[0x15];
+    if (nr51 & leftMask) {
+        for (int i = 0; i < samples; ++i) {
+            mixLeft[i] += channelBuffer[i];
+        }
+    }
+    if (nr51 & rightMask) {
+        for (int i = 0; i < samples; ++i) {
+            mixRight[i] += channelBuffer[i];
+        }
+    }
+}
+
+// Polyphase windowed sinc resampling from the internal rate to 48 kHz
+void APU::resampleBlock(int samples) {
+    std::memcpy(historyLeft + historyLength, mixLeft, samples * sizeof(float));
+    std::memcpy(historyRight + historyLength, mixRight, samples * sizeof(float));
+    historyLength += samples;
+
+    const double ratio = static_cast<double>(APU_INTERNAL_RATE) / APU_OUTPUT_RATE;
+    const ResampleTable& filter = resampleTable();
+
+    while (static_cast<int>(resamplePosition) + RESAMPLER_TAPS / 2 < historyLength) {
+        int base = static_cast<int>(resamplePosition);
+        int phase = static_cast<int>((resamplePosition - base) * RESAMPLER_PHASES + 0.5);
+        const float* taps = filter[phase].data();
+        const float* left = historyLeft + base - RESAMPLER_TAPS / 2 + 1;
+        const float* right = historyRight + base - RESAMPLER_TAPS / 2 + 1;
+
+        float sumLeft = 0.0f;
+        float sumRight = 0.0f;
+        for (int tap = 0; tap < RESAMPLER_TAPS; ++tap) {
+            sumLeft += taps[tap] * left[tap];
+            sumRight += taps[tap] * right[tap];
+        }
+        pushFrame(sumLeft, sumRight);
+        resamplePosition += ratio;
+    }
+
+    // Keep only the history still needed by the next output sample
+    int consumed = static_cast<int>(resamplePosition) - RESAMPLER_TAPS / 2 + 1;
+    if (consumed > 0) {
+        historyLength -= consumed;
+        std::memmove(historyLeft, historyLeft + consumed, historyLength * sizeof(float));
+        std::memmove(historyRight, historyRight + consumed, historyLength * sizeof(float));
+        resamplePosition -= consumed;
+    }
+}
+
+// High-pass (DC blocking) and store one output frame in the ring buffer
+void APU::pushFrame(float left, float right) {
+    const float charge = 0.996f; // ~0.999958^(4194304 / 48000)
+
+    float outLeft = left - capacitorLeft;
+    capacitorLeft = left - outLeft * charge;
+    float outRight = right - capacitorRight;
+    capacitorRight = right - outRight * charge;
+
+    size_t write = ringWrite.load(std::memory_order_relaxed);
+    if (write - ringRead.load(std::memory_order_acquire) >= AUDIO_RING_FRAMES) {
+        droppedFrames++; // Consumer fell behind
+        return;
+    }
+
+    size_t index = (write & (AUDIO_RING_FRAMES - 1)) * 2;
+    ring[index] = static_cast<int16_t>(std::clamp(outLeft * 16384.0f, -32768.0f, 32767.0f));
+    ring[index + 1] = static_cast<int16_t>(std::clamp(outRight * 16384.0f, -32768.0f, 32767.0f));
+    ringWrite.store(write + 1, std::memory_order_release);
+}
+
+// Frame sequencer (512 Hz)
+void APU::clockSequencer() {
+    switch (sequencerStep) {
+    case 0:
+    case 4:
+        clockLength();
+        break;
+    case 2:
+    case 6:
+        clockLength();
+        clockSweep();
+        break;
+    case 7:
+        clockEnvelopes();
+        break;
+    default:
+        break;
+    }
+    sequencerStep = (sequencerStep + 1) & 0x07;
+}
+
+void APU::clockLength() {
+    auto clock = [](bool lengthEnabled, int& lengthCounter, bool& enabled) {
+        if (lengthEnabled && lengthCounter > 0 && --lengthCounter == 0) {
+            enabled = false;
+        }
+    };
+    clock(square1.lengthEnabled, square1.lengthCounter, square1.enabled);
+    clock(square2.lengthEnabled, square2.lengthCounter, square2.enabled);
+    clock(wave.lengthEnabled, wave.lengthCounter, wave.enabled);
+    clock(noise.lengthEnabled, noise.lengthCounter, noise.enabled);
+}
+
+void APU::clockEnvelopes() {
+    auto clock = [](uint8_t period, uint8_t& timer, uint8_t& volume, bool increase) {
+        if (period == 0) {
+            return;
+        }
+        if (timer > 1) {
+            timer--;
+            return;
+        }
+        timer = period;
+        if (increase && volume < 15) {
+            volume++;
+        }
+        else if (!increase && volume > 0) {
+            volume--;
+        }
+    };
+    clock(square1.envelopePeriod, square1.envelopeTimer, square1.volume, square1.envelopeIncrease);
+    clock(square2.envelopePeriod, square2.envelopeTimer, square2.volume, square2.envelopeIncrease);
+    clock(noise.envelopePeriod, noise.envelopeTimer, noise.volume, noise.envelopeIncrease);
+}
+
+uint16_t APU::sweepCalculation() {
+    uint16_t delta = square1.sweepShadow >> square1.sweepShift;
+    uint16_t frequency = square1.sweepNegate ? square1.sweepShadow - delta : square1.sweepShadow + delta;
+    if (frequency > 2047) {
+        square1.enabled = false;
+    }
+    return frequency;
+}
+
+void APU::clockSweep() {
+    if (square1.sweepTimer > 1) {
+        square1.sweepTimer--;
+        return;
+    }
+    square1.sweepTimer = square1.sweepPeriod ? square1.sweepPeriod : 8;
+
+    if (square1.sweepEnabled && square1.sweepPeriod) {
+        uint16_t frequency = sweepCalculation();
+        if (frequency <= 2047 && square1.sweepShift) {
+            square1.sweepShadow = frequency;
+            square1.frequency = frequency;
+            registers[0x03] = frequency & 0xFF;
+            registers[0x04] = (registers[0x04] & 0xF8) | ((frequency >> 8) & 0x07);
+            sweepCalculation(); // Overflow check with the new frequency
+        }
+    }
+}
+
+// Channel triggers (NRx4 bit 7)
+void APU::triggerSquare(SquareChannel& channel, int index) {
+    channel.enabled = channel.dacEnabled;
+    if (channel.lengthCounter == 0) {
+        channel.lengthCounter = 64;
+    }
+    channel.volume = channel.envelopeInitial;
+    channel.envelopeTimer = channel.envelopePeriod;
+
+    if (index == 1) {
+        channel.sweepShadow = channel.frequency;
+        channel.sweepTimer = channel.sweepPeriod ? channel.sweepPeriod : 8;
+        channel.sweepEnabled = channel.sweepPeriod || channel.sweepShift;
+        if (channel.sweepShift) {
+            sweepCalculation();
+        }
+    }
+}
+
+void APU::triggerWave() {
+    wave.enabled = wave.dacEnabled;
+    if (wave.lengthCounter == 0) {
+        wave.lengthCounter = 256;
+    }
+    wave.phase = 0;
+}
+
+void APU::triggerNoise() {
+    noise.enabled = noise.dacEnabled;
+    if (noise.lengthCounter == 0) {
+        noise.lengthCounter = 64;
+    }
+    noise.volume = noise.envelopeInitial;
+    noise.envelopeTimer = noise.envelopePeriod;
+    noise.lfsr = 0x7FFF;
+    noise.counter = noise.period;
+}
+
+// NR52 power off clears every register except wave RAM
+void APU::powerOff() {
+    std::fill(registers.begin(), registers.begin() + 0x16, 0);
+    square1 = {};
+    square2 = {};
+    wave = {};
+    uint16_t lfsr = noise.lfsr;
+    noise = {};
+    noise.lfsr = lfsr;
+    noise.period = noiseDivisors[0];
+    powered = false;
+}
+
+// Read a sound register
+uint8_t APU::readRegister(uint16_t address) {
+    int index = address - 0xFF10;
+    if (address == 0xFF26) {
+        return (powered ? 0x80 : 0) | 0x70 |
+            (square1.enabled ? 0x01 : 0) | (square2.enabled ? 0x02 : 0) |
+            (wave.enabled ? 0x04 : 0) | (noise.enabled ? 0x08 : 0);
+    }
+    return registers[index] | readMasks[index];
+}
+
+// Write a sound register
+void APU::writeRegister(uint16_t address, uint8_t value) {
+    int index = address - 0xFF10;
+
+    if (address >= 0xFF30) {
+        registers[index] = value; // Wave RAM
+        return;
+    }
+    if (!powered && address != 0xFF26) {
+        return; // Registers are read only while powered off
+    }
+
+    registers[index] = value;
+
+    switch (address) {
+    // Channel 1
+    case 0xFF10:
+        square1.sweepPeriod = (value >> 4) & 0x07;
+        square1.sweepNegate = value & 0x08;
+        square1.sweepShift = value & 0x07;
+        break;
+    case 0xFF11:
+        square1.duty = value >> 6;
+        square1.lengthCounter = 64 - (value & 0x3F);
+        break;
+    case 0xFF12:
+        square1.envelopeInitial = value >> 4;
+        square1.envelopeIncrease = value & 0x08;
+        square1.envelopePeriod = value & 0x07;
+        square1.dacEnabled = (value & 0xF8) != 0;
+        square1.enabled = square1.enabled && square1.dacEnabled;
+        break;
+    case 0xFF13:
+        square1.frequency = (square1.frequency & 0x700) | value;
+        break;
+    case 0xFF14:
+        square1.frequency = (square1.frequency & 0xFF) | ((value & 0x07) << 8);
+        square1.lengthEnabled = value & 0x40;
+        if (value & 0x80) {
+            triggerSquare(square1, 1);
+        }
+        break;
+
+    // Channel 2
+    case 0xFF16:
+        square2.duty = value >> 6;
+        square2.lengthCounter = 64 - (value & 0x3F);
+        break;
+    case 0xFF17:
+        square2.envelopeInitial = value >> 4;
+        square2.envelopeIncrease = value & 0x08;
+        square2.envelopePeriod = value & 0x07;
+        square2.dacEnabled = (value & 0xF8) != 0;
+        square2.enabled = square2.enabled && square2.dacEnabled;
+        break;
+    case 0xFF18:
+        square2.frequency = (square2.frequency & 0x700) | value;
+        break;
+    case 0xFF19:
+        square2.frequency = (square2.frequency & 0xFF) | ((value & 0x07) << 8);
+        square2.lengthEnabled = value & 0x40;
+        if (value & 0x80) {
+            triggerSquare(square2, 2);
+        }
+        break;
+
+    // Channel 3
+    case 0xFF1A:
+        wave.dacEnabled = value & 0x80;
+        wave.enabled = wave.enabled && wave.dacEnabled;
+        break;
+    case 0xFF1B:
+        wave.lengthCounter = 256 - value;
+        break;
+    case 0xFF1C:
+        wave.volumeShift = (value >> 5) & 0x03;
+        break;
+    case 0xFF1D:
+        wave.frequency = (wave.frequency & 0x700) | value;
+        break;
+    case 0xFF1E:
+        wave.frequency = (wave.frequency & 0xFF) | ((value & 0x07) << 8);
+        wave.lengthEnabled = value & 0x40;
+        if (value & 0x80) {
+            triggerWave();
+        }
+        break;
+
+    // Channel 4
+    case 0xFF20:
+        noise.lengthCounter = 64 - (value & 0x3F);
+        break;
+    case 0xFF21:
+        noise.envelopeInitial = value >> 4;
+        noise.envelopeIncrease = value & 0x08;
+        noise.envelopePeriod = value & 0x07;
+        noise.dacEnabled = (value & 0xF8) != 0;
+        noise.enabled = noise.enabled && noise.dacEnabled;
+        break;
+    case 0xFF22:
+        noise.narrow = value & 0x08;
+        noise.period = ((value >> 4) >= 14) ? 0x7FFFFFFF : noiseDivisors[value & 0x07] << (value >> 4);
+        break;
+    case 0xFF23:
+        noise.lengthEnabled = value & 0x40;
+        if (value & 0x80) {
+            triggerNoise();
+        }
+        break;
+
+    // Control
+    case 0xFF26:
+        if (powered && !(value & 0x80)) {
+            powerOff();
+        }
+        else if (!powered && (value & 0x80)) {
+            powered = true;
+            sequencerStep = 0;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Output ring buffer access
+size_t APU::readSamples(int16_t* out, size_t maxFrames) {
+    size_t read = ringRead.load(std::memory_order_relaxed);
+    size_t available = ringWrite.load(std::memory_order_acquire) - read;
+    size_t frames = std::min(available, maxFrames);
+
+    for (size_t i = 0; i < frames; ++i) {
+        size_t index = ((read + i) & (AUDIO_RING_FRAMES - 1)) * 2;
+        out[i * 2] = ring[index];
+        out[i * 2 + 1] = ring[index + 1];
+    }
+
+    ringRead.store(read + frames, std::memory_order_release);
+    return frames;
+}
+
+size_t APU::availableSamples() const {
+    return ringWrite.load(std::memory_order_acquire) - ringRead.load(std::memory_order_relaxed);
+}
+
+uint64_t APU::getDroppedFrames() const {
+    return droppedFrames;
+}
+
+void APU::setMuted(bool muted) {
+    this->muted = muted;
+}
+
+void APU::setTelemetry(FrameTelemetry* telemetry) {
+    this->telemetry = telemetry;
+}
+
+// WAV writer
+WavWriter::WavWriter() : file(nullptr), dataBytes(0), sampleRate(APU_OUTPUT_RATE) {
+}
+
+WavWriter::~WavWriter() {
+    close();
+}
+
+bool WavWriter::open(const std::string& filePath, int sampleRate) {
+    close();
+    file = std::fopen(filePath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    this->sampleRate = sampleRate;
+    dataBytes = 0;
+    writeHeader(); // Sizes are patched on close
+    return true;
+}
+
+void WavWriter::writeHeader() {
+    auto write32 = [this](uint32_t value) {
+        uint8_t bytes[4] = { uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24) };
+        std::fwrite(bytes, 1, 4, file);
+    };
+    auto write16 = [this](uint16_t value) {
+        uint8_t bytes[2] = { uint8_t(value), uint8_t(value >> 8) };
+        std::fwrite(bytes, 1, 2, file);
+    };
+
+    std::fwrite("RIFF", 1, 4, file);
+    write32(36 + dataBytes);
+    std::fwrite("WAVEfmt ", 1, 8, file);
+    write32(16);             // fmt chunk size
+    write16(1);              // PCM
+    write16(2);              // Stereo
+    write32(sampleRate);
+    write32(sampleRate * 4); // Byte rate
+    write16(4);              // Block align
+    write16(16);             // Bits per sample
+    std::fwrite("data", 1, 4, file);
+    write32(dataBytes);
+}
+
+void WavWriter::write(const int16_t* samples, size_t frames) {
+    if (!file) {
+        return;
+    }
+    // WAV data is little endian, as are all supported hosts
+    std::fwrite(samples, sizeof(int16_t) * 2, frames, file);
+    dataBytes += static_cast<uint32_t>(frames * 4);
+}
+
+void WavWriter::write(APU& apu) {
+    int16_t buffer[1024 * 2];
+    size_t frames;
+    while ((frames = apu.readSamples(buffer, 1024)) > 0) {
+        write(buffer, frames);
+    }
+}
+
+void WavWriter::close() {
+    if (!file) {
+        return;
+    }
+    std::fseek(file, 0, SEEK_SET);
+    writeHeader();
+    std::fclose(file);
+    file = nullptr;
+}
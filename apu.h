@@ -0,0 +1,219 @@
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#ifndef apu_H
+#define apu_H
+
+// Timing constants
+constexpr int CPU_CLOCK_HZ = 4194304;
+constexpr int APU_CYCLES_PER_SAMPLE = 32; // Internal synthesis rate: 131072 Hz
+constexpr int APU_INTERNAL_RATE = CPU_CLOCK_HZ / APU_CYCLES_PER_SAMPLE;
+constexpr int APU_OUTPUT_RATE = 48000;
+constexpr int FRAME_SEQUENCER_CYCLES = 8192; // 512 Hz
+constexpr int APU_BLOCK_SIZE = FRAME_SEQUENCER_CYCLES / APU_CYCLES_PER_SAMPLE;
+
+// Band-limited resampler (windowed sinc, polyphase)
+constexpr int RESAMPLER_TAPS = 16;
+constexpr int RESAMPLER_PHASES = 64;
+
+// Output ring buffer, interleaved stereo frames (power of two)
+constexpr size_t AUDIO_RING_FRAMES = 16384;
+
+// Square wave channel (1 and 2), channel 1 adds the frequency sweep
+struct SquareChannel {
+    bool enabled;
+    bool dacEnabled;
+    bool lengthEnabled;
+    int lengthCounter;
+    uint8_t duty;
+    uint16_t frequency;
+    uint32_t phase; // 16.16 fixed point duty step position
+
+    // Volume envelope
+    uint8_t volume;
+    uint8_t envelopeInitial;
+    bool envelopeIncrease;
+    uint8_t envelopePeriod;
+    uint8_t envelopeTimer;
+
+    // Sweep (channel 1 only)
+    uint8_t sweepPeriod;
+    bool sweepNegate;
+    uint8_t sweepShift;
+    uint8_t sweepTimer;
+    bool sweepEnabled;
+    uint16_t sweepShadow;
+};
+
+// Programmable wave channel (3)
+struct WaveChannel {
+    bool enabled;
+    bool dacEnabled;
+    bool lengthEnabled;
+    int lengthCounter;
+    uint8_t volumeShift;
+    uint16_t frequency;
+    uint32_t phase; // 16.16 fixed point sample position
+};
+
+// Noise channel (4)
+struct NoiseChannel {
+    bool enabled;
+    bool dacEnabled;
+    bool lengthEnabled;
+    int lengthCounter;
+    uint16_t lfsr;
+    bool narrow;
+    int period;
+    int counter;
+
+    uint8_t volume;
+    uint8_t envelopeInitial;
+    bool envelopeIncrease;
+    uint8_t envelopePeriod;
+    uint8_t envelopeTimer;
+};
+
+// Everything a save state needs from the APU: registers, channels, the frame sequencer and
+// the cycle synthesis has reached (not the resampler or output ring, which hold audio
+// already produced)
+struct APUState {
+    std::array<uint8_t, 0x30> registers;
+    SquareChannel square1;
+    SquareChannel square2;
+    WaveChannel wave;
+    NoiseChannel noise;
+    bool powered;
+    int sequencerStep;
+    uint64_t lastSyncCycle;
+    uint32_t cycleRemainder;
+    int blockPosition;
+};
+
+class FrameTelemetry;
+
+class APU {
+private:
+    // Raw register values 0xFF10-0xFF3F (NR10-NR52 and wave RAM)
+    std::array<uint8_t, 0x30> registers;
+
+    SquareChannel square1;
+    SquareChannel square2;
+    WaveChannel wave;
+    NoiseChannel noise;
+
+    bool powered;
+    int sequencerStep;
+
+    // Catch-up state
+    uint64_t lastSyncCycle;
+    uint32_t cycleRemainder;
+    int blockPosition; // Samples generated in the current sequencer period
+
+    // Per-block mix buffers at the internal rate
+    float channelBuffer[APU_BLOCK_SIZE];
+    float mixLeft[APU_BLOCK_SIZE];
+    float mixRight[APU_BLOCK_SIZE];
+
+    // Resampler state
+    float historyLeft[RESAMPLER_TAPS + APU_BLOCK_SIZE];
+    float historyRight[RESAMPLER_TAPS + APU_BLOCK_SIZE];
+    int historyLength;
+    double resamplePosition;
+    float capacitorLeft;
+    float capacitorRight;
+
+    // Output ring buffer
+    std::array<int16_t, AUDIO_RING_FRAMES * 2> ring;
+    std::atomic<size_t> ringWrite;
+    std::atomic<size_t> ringRead;
+    uint64_t droppedFrames;
+
+    bool muted; // Sequencer and registers only, no samples (speculative frames)
+
+    FrameTelemetry* telemetry;
+
+    // Synthesis
+    void generate(int samples);
+    void renderBlock(int samples);
+    void renderSquare(SquareChannel& channel, int samples);
+    void renderWave(int samples);
+    void renderNoise(int samples);
+    void mixChannel(int samples, uint8_t leftMask, uint8_t rightMask);
+    void resampleBlock(int samples);
+    void pushFrame(float left, float right);
+
+    // Frame sequencer
+    void clockSequencer();
+    void clockLength();
+    void clockEnvelopes();
+    void clockSweep();
+    uint16_t sweepCalculation();
+
+    // Register side effects
+    void triggerSquare(SquareChannel& channel, int index);
+    void triggerWave();
+    void triggerNoise();
+    void powerOff();
+
+    // Empty the resampler and the output ring
+    void resetOutput();
+
+public:
+    // Constructor
+    APU();
+
+    // Reset APU, with synthesis starting at the given CPU cycle
+    void reset(uint64_t cycle = 0);
+
+    // Save states; loading moves synthesis back (or forward) to the saved cycle
+    void saveState(APUState& state) const;
+    void loadState(const APUState& state);
+    // Copy another APU's sound state; the output starts empty
+    void copyFrom(const APU& other);
+
+    // Keep the channels and registers running without rendering or queueing any audio
+    void setMuted(bool muted);
+
+    // Bring synthesis up to the given CPU cycle
+    void sync(uint64_t cycle);
+    // Called at frame end so output keeps flowing without register writes
+    void endFrame(uint64_t cycle);
+
+    // Sound register access (0xFF10-0xFF3F), callers sync first
+    uint8_t readRegister(uint16_t address);
+    void writeRegister(uint16_t address, uint8_t value);
+
+    // Consume 48 kHz interleaved stereo frames, returns frames copied
+    size_t readSamples(int16_t* out, size_t maxFrames);
+    size_t availableSamples() const;
+    uint64_t getDroppedFrames() const;
+
+    // Report synthesis time to a machine's telemetry (null detaches)
+    void setTelemetry(FrameTelemetry* telemetry);
+};
+
+// Headless PCM16 stereo WAV writer
+class WavWriter {
+private:
+    FILE* file;
+    uint32_t dataBytes;
+    int sampleRate;
+
+    void writeHeader();
+
+public:
+    WavWriter();
+    ~WavWriter();
+
+    bool open(const std::string& filePath, int sampleRate = APU_OUTPUT_RATE);
+    void write(const int16_t* samples, size_t frames);
+    // Drain everything the APU has produced so far
+    void write(APU& apu);
+    void close();
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "cartridge.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+// Build a cartridge from an in-memory image
+std::shared_ptr<const Cartridge> Cartridge::fromData(std::vector<uint8_t> data) {
+    auto cartridge = std::make_shared<Cartridge>();
+
+    // Pad to whole banks so every mapped page is backed
+    size_t banks = (std::max<size_t>(data.size(), 2 * ROM_BANK_SIZE) + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+    data.resize(banks * ROM_BANK_SIZE, 0xFF);
+
+    cartridge->rom = std::move(data);
+    cartridge->romBanks = static_cast<int>(banks);
+    cartridge->parseHeader();
+    return cartridge;
+}
+
+// Load a ROM file, reusing the image if another instance already holds it
+std::shared_ptr<const Cartridge> Cartridge::load(const std::string& filePath) {
+    static std::mutex cacheMutex;
+    static std::map<std::string, std::weak_ptr<const Cartridge>> cache;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (auto cached = cache[filePath].lock()) {
+        return cached;
+    }
+
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        return nullptr;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.empty()) {
+        return nullptr;
+    }
+
+    auto cartridge = fromData(std::move(data));
+    cache[filePath] = cartridge;
+    return cartridge;
+}
+
+// Read the cartridge type and RAM size from the header (0x0134-0x0149)
+void Cartridge::parseHeader() {
+    for (int i = 0x134; i < 0x144 && rom[i] != 0; ++i) {
+        title += static_cast<char>(rom[i]);
+    }
+
+    uint8_t type = rom[0x147];
+    mbc = MBCType::None;
+    battery = false;
+    rtc = false;
+    switch (type) {
+    case 0x01: mbc = MBCType::MBC1; break;
+    case 0x02: mbc = MBCType::MBC1; break;
+    case 0x03: mbc = MBCType::MBC1; battery = true; break;
+    case 0x0F: mbc = MBCType::MBC3; battery = true; rtc = true; break;
+    case 0x10: mbc = MBCType::MBC3; battery = true; rtc = true; break;
+    case 0x11: mbc = MBCType::MBC3; break;
+    case 0x12: mbc = MBCType::MBC3; break;
+    case 0x13: mbc = MBCType::MBC3; battery = true; break;
+    case 0x19: case 0x1A: case 0x1C: case 0x1D: mbc = MBCType::MBC5; break;
+    case 0x1B: case 0x1E: mbc = MBCType::MBC5; battery = true; break;
+    default: break;
+    }
+
+    static const size_t ramSizes[6] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+    uint8_t ramCode = rom[0x149];
+    ramSize = ramCode < 6 ? ramSizes[ramCode] : 0;
+}
@@ -0,0 +1,37 @@
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef cartridge_H
+#define cartridge_H
+
+constexpr int ROM_BANK_SIZE = 0x4000;
+constexpr int RAM_BANK_SIZE = 0x2000;
+
+// Memory bank controller families
+enum class MBCType {
+    None, MBC1, MBC3, MBC5
+};
+
+// Immutable cartridge image, shared read-only by every instance running it
+class Cartridge {
+public:
+    std::vector<uint8_t> rom;
+    std::string title;
+    MBCType mbc;
+    int romBanks;
+    size_t ramSize;
+    bool battery;
+    bool rtc;
+
+    // Load a ROM file; instances loading the same path share one image
+    static std::shared_ptr<const Cartridge> load(const std::string& filePath);
+    // Build a cartridge from an in-memory image
+    static std::shared_ptr<const Cartridge> fromData(std::vector<uint8_t> data);
+
+private:
+    void parseHeader();
+};
+
+#endif
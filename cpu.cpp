@@ -1,11 +1,588 @@
 #include <iostream>
+#include <bit>
+#include <cstring>
 #include "cpu.h"
+#include "gpu.h"
+#include "apu.h"
+
+// Base T-cycle cost of each opcode (conditional branches are listed as not taken)
+static const uint8_t instructionCycles[256] = {
+//  0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F
+	 4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4, // 0x00
+	 4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4, // 0x10
+	 8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 0x20
+	 8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4, // 0x30
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x40
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x50
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x60
+	 8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4, // 0x70
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x80
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0x90
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0xA0
+	 4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4, // 0xB0
+	 8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  4, 12, 24,  8, 16, // 0xC0
+	 8, 12, 12,  4, 12, 16,  8, 16,  8, 16, 12,  4, 12,  4,  8, 16, // 0xD0
+	12, 12,  8,  4,  4, 16,  8, 16, 16,  4, 16,  4,  4,  4,  8, 16, // 0xE0
+	12, 12,  8,  4,  4, 16,  8, 16, 12,  8, 16,  4,  4,  4,  8, 16  // 0xF0
+};
+
+// I/O register dispatch table for 0xFF00-0xFF7F
+static std::array<CPU::IOHandler, 0x80> buildIOHandlers() {
+	std::array<CPU::IOHandler, 0x80> handlers;
+	handlers.fill({ &CPU::readIORegister, &CPU::writeIORegister });
+
+	// Joypad
+	handlers[0x00] = { &CPU::readJoypad, &CPU::writeJoypad };
+
+	// Timer
+	handlers[0x04] = { &CPU::readDIV, &CPU::writeDIV };
+	handlers[0x05] = { &CPU::readTIMA, &CPU::writeTIMA };
+	handlers[0x06] = { &CPU::readTMA, &CPU::writeTMA };
+	handlers[0x07] = { &CPU::readTAC, &CPU::writeTAC };
+
+	// Interrupt Flag
+	handlers[0x0F] = { &CPU::readIF, &CPU::writeIF };
+
+	// Sound (0xFF10-0xFF26) and wave RAM (0xFF30-0xFF3F)
+	for (int i = 0x10; i <= 0x3F; ++i) {
+		handlers[i] = { &CPU::readSoundRegister, &CPU::writeSoundRegister };
+	}
+
+	// LCD (0xFF40-0xFF4B)
+	for (int i = 0x40; i <= 0x4B; ++i) {
+		handlers[i] = { &CPU::readLCDRegister, &CPU::writeLCDRegister };
+	}
+	handlers[0x46] = { &CPU::readLCDRegister, &CPU::writeDMA };
+	return handlers;
+}
+
+const std::array<CPU::IOHandler, 0x80> CPU::ioHandlers = buildIOHandlers();
 
 // Constructor and Initialization
 CPU::CPU(): A(0), B(0), C(0), D(0), E(0), H(0), L(0), PC(0), SP(0xFF), zeroFlag(false), 
-	carryFlag(false), halfCarryFlag(false), ime(false), 
-	pendingIME(false), timerCounter(0), timerValue(0), timerFrequency(0){
-	std::fill(std::begin(memory), std::end(memory), 0);
+	subtractFlag(false), carryFlag(false), halfCarryFlag(false), ime(false), 
+	pendingIME(false), romBank(1), ramBank(0), bankUpper(0), ramEnabled(false), bankingMode(false), rtc(),
+	interruptEnable(0), interruptFlags(0), pendingInterrupts(0),
+	cycleCount(0), dmaEndCycle(0), gpu(nullptr), apu(nullptr), debugger(nullptr), trace(nullptr), joypadButtons(0), joypadSelect(0x30), dividerBase(0), timerCycle(0), timerOverflowCycle(UINT64_MAX), timerValue(0), timerModulo(0), timerControl(0),
+	gpuCycle(0), gpuEventCycle(UINT64_MAX), nextEventCycle(UINT64_MAX), loopPending(false){
+	wram.assign(WRAM_SIZE);
+	io.fill(0);
+	hram.fill(0);
+	mapMemory();
+}
+
+// OAM DMA length: 160 M-cycles
+constexpr uint64_t DMA_CYCLES = 160 * 4;
+
+// What pages below the I/O page read while OAM DMA holds the bus
+static const std::array<uint8_t, MEMORY_PAGE_SIZE> openBusPage = [] {
+	std::array<uint8_t, MEMORY_PAGE_SIZE> page;
+	page.fill(0xFF);
+	return page;
+}();
+
+// Memory bus: mapped pages are a direct array access, everything else takes the slow path
+uint8_t CPU::read8(uint16_t address) {
+	if (const uint8_t* page = memoryMap.read[address >> 8]) {
+		return page[address & 0xFF];
+	}
+	return readSlow(address);
+}
+
+void CPU::write8(uint16_t address, uint8_t value) {
+	if (uint8_t* page = memoryMap.write[address >> 8]) {
+		page[address & 0xFF] = value;
+		return;
+	}
+	writeSlow(address, value);
+}
+
+// Watched pages are unmapped, so only their accesses reach the debugger
+uint8_t CPU::readSlow(uint16_t address) {
+	uint8_t value = readBus(address);
+	if (debugger && (debugger->getPageFlags(address >> 8) & WATCH_READ)) {
+		debugger->onAccess(address, value, WATCH_READ);
+	}
+	return value;
+}
+
+void CPU::writeSlow(uint16_t address, uint8_t value) {
+	if (dmaEndCycle && address < 0xFF00) {
+		return; // Bus held by OAM DMA: every page below I/O is unmapped for writes
+	}
+	writeBus(address, value);
+	if (debugger && (debugger->getPageFlags(address >> 8) & WATCH_WRITE)) {
+		debugger->onAccess(address, value, WATCH_WRITE);
+	}
+}
+
+// Full address decode, for pages the page table does not map directly
+uint8_t CPU::readBus(uint16_t address) {
+	if (address < 0x8000) {
+		if (!cartridge) {
+			return 0xFF;
+		}
+		size_t bank = (address < 0x4000 ? lowROMBank() : romBank) % cartridge->romBanks;
+		return cartridge->rom[bank * ROM_BANK_SIZE + (address & 0x3FFF)];
+	}
+	if (address < 0xA000) {
+		return gpu ? gpu->vram[address - 0x8000] : 0xFF;
+	}
+	if (address < 0xC000) {
+		if (isRTCMapped()) {
+			return rtc.latched[ramBank - 0x08];
+		}
+		return isSRAMMapped() ? *sram.readPointer(sramOffset(address)) : 0xFF;
+	}
+	if (address < 0xFE00) {
+		return *wram.readPointer(address & 0x1FFF);
+	}
+	if (address >= 0xFF80 && address < 0xFFFF) {
+		return hram[address - 0xFF80];
+	}
+	if ((address & 0xFF80) == 0xFF00) {
+		return (this->*ioHandlers[address & 0x7F].read)(address);
+	}
+	if (address == 0xFFFF) {
+		return interruptEnable;
+	}
+	if (gpu && address < 0xFE00 + OAM_SIZE) {
+		return gpu->oam[address - 0xFE00];
+	}
+	return 0xFF; // Unmapped: no cartridge, disabled cartridge RAM, unusable area
+}
+
+void CPU::writeBus(uint16_t address, uint8_t value) {
+	if (address < 0x8000) {
+		writeMBC(address, value);
+	}
+	else if (address < 0xA000) {
+		if (gpu) {
+			syncGPU(); // Lines still to be drawn see the old tiles
+			gpu->writeVRAM(address - 0x8000, value);
+		}
+	}
+	else if (address < 0xC000) {
+		if (isRTCMapped()) {
+			writeRTC(value);
+		}
+		else if (isSRAMMapped()) {
+			// Write to a chunk still shared with a copy of this machine (or a watched page)
+			*sram.unshare(sramOffset(address)) = value;
+			mapRAM();
+		}
+	}
+	else if (address < 0xFE00) {
+		*wram.unshare(address & 0x1FFF) = value;
+		mapWRAM();
+	}
+	else if (address >= 0xFF80 && address < 0xFFFF) {
+		hram[address - 0xFF80] = value;
+	}
+	else if ((address & 0xFF80) == 0xFF00) {
+		(this->*ioHandlers[address & 0x7F].write)(address, value);
+	}
+	else if (address == 0xFFFF) {
+		setInterruptEnable(value);
+	}
+	else if (gpu && address < 0xFE00 + OAM_SIZE) {
+		syncGPU();
+		gpu->writeOAM(address - 0xFE00, value);
+	}
+}
+
+// Memory Mapping
+void CPU::insertCartridge(std::shared_ptr<const Cartridge> cartridge) {
+	this->cartridge = std::move(cartridge);
+	sram.assign(this->cartridge ? this->cartridge->ramSize : 0);
+	rtc = {};
+	rtc.cycle = cycleCount;
+	romBank = 1;
+	ramBank = bankUpper = 0;
+	ramEnabled = bankingMode = false;
+	mapMemory();
+}
+
+// Rebuild the whole page table
+void CPU::mapMemory() {
+	std::fill(std::begin(memoryMap.read), std::end(memoryMap.read), nullptr);
+	std::fill(std::begin(memoryMap.write), std::end(memoryMap.write), nullptr);
+
+	mapROM();
+	mapRAM();
+
+	// Video RAM lives in the GPU; writes go through writeBus so it can catch up first
+	// (and a pipelined GPU can log them for its render thread)
+	if (gpu) {
+		for (int page = 0x80; page < 0xA0; ++page) {
+			memoryMap.read[page] = &gpu->vram[(page - 0x80) * MEMORY_PAGE_SIZE];
+		}
+	}
+
+	mapWRAM();
+}
+
+// While OAM DMA holds the bus everything below the I/O page reads 0xFF and ignores writes;
+// the page table is rebuilt when dmaEndCycle comes up in serviceEvents
+void CPU::mapDMA() {
+	if (!dmaEndCycle) {
+		return;
+	}
+	std::fill(memoryMap.read, memoryMap.read + 0xFF, openBusPage.data());
+	std::fill(memoryMap.write, memoryMap.write + 0xFF, nullptr);
+}
+
+// Work RAM and its echo at 0xE000-0xFDFF; chunks shared with a copy stay read only
+void CPU::mapWRAM() {
+	for (int page = 0xC0; page < 0xE0; ++page) {
+		size_t offset = (page - 0xC0) * MEMORY_PAGE_SIZE;
+		memoryMap.read[page] = wram.readPointer(offset);
+		memoryMap.write[page] = wram.writePointer(offset);
+	}
+	std::copy(memoryMap.read + 0xC0, memoryMap.read + 0xDE, memoryMap.read + 0xE0);
+	std::copy(memoryMap.write + 0xC0, memoryMap.write + 0xDE, memoryMap.write + 0xE0);
+	protectWatchedPages();
+	mapDMA();
+}
+
+// ROM pages are read only; writes fall through to the MBC
+void CPU::mapROM() {
+	if (!cartridge) {
+		return;
+	}
+	const uint8_t* bank0 = cartridge->rom.data() + (lowROMBank() % cartridge->romBanks) * ROM_BANK_SIZE;
+	const uint8_t* bankN = cartridge->rom.data() + (romBank % cartridge->romBanks) * ROM_BANK_SIZE;
+	for (int page = 0; page < 0x40; ++page) {
+		memoryMap.read[page] = bank0 + page * MEMORY_PAGE_SIZE;
+		memoryMap.read[page + 0x40] = bankN + page * MEMORY_PAGE_SIZE;
+	}
+	protectWatchedPages();
+	mapDMA();
+}
+
+void CPU::mapRAM() {
+	bool mapped = isSRAMMapped();
+
+	for (int page = 0xA0; page < 0xC0; ++page) {
+		if (mapped) {
+			size_t offset = sramOffset(page << 8);
+			memoryMap.read[page] = sram.readPointer(offset);
+			memoryMap.write[page] = sram.writePointer(offset);
+		}
+		else {
+			memoryMap.read[page] = memoryMap.write[page] = nullptr;
+		}
+	}
+	protectWatchedPages();
+	mapDMA();
+}
+
+// Route accesses to pages with watchpoints through the slow path
+void CPU::protectWatchedPages() {
+	if (!debugger) {
+		return;
+	}
+	for (int page = 0; page < MEMORY_PAGE_COUNT; ++page) {
+		uint8_t flags = debugger->getPageFlags(page);
+		if (flags & WATCH_READ) {
+			memoryMap.read[page] = nullptr;
+		}
+		if (flags & WATCH_WRITE) {
+			memoryMap.write[page] = nullptr;
+		}
+	}
+}
+
+// RAM enabled and a RAM bank (not an MBC3 clock register) selected
+bool CPU::isSRAMMapped() const {
+	return ramEnabled && !sram.empty() && ramBank < 0x08;
+}
+
+// MBC3 with a clock and one of its registers (0x08-0x0C) selected
+bool CPU::isRTCMapped() const {
+	return ramEnabled && cartridge && cartridge->rtc && ramBank >= 0x08 && ramBank <= 0x0C;
+}
+
+// ROM bank at 0x0000-0x3FFF: bank 0, except on MBC1 in mode 1 (bank 0x20, 0x40 or 0x60 on
+// large cartridges)
+size_t CPU::lowROMBank() const {
+	return cartridge && cartridge->mbc == MBCType::MBC1 && bankingMode ? bankUpper << 5 : 0;
+}
+
+// Offset into cartridge RAM of an address in 0xA000-0xBFFF for the current bank
+size_t CPU::sramOffset(uint16_t address) const {
+	size_t banks = sram.size() / RAM_BANK_SIZE;
+	// Cartridges with less than one full bank mirror it
+	return banks ? (ramBank % banks) * RAM_BANK_SIZE + (address - 0xA000)
+		: (address - 0xA000) % sram.size();
+}
+
+// Memory bank controller registers (writes to 0x0000-0x7FFF)
+void CPU::writeMBC(uint16_t address, uint8_t value) {
+	if (!cartridge) {
+		return;
+	}
+
+	switch (cartridge->mbc) {
+	case MBCType::MBC1:
+		if (address < 0x2000) {
+			ramEnabled = (value & 0x0F) == 0x0A;
+		}
+		else if (address < 0x4000) {
+			romBank = (value & 0x1F) ? (value & 0x1F) : 1;
+		}
+		else if (address < 0x6000) {
+			bankUpper = value & 0x03;
+		}
+		else {
+			bankingMode = value & 0x01;
+		}
+		// The upper bits always extend the switchable ROM bank; mode 1 also applies them to
+		// 0x0000-0x3FFF and the RAM bank
+		ramBank = bankingMode ? bankUpper : 0;
+		romBank = (romBank & 0x1F) | (bankUpper << 5);
+		break;
+	case MBCType::MBC3:
+		if (address < 0x2000) {
+			ramEnabled = (value & 0x0F) == 0x0A;
+		}
+		else if (address < 0x4000) {
+			romBank = (value & 0x7F) ? (value & 0x7F) : 1;
+		}
+		else if (address < 0x6000) {
+			ramBank = value; // 0x08-0x0C select RTC registers (left unmapped)
+		}
+		else if (cartridge->rtc) {
+			if (rtc.latchValue == 0x00 && value == 0x01) {
+				latchRTC();
+			}
+			rtc.latchValue = value;
+		}
+		break;
+	case MBCType::MBC5:
+		if (address < 0x2000) {
+			ramEnabled = (value & 0x0F) == 0x0A;
+		}
+		else if (address < 0x3000) {
+			romBank = (romBank & 0x100) | value;
+		}
+		else if (address < 0x4000) {
+			romBank = (romBank & 0xFF) | ((value & 0x01) << 8);
+		}
+		else if (address < 0x6000) {
+			ramBank = value & 0x0F;
+		}
+		break;
+	default:
+		return;
+	}
+
+	mapROM();
+	mapRAM();
+}
+
+// MBC3 clock
+void CPU::updateRTC() {
+	uint64_t elapsed = cycleCount - rtc.cycle;
+	rtc.cycle = cycleCount;
+	if (rtc.registers[4] & 0x40) {
+		return; // Halted
+	}
+	uint64_t cycles = rtc.subsecond + elapsed;
+	rtc.subsecond = cycles % CPU_CLOCK_HZ;
+	advanceRTC(cycles / CPU_CLOCK_HZ);
+}
+
+// Also used to catch up on the time that passed while the emulator was not running
+void CPU::advanceRTC(uint64_t seconds) {
+	if (seconds == 0 || (rtc.registers[4] & 0x40)) {
+		return;
+	}
+	uint8_t* r = rtc.registers;
+	uint64_t carry = r[0] + seconds;
+	r[0] = carry % 60;
+	carry = carry / 60 + r[1];
+	r[1] = carry % 60;
+	carry = carry / 60 + r[2];
+	r[2] = carry % 24;
+	uint64_t days = carry / 24 + (((r[4] & 0x01) << 8) | r[3]);
+	if (days > 0x1FF) {
+		r[4] |= 0x80; // Day counter overflow, sticky until written
+	}
+	r[3] = days & 0xFF;
+	r[4] = (r[4] & 0xFE) | ((days >> 8) & 0x01);
+}
+
+void CPU::latchRTC() {
+	updateRTC();
+	std::memcpy(rtc.latched, rtc.registers, sizeof(rtc.registers));
+}
+
+void CPU::writeRTC(uint8_t value) {
+	static const uint8_t masks[5] = { 0x3F, 0x3F, 0x1F, 0xFF, 0xC1 };
+	updateRTC(); // Time up to now counts under the old halt state
+	int index = ramBank - 0x08;
+	rtc.registers[index] = value & masks[index];
+	rtc.latched[index] = rtc.registers[index];
+	if (index == 0) {
+		rtc.subsecond = 0; // Writing the seconds restarts the second
+	}
+}
+
+// I/O Registers
+uint8_t CPU::readJoypad(uint16_t) {
+	uint8_t pressed = 0;
+	if (!(joypadSelect & 0x10)) {
+		pressed |= joypadButtons & 0x0F; // Direction keys
+	}
+	if (!(joypadSelect & 0x20)) {
+		pressed |= joypadButtons >> 4; // Action buttons
+	}
+	return 0xC0 | joypadSelect | (~pressed & 0x0F);
+}
+
+void CPU::writeJoypad(uint16_t, uint8_t value) {
+	joypadSelect = value & 0x30;
+}
+
+uint8_t CPU::readIORegister(uint16_t address) {
+	return io[address & 0x7F];
+}
+
+void CPU::writeIORegister(uint16_t address, uint8_t value) {
+	io[address & 0x7F] = value;
+}
+
+uint8_t CPU::readIF(uint16_t) {
+	return interruptFlags | 0xE0; // Upper bits read as 1
+}
+
+void CPU::writeIF(uint16_t, uint8_t value) {
+	setInterruptFlags(value);
+}
+
+uint8_t CPU::readDIV(uint16_t) {
+	return systemCounter() >> 8;
+}
+
+// Any write resets the whole system counter, which is a falling edge if TIMA's bit was set
+void CPU::writeDIV(uint16_t, uint8_t) {
+	updateTimer();
+	if (timerSignal()) {
+		incrementTimer(1);
+	}
+	dividerBase = cycleCount;
+	scheduleTimer();
+}
+
+uint8_t CPU::readTIMA(uint16_t) {
+	updateTimer();
+	return timerValue;
+}
+
+void CPU::writeTIMA(uint16_t, uint8_t value) {
+	updateTimer();
+	timerValue = value;
+	scheduleTimer();
+}
+
+uint8_t CPU::readTMA(uint16_t) {
+	return timerModulo;
+}
+
+void CPU::writeTMA(uint16_t, uint8_t value) {
+	updateTimer();
+	timerModulo = value;
+}
+
+uint8_t CPU::readTAC(uint16_t) {
+	return timerControl | 0xF8;
+}
+
+// Disabling the timer or switching bits drops the signal, which counts as a falling edge
+void CPU::writeTAC(uint16_t, uint8_t value) {
+	updateTimer();
+	bool before = timerSignal();
+	timerControl = value & 0x07;
+	if (before && !timerSignal()) {
+		incrementTimer(1);
+	}
+	scheduleTimer();
+}
+
+// LCD registers: the GPU catches up before any write, and before STAT and LY reads (the
+// only ones that change on their own). LCDC, STAT and LYC writes move its next event.
+uint8_t CPU::readLCDRegister(uint16_t address) {
+	if (!gpu) {
+		return io[address & 0x7F];
+	}
+	if (address == 0xFF41 || address == 0xFF44) {
+		syncGPU();
+	}
+	return gpu->readRegister(address);
+}
+
+void CPU::writeLCDRegister(uint16_t address, uint8_t value) {
+	if (gpu) {
+		syncGPU();
+		if (uint8_t interrupts = gpu->writeRegister(address, value)) {
+			requestInterrupt(interrupts);
+		}
+		if (address == 0xFF40 || address == 0xFF41 || address == 0xFF45) {
+			scheduleGPU();
+		}
+	}
+	else {
+		io[address & 0x7F] = value;
+	}
+}
+
+// Sound registers: the APU catches up before any write, and before NR52 status reads
+uint8_t CPU::readSoundRegister(uint16_t address) {
+	if (!apu) {
+		return io[address & 0x7F];
+	}
+	if (address == 0xFF26) {
+		apu->sync(cycleCount);
+	}
+	return apu->readRegister(address);
+}
+
+void CPU::writeSoundRegister(uint16_t address, uint8_t value) {
+	if (!apu) {
+		io[address & 0x7F] = value;
+		return;
+	}
+	apu->sync(cycleCount);
+	apu->writeRegister(address, value);
+}
+
+// OAM DMA: copy the whole source page at once and hold the bus until it would have finished
+void CPU::writeDMA(uint16_t address, uint8_t value) {
+	writeLCDRegister(address, value);
+	if (!gpu) {
+		return;
+	}
+
+	uint16_t source = value << 8;
+	if (source >= 0xE000) {
+		source -= 0x2000; // 0xE0-0xFF read through echo RAM
+	}
+	if (const uint8_t* sourceData = dmaEndCycle ? nullptr : memoryMap.read[source >> 8]) {
+		gpu->loadOAM(sourceData);
+	}
+	else {
+		// Source not directly mapped (disabled cartridge RAM, watched page, a DMA still running)
+		uint8_t data[OAM_SIZE];
+		for (int i = 0; i < OAM_SIZE; ++i) {
+			data[i] = readBus(source + i);
+		}
+		gpu->loadOAM(data);
+	}
+
+	dmaEndCycle = cycleCount + DMA_CYCLES;
+	mapDMA();
+	scheduleEvents();
 }
 
 // SP sets/gets
@@ -35,31 +612,31 @@ void CPU::ldFrom(uint8_t &destReg, uint8_t &srcReg) {
 }
 
 void CPU::loadFromAddress(uint8_t &destReg, uint16_t address) {
-	destReg = memory[address];
+	destReg = read8(address);
 }
 
 void CPU::storeToMemory(uint16_t address, uint8_t &srcReg) {
-	memory[address] = srcReg;
+	write8(address, srcReg);
 }
 
 void CPU::loadFromRegisterPair(uint8_t &destReg, uint8_t srcReg1, uint8_t srcReg2) {
 	uint16_t address = (srcReg1 << 8) | srcReg2;  // Combine H and L to form 16-bit address
-	destReg = memory[address];
+	destReg = read8(address);
 }
 
 void CPU::storeToRegisterPair(uint8_t srcReg, uint8_t destReg1, uint8_t destReg2) {
 	uint16_t address = (destReg1 << 8) | destReg2;  // Combine H and L to form 16-bit address
-	memory[address] = srcReg;
+	write8(address, srcReg);
 }
 
 void CPU::loadFromMemory(uint8_t &destReg, uint16_t high, uint8_t low) {
 	uint16_t address = (high << 8) | low;
-	destReg = memory[address];
+	destReg = read8(address);
 }
 
 void CPU::storeToMemory(uint8_t high, uint8_t low, uint8_t value) {
 	uint16_t address = (high << 8) | low;
-	memory[address] = value;
+	write8(address, value);
 }
 
 void CPU::incrementRegisterPair(uint8_t& high, uint8_t& low) {
@@ -77,7 +654,7 @@ void CPU::decrementRegisterPair(uint8_t& high, uint8_t& low) {
 }
 
 void CPU::storeToAddress(uint16_t address, uint8_t reg) {
-	memory[address] = reg;
+	write8(address, reg);
 }
 
 // Jump Instructions
@@ -91,163 +668,163 @@ void CPU::jpIfZero(uint16_t address) {
 	}
 }
 
+void CPU::jr(int8_t offset) {
+	PC += offset;
+}
+
+// Returns the extra cycles of a taken jump
+uint8_t CPU::jrIf(bool condition) {
+	int8_t offset = static_cast<int8_t>(fetch());
+	if (!condition) {
+		return 0;
+	}
+	PC += offset;
+	loopPending = offset < 0;
+	return 4;
+}
+
 // Arithmetic Instructions
 void CPU::add(uint8_t &destReg, uint8_t srcReg) {
 	uint16_t result = destReg + srcReg;
 	zeroFlag = (result & 0xFF) == 0;
+	subtractFlag = false;
 	carryFlag = result > 0xFF;
 	halfCarryFlag = ((destReg & 0x0F) + (srcReg & 0x0F)) > 0x0F;
 	destReg = result & 0xFF;
 }
 
+// The *Pair forms take their operand from memory at (HL)
 void CPU::addPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2) {
-	uint16_t HL = (srcReg1 << 8) | srcReg2;
-	uint16_t result = destReg + HL;
-	zeroFlag = (result & 0xFF) == 0;
-	carryFlag = result > 0xFF;
-	halfCarryFlag = ((destReg & 0x0F) + (HL & 0x0F)) > 0x0F;
-	destReg = result & 0xFF;
+	add(destReg, read8((srcReg1 << 8) | srcReg2));
 }
 
 void CPU::addPairs(uint8_t& highDest, uint8_t& lowDest, uint8_t highSrc, uint8_t lowSrc) {
 	uint16_t dest = (highDest << 8) | lowDest;
 	uint16_t src = (highSrc << 8) | lowSrc;
 	uint32_t result = dest + src;
+	subtractFlag = false; // Zero is left alone
 	carryFlag = (result > 0xFFFF);
 	halfCarryFlag = ((dest & 0x0FFF) + (src & 0x0FFF)) > 0x0FFF;
 	highDest = (result >> 8) & 0xFF;
 	lowDest = result & 0xFF;
+}
+
+// ADD SP,e8 (flags come from the low byte, like an unsigned 8 bit add)
+void CPU::addToSP(int8_t offset) {
+	uint8_t low = SP & 0xFF;
+	uint8_t value = static_cast<uint8_t>(offset);
 	zeroFlag = false;
+	subtractFlag = false;
+	halfCarryFlag = ((low & 0x0F) + (value & 0x0F)) > 0x0F;
+	carryFlag = (low + value) > 0xFF;
+	SP += offset;
 }
 
 void CPU::adc(uint8_t& destReg, uint8_t srcReg) {
 	uint8_t carryValue = carryFlag ? 1 : 0;
 	uint16_t result = destReg + srcReg + carryValue;
 	zeroFlag = (result & 0xFF) == 0;
+	subtractFlag = false;
 	carryFlag = result > 0xFF;
 	halfCarryFlag = ((destReg & 0x0F) + (srcReg & 0x0F) + carryValue) > 0x0F;
 	destReg = result & 0xFF;
 }
 
 void CPU::adcPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2) {
-	uint8_t carryValue = carryFlag ? 1 : 0;
-	uint16_t result = destReg + srcReg1 + srcReg2 + carryValue;
-	zeroFlag = (result & 0xFF) == 0;
-	halfCarryFlag = ((destReg & 0x0F) + (srcReg1 & 0x0F) + (srcReg2 & 0x0F) + carryValue) > 0x0F;
-	destReg = result & 0xFF;
+	adc(destReg, read8((srcReg1 << 8) | srcReg2));
 }
 
 void CPU::sub(uint8_t &destReg, uint8_t srcReg) {
-	uint16_t result = destReg - srcReg;
-	zeroFlag = (result & 0xFF) == 0;
-	carryFlag = result < 0;
+	uint8_t result = destReg - srcReg;
+	zeroFlag = result == 0;
+	subtractFlag = true;
+	carryFlag = destReg < srcReg;
 	halfCarryFlag = (destReg & 0x0F) < (srcReg & 0x0F);
-	destReg = result & 0xFF;
+	destReg = result;
 }
 
 void CPU::subPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2) {
-	uint16_t HL = (srcReg1 << 8) | srcReg2;
-	uint16_t result = destReg - HL;
-	zeroFlag = (result & 0xFF) == 0;
-	carryFlag = result > 0xFF;
-	halfCarryFlag = ((destReg & 0x0F) < (HL & 0x0F));
-	destReg = result & 0xFF;
+	sub(destReg, read8((srcReg1 << 8) | srcReg2));
 }
 
 void CPU::sbc(uint8_t& destReg, uint8_t srcReg) {
 	uint8_t carryValue = carryFlag ? 1 : 0;
 	uint16_t result = destReg - srcReg - carryValue;
 	zeroFlag = (result & 0xFF) == 0;
+	subtractFlag = true;
 	carryFlag = result > 0xFF;
 	halfCarryFlag = ((destReg & 0x0F) < ((srcReg & 0x0F) + carryValue));
 	destReg = result & 0xFF;
 }
 
 void CPU::sbcPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2) {
-	uint8_t carryValue = carryFlag ? 1 : 0;
-	uint16_t result = destReg - srcReg1 - srcReg2 - carryValue;
-	zeroFlag = (result & 0xFF) == 0;
-	carryFlag = result > 0xFF;
-	halfCarryFlag = ((destReg & 0x0F) < ((srcReg1 & 0x0F) + (srcReg2 & 0x0F) + carryValue));
-	destReg = result & 0xFF;
+	sbc(destReg, read8((srcReg1 << 8) | srcReg2));
 }
 
-void CPU::inc(uint8_t destReg) {
-	uint16_t result = destReg + 1;
-	zeroFlag = (result & 0xFF) == 0;
-	carryFlag = result > 0xFF;
-	halfCarryFlag = (destReg & 0xFF) == 0x0F;
-	destReg = result & 0xFF;
+// INC and DEC leave the carry alone
+void CPU::inc(uint8_t& destReg) {
+	destReg++;
+	zeroFlag = destReg == 0;
+	subtractFlag = false;
+	halfCarryFlag = (destReg & 0x0F) == 0;
 }
 
-void CPU::dec(uint8_t destReg) {
-	uint16_t result = destReg - 1;
-	zeroFlag = (result & 0xFF) == 0;
-	carryFlag = destReg == 0;
-	halfCarryFlag = (destReg & 0xFF) == 0;
-	destReg = result & 0xFF;
+void CPU::dec(uint8_t& destReg) {
+	destReg--;
+	zeroFlag = destReg == 0;
+	subtractFlag = true;
+	halfCarryFlag = (destReg & 0x0F) == 0x0F;
 }
 
-void CPU::incPair(uint8_t &destReg1, uint8_t &destReg2) {
-	if (++destReg2 == 0) {
-		++destReg1;
-	}
-	zeroFlag = (destReg1 == 0 && destReg2 == 0);
-	halfCarryFlag = (destReg2 == 0);
+void CPU::incPair(uint8_t srcReg1, uint8_t srcReg2) {
+	uint16_t address = (srcReg1 << 8) | srcReg2;
+	uint8_t value = read8(address);
+	inc(value);
+	write8(address, value);
 }
 
-void CPU::decPair(uint8_t& destReg1, uint8_t& destReg2) {
-	if (--destReg2 == 0xFF) {
-		--destReg1;
-	}
-	zeroFlag = (destReg1 == 0 && destReg2 == 0);
-	halfCarryFlag = (destReg2 == 0x0F);
+void CPU::decPair(uint8_t srcReg1, uint8_t srcReg2) {
+	uint16_t address = (srcReg1 << 8) | srcReg2;
+	uint8_t value = read8(address);
+	dec(value);
+	write8(address, value);
 }
 
 // Logical Instructions
 void CPU::andOp(uint8_t &destReg, uint8_t srcReg) {
 	destReg = destReg & srcReg;
 	zeroFlag = (destReg == 0);
+	subtractFlag = false;
 	halfCarryFlag = true;
 	carryFlag = false;
 }
 
 void CPU::andOpPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2) {
-	uint16_t HL = (srcReg1 >> 8) | srcReg2;
-	destReg &= HL;
-	zeroFlag = (destReg == 0);
-	carryFlag = false;
-	halfCarryFlag = false;
+	andOp(destReg, read8((srcReg1 << 8) | srcReg2));
 }
 
 void CPU::orOp(uint8_t &destReg, uint8_t srcReg) {
 	destReg = destReg | srcReg;
 	zeroFlag = (destReg == 0);
+	subtractFlag = false;
 	halfCarryFlag = false;
 	carryFlag = false;
 }
 
 void CPU::orOpPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2) {
-	uint16_t HL = (srcReg1 >> 8) | srcReg2;
-	destReg |= HL;
-	zeroFlag = (destReg == 0);
-	carryFlag = false;
-	halfCarryFlag = false;
+	orOp(destReg, read8((srcReg1 << 8) | srcReg2));
 }
 
 void CPU::xorOp(uint8_t &destReg, uint8_t srcReg) {
 	destReg = destReg ^ srcReg;
 	zeroFlag  = (destReg == 0);
+	subtractFlag = false;
 	halfCarryFlag = false;
 	carryFlag = false;
 }
 
 void CPU::xorOpPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2) {
-	uint16_t HL = (srcReg1 >> 8) | srcReg2;
-	destReg ^= HL;
-	zeroFlag = (destReg == 0);
-	carryFlag = false;
-	halfCarryFlag = false;
+	xorOp(destReg, read8((srcReg1 << 8) | srcReg2));
 }
 
 // Shift instructions
@@ -255,6 +832,7 @@ void CPU::shiftLeft(uint8_t &destReg) {
 	carryFlag = (destReg & 0x80) != 0;
 	destReg = destReg << 1;
 	zeroFlag = (destReg == 0);
+	subtractFlag = false;
 	halfCarryFlag = false;
 }
 
@@ -262,6 +840,7 @@ void CPU::shiftRight(uint8_t &destReg) {
 	carryFlag = (destReg & 0x01) != 0;
 	destReg = destReg >> 1;
 	zeroFlag = (destReg == 0);
+	subtractFlag = false;
 	halfCarryFlag = false;
 }
 
@@ -270,6 +849,7 @@ void CPU::rotateLeft(uint8_t &destReg) {
 	carryFlag = (destReg & 0x80) != 0;
 	destReg = (destReg << 1) | (destReg >> 7);
 	zeroFlag = (destReg == 0);
+	subtractFlag = false;
 	halfCarryFlag = false;
 }
 
@@ -277,26 +857,37 @@ void CPU::rotateRight(uint8_t &destReg) {
 	carryFlag = (destReg & 0x01) != 0;
 	destReg = (destReg >> 1) | (destReg << 7);
 	zeroFlag = (destReg == 0);
+	subtractFlag = false;
 	halfCarryFlag = false;
 }
 
 // Comparison instructions
 void CPU::comp(uint8_t srcReg, uint8_t srcReg2) {
-	uint16_t result = srcReg - srcReg2;
-	zeroFlag = (result == 0);
+	zeroFlag = (srcReg == srcReg2);
+	subtractFlag = true;
 	carryFlag = (srcReg < srcReg2);
-	halfCarryFlag = (srcReg * 0x0F) < (srcReg2 & 0x0F);
+	halfCarryFlag = (srcReg & 0x0F) < (srcReg2 & 0x0F);
 }
 
 void CPU::compPair(uint8_t srcReg1, uint8_t srcReg2, uint8_t srcReg3) {
-	uint16_t HL = (srcReg2 << 8) | srcReg3;
-	uint16_t result = HL - A;
-	zeroFlag = ((result & 0xFF) == 0);
-	carryFlag = (HL < A);
-	halfCarryFlag = ((HL & 0x0F) < (A & 0x0F));
+	comp(srcReg1, read8((srcReg2 << 8) | srcReg3));
 }
 
 // Interrupt Handling
+void CPU::requestInterrupt(uint8_t interrupt) {
+	setInterruptFlags(interruptFlags | interrupt);
+}
+
+void CPU::setInterruptEnable(uint8_t value) {
+	interruptEnable = value;
+	pendingInterrupts = interruptEnable & interruptFlags & 0x1F;
+}
+
+void CPU::setInterruptFlags(uint8_t value) {
+	interruptFlags = value & 0x1F;
+	pendingInterrupts = interruptEnable & interruptFlags;
+}
+
 void CPU::serviceInterrupt(uint16_t address) {
 	// Clear the interrupt master enable flag (IME) to disable further interrupts temporarily
 	ime = false;
@@ -320,35 +911,10 @@ void CPU::executeDI() {
 }
 
 void CPU::handleInterrupts() {
-	uint8_t interruptEnable = memory[0xFFFF]; // IE register
-	uint8_t interruptFlag = memory[0xFF0F]; // IF register
-
-	// Check each interrupt in priority order
-	if ((interruptEnable & 0x01) && (interruptFlag & 0x01)) {
-		// V-Blank Interrupt
-		serviceInterrupt(0x40);  // Address 0x40 for V-Blank
-		memory[0xFF0F] &= ~0x01; // Clear the IF flag
-	}
-	else if ((interruptEnable & 0x02) && (interruptFlag & 0x02)) {
-		// LCD STAT Interrupt
-		serviceInterrupt(0x48);
-		memory[0xFF0F] &= ~0x02;
-	}
-	else if ((interruptEnable & 0x04) && (interruptFlag & 0x04)) {
-		// Timer Interrupt
-		serviceInterrupt(0x50);
-		memory[0xFF0F] &= ~0x04;
-	}
-	else if ((interruptEnable & 0x08) && (interruptFlag & 0x08)) {
-		// Serial Interrupt
-		serviceInterrupt(0x58);
-		memory[0xFF0F] &= ~0x08;
-	}
-	else if ((interruptEnable & 0x10) && (interruptFlag & 0x10)) {
-		// Joypad Interrupt
-		serviceInterrupt(0x60);
-		memory[0xFF0F] &= ~0x10;
-	}
+	// Lowest set bit is the highest priority (V-Blank, LCD STAT, Timer, Serial, Joypad)
+	int bit = std::countr_zero(pendingInterrupts);
+	setInterruptFlags(interruptFlags & ~(1 << bit)); // Clear the IF flag
+	serviceInterrupt(0x40 + bit * 8);
 }
 
 void CPU::updateIME() {
@@ -360,59 +926,411 @@ void CPU::updateIME() {
 
 // Stack Instructions
 void CPU::push(uint16_t value) {
-	memory[--SP] = (value >> 8) & 0xFF;
-	memory[--SP] = value & 0xFF;
+	write8(--SP, (value >> 8) & 0xFF);
+	write8(--SP, value & 0xFF);
 }
 
 // Timers and Clocks
-void CPU::updateTimers(int cycles) {
-	timerCounter += cycles;
-	if (timerCounter & 0x04) {
-		while (timerCounter >= timerFrequency) {
-			timerCounter -= timerFrequency;
-			timerValue++;
-			if (timerValue == 0) {
-				memory[0xFF0F] |= 0x04;
-			}
-		}
+
+// System counter bit whose falling edge clocks TIMA, by TAC frequency (4096, 262144,
+// 65536 and 16384 Hz)
+static const int timerBits[4] = { 9, 3, 5, 7 };
+
+uint16_t CPU::systemCounter() const {
+	return (cycleCount - dividerBase) & 0xFFFF;
+}
+
+// Timer enabled and its counter bit set: TIMA ticks when this goes from true to false
+bool CPU::timerSignal() const {
+	return (timerControl & 0x04) && ((systemCounter() >> timerBits[timerControl & 0x03]) & 1);
+}
+
+// Catch TIMA up to cycleCount: the selected bit falls each time the counter passes a
+// multiple of twice its value
+void CPU::updateTimer() {
+	if (timerControl & 0x04) {
+		int shift = timerBits[timerControl & 0x03] + 1;
+		incrementTimer(((cycleCount - dividerBase) >> shift) - ((timerCycle - dividerBase) >> shift));
+	}
+	timerCycle = cycleCount;
+}
+
+// Overflows reload TMA and request the interrupt
+void CPU::incrementTimer(uint64_t count) {
+	uint64_t value = timerValue + count;
+	if (value <= 0xFF) {
+		timerValue = static_cast<uint8_t>(value);
+		return;
+	}
+	timerValue = static_cast<uint8_t>(timerModulo + (value - 0x100) % (0x100 - timerModulo));
+	requestInterrupt(INTERRUPT_TIMER);
+}
+
+// Cycle of the next overflow: the (256 - TIMA)th falling edge from now
+void CPU::scheduleTimer() {
+	timerOverflowCycle = UINT64_MAX;
+	if (timerControl & 0x04) {
+		int shift = timerBits[timerControl & 0x03] + 1;
+		uint64_t edges = ((timerCycle - dividerBase) >> shift) + (0x100 - timerValue);
+		timerOverflowCycle = dividerBase + (edges << shift);
 	}
+	scheduleEvents();
+}
+
+void CPU::serviceTimer() {
+	updateTimer();
+	scheduleTimer();
 }
 
-void CPU::updateClock() {
-	updateTimers(1);
+void CPU::scheduleEvents() {
+	nextEventCycle = std::min({ timerOverflowCycle, gpuEventCycle, dmaEndCycle ? dmaEndCycle : UINT64_MAX });
+}
+
+// Called by the interpreter loop once cycleCount reaches nextEventCycle
+void CPU::serviceEvents() {
+	if (cycleCount >= timerOverflowCycle) {
+		serviceTimer();
+	}
+	if (cycleCount >= gpuEventCycle) {
+		syncGPU();
+		scheduleGPU();
+	}
+	if (dmaEndCycle && cycleCount >= dmaEndCycle) {
+		dmaEndCycle = 0; // OAM DMA done: give the bus back
+		mapMemory();
+		scheduleEvents();
+	}
 }
 
 uint16_t CPU::pop() {
-	uint16_t value = (memory[SP] << 8) | memory[SP + 1];
+	uint16_t value = (read8(SP) << 8) | read8(SP + 1);
 	SP += 2;
 	return value;
 }
 
+// Input
+void CPU::setJoypad(uint8_t buttons) {
+	if (buttons & ~joypadButtons) {
+		requestInterrupt(INTERRUPT_JOYPAD); // Newly pressed button
+	}
+	joypadButtons = buttons;
+}
+
 // Misc.
 void CPU::reset() {
 	A = B = C = D = E = H = L = 0;
 	PC = 0x0100;
 	SP = 0xFFFE;
-	zeroFlag = carryFlag = halfCarryFlag = ime = pendingIME = false;
+	zeroFlag = subtractFlag = carryFlag = halfCarryFlag = ime = pendingIME = false;
+	interruptEnable = interruptFlags = pendingInterrupts = 0;
+	dmaEndCycle = 0;
+	joypadButtons = 0;
+	joypadSelect = 0x30;
+	dividerBase = timerCycle = cycleCount;
+	timerOverflowCycle = UINT64_MAX;
+	timerValue = timerModulo = timerControl = 0;
+	gpuCycle = gpuEventCycle = nextEventCycle = cycleCount; // GPU event looked up at the next instruction
+
+	// Volatile memory only; cartridge RAM survives a reset like on hardware
+	wram.clear();
+	io.fill(0);
+	hram.fill(0);
+	romBank = 1;
+	ramBank = bankUpper = 0;
+	ramEnabled = bankingMode = false;
+	mapMemory();
+	}
+
+// Graphics Processing Unit
+void CPU::connectGPU(GPU* gpu) {
+	this->gpu = gpu;
+	gpuCycle = cycleCount;
+	scheduleGPU();
+	mapMemory();
+}
+
+// Step the GPU over the cycles since it was last observed
+void CPU::syncGPU() {
+	if (!gpu || gpuCycle == cycleCount) {
+		return;
+	}
+	uint8_t interrupts = gpu->advance(cycleCount - gpuCycle);
+	gpuCycle = cycleCount;
+	if (interrupts) {
+		requestInterrupt(interrupts);
+
+		// Frame end: let the APU flush the audio for this frame
+		if ((interrupts & INTERRUPT_VBLANK) && apu) {
+			apu->endFrame(cycleCount);
+		}
 	}
+}
+
+void CPU::scheduleGPU() {
+	uint64_t cycles = gpu ? gpu->cyclesUntilEvent() : UINT64_MAX;
+	gpuEventCycle = cycles == UINT64_MAX ? UINT64_MAX : gpuCycle + cycles;
+	scheduleEvents();
+}
+
+// Audio Processing Unit
+void CPU::connectAPU(APU* apu) {
+	this->apu = apu;
+}
+
+// Debugger
+void CPU::connectDebugger(Debugger* debugger) {
+	this->debugger = debugger;
+}
+
+void CPU::connectTrace(TraceBuffer* trace) {
+	this->trace = trace;
+}
+
+// Superinstructions. When a conditional JR jumps back onto one of the copy, fill or polling
+// loops below, fuseLoop runs as many whole iterations of it at once as end before the next
+// event and the run limit. Interrupts, timer and GPU events and the frame end then fall on
+// the same instruction as without fusion; whatever is left runs one instruction at a time.
+
+// One iteration of a loop, its closing JR taken
+static unsigned loopCycles(std::initializer_list<uint8_t> opcodes) {
+	unsigned cycles = 4;
+	for (uint8_t opcode : opcodes) {
+		cycles += instructionCycles[opcode];
+	}
+	return cycles;
+}
+
+// Whether code starts with body and a JR NZ back to its first byte
+static bool matchLoop(const uint8_t* code, size_t available, std::initializer_list<uint8_t> body) {
+	size_t length = body.size() + 2;
+	return length <= available && std::equal(body.begin(), body.end(), code)
+		&& code[body.size()] == 0x20 && code[body.size() + 1] == static_cast<uint8_t>(-static_cast<int>(length));
+}
+
+static bool overlaps(const uint8_t* a, size_t aLength, const uint8_t* b, size_t bLength) {
+	return a < b + bLength && b < a + aLength;
+}
+
+void CPU::fuseLoop(uint64_t limit) {
+	// An interrupt about to be taken, a pending EI or a running OAM DMA changes what comes next
+	if ((ime && pendingInterrupts) || pendingIME || cycleCount < dmaEndCycle) {
+		return;
+	}
+	const uint8_t* page = memoryMap.read[PC >> 8];
+	if (!page) {
+		return;
+	}
+	const uint8_t* code = page + (PC & 0xFF);
+	size_t available = MEMORY_PAGE_SIZE - (PC & 0xFF); // Loops are matched within one page
+	uint64_t bound = std::min(nextEventCycle, limit);
+	uint8_t* counters[4] = { &B, &C, &D, &E }; // DEC B, C, D, E are 0x05, 0x0D, 0x15, 0x1D
+
+	switch (code[0]) {
+	case 0x2A: // LD A,(HL+) / LD (DE),A / INC DE, counted in B or C, or in BC
+		if (available > 3 && (code[3] == 0x05 || code[3] == 0x0D) && matchLoop(code, available, { 0x2A, 0x12, 0x13, code[3] })) {
+			fuseTransfer({ true, 1, 0, counters[code[3] >> 3], loopCycles({ 0x2A, 0x12, 0x13, code[3], 0x20 }), 6 }, bound);
+		}
+		else if (matchLoop(code, available, { 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1 })) {
+			fuseTransfer({ true, 1, 0, nullptr, loopCycles({ 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20 }), 8 }, bound);
+		}
+		break;
+	case 0x22: // LD (HL+),A or LD (HL-),A / DEC r
+	case 0x32:
+		if (available > 1 && (code[1] & 0xC7) == 0x05 && code[1] <= 0x1D && matchLoop(code, available, { code[0], code[1] })) {
+			fuseTransfer({ false, code[0] == 0x22 ? 1 : -1, A, counters[code[1] >> 3], loopCycles({ code[0], code[1], 0x20 }), 4 }, bound);
+		}
+		break;
+	case 0xAF: // XOR A or LD A,n / LD (HL+),A, counted in BC
+		if (matchLoop(code, available, { 0xAF, 0x22, 0x0B, 0x78, 0xB1 })) {
+			fuseTransfer({ false, 1, 0, nullptr, loopCycles({ 0xAF, 0x22, 0x0B, 0x78, 0xB1, 0x20 }), 7 }, bound);
+		}
+		break;
+	case 0x3E:
+		if (available > 1 && matchLoop(code, available, { 0x3E, code[1], 0x22, 0x0B, 0x78, 0xB1 })) {
+			fuseTransfer({ false, 1, code[1], nullptr, loopCycles({ 0x3E, 0x22, 0x0B, 0x78, 0xB1, 0x20 }), 8 }, bound);
+		}
+		break;
+	case 0xF0: // LDH A,(n) / CP n or AND n / JR cc
+		if (available >= 6 && (code[2] == 0xFE || code[2] == 0xE6) && (code[4] & 0xE7) == 0x20 && code[5] == 0xFA) {
+			fusePoll(code, bound);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// Copies and fills move whole runs of bytes with memcpy/memset, a page at a time, as long as
+// both sides are plain memory (directly mapped pages, or VRAM before the GPU next reads it)
+// and a copy's destination overlaps neither its source nor the loop's code. Only the
+// run<NoTrace, NoWatch> core fuses, so no watchpoint can be set on the VRAM written here.
+void CPU::fuseTransfer(const FusedTransfer& loop, uint64_t bound) {
+	if (bound <= cycleCount) {
+		return;
+	}
+	// Iterations that jump back: the counter is still non-zero after its decrement
+	uint64_t iterations = loop.counter ? static_cast<uint8_t>(*loop.counter - 1) : static_cast<uint16_t>(((B << 8) | C) - 1);
+	iterations = std::min<uint64_t>(iterations, (bound - 1 - cycleCount) / loop.cycles);
+	const uint8_t* code = memoryMap.read[PC >> 8] + (PC & 0xFF);
+
+	uint64_t done = 0;
+	uint8_t last = 0;
+	while (done < iterations) {
+		uint16_t source = (H << 8) | L;
+		uint16_t destination = loop.copy ? (D << 8) | E : source;
+		size_t count = std::min<uint64_t>(iterations - done,
+			loop.step > 0 ? MEMORY_PAGE_SIZE - (destination & 0xFF) : (destination & 0xFF) + 1);
+		const uint8_t* from = nullptr;
+		if (loop.copy) {
+			from = memoryMap.read[source >> 8];
+			if (!from) {
+				break;
+			}
+			from += source & 0xFF;
+			count = std::min<size_t>(count, MEMORY_PAGE_SIZE - (source & 0xFF));
+		}
+
+		uint8_t* to = memoryMap.write[destination >> 8];
+		bool vram = !to && gpu && destination >= 0x8000 && destination < 0xA000;
+		if (vram) {
+			syncGPU();
+			uint64_t untilRead = gpu->cyclesUntilVRAMRead();
+			if (untilRead != UINT64_MAX) {
+				count = std::min<uint64_t>(count, untilRead / loop.cycles);
+			}
+			to = &gpu->vram[(destination & 0xFF00) - 0x8000];
+		}
+		if (!to || count == 0) {
+			break;
+		}
+		uint16_t lowest = loop.step > 0 ? destination : destination - (count - 1);
+		to += lowest & 0xFF;
+		if ((loop.copy && overlaps(to, count, from, count)) || overlaps(to, count, code, loop.length)) {
+			break;
+		}
+
+		if (loop.copy) {
+			if (vram) {
+				gpu->copyToVRAM(destination - 0x8000, from, count);
+			}
+			else {
+				std::memcpy(to, from, count);
+			}
+			last = from[count - 1];
+			source += count;
+			destination += count;
+			D = destination >> 8;
+			E = destination & 0xFF;
+		}
+		else {
+			if (vram) {
+				gpu->fillVRAM(lowest - 0x8000, loop.value, count);
+			}
+			else {
+				std::memset(to, loop.value, count);
+			}
+			source += loop.step > 0 ? count : -count;
+		}
+		H = source >> 8;
+		L = source & 0xFF;
+		if (loop.counter) {
+			*loop.counter -= count;
+		}
+		else {
+			uint16_t bc = ((B << 8) | C) - count;
+			B = bc >> 8;
+			C = bc & 0xFF;
+		}
+		cycleCount += count * loop.cycles;
+		done += count;
+	}
+	if (done == 0) {
+		return;
+	}
+
+	// Registers and flags as the last iteration left them
+	if (loop.copy) {
+		A = last;
+	}
+	if (loop.counter) {
+		zeroFlag = false;
+		subtractFlag = true;
+		halfCarryFlag = (*loop.counter & 0x0F) == 0x0F;
+	}
+	else {
+		A = B | C;
+		zeroFlag = subtractFlag = halfCarryFlag = carryFlag = false;
+	}
+}
+
+// The polled register only changes at a GPU mode change (STAT, LY), at an event (IF) or not
+// at all while running (joypad, other LCD registers), so every iteration up to then reads the
+// same value and takes the same branch
+void CPU::fusePoll(const uint8_t* code, uint64_t bound) {
+	uint8_t port = code[1];
+	uint8_t operation = code[2];
+	uint8_t operand = code[3];
+	uint8_t jump = code[4];
+	bool lcd = port == 0x41 || port == 0x44;
+	if (port != 0x00 && port != 0x0F && !(port >= 0x40 && port <= 0x4B)) {
+		return;
+	}
+	unsigned cycles = loopCycles({ 0xF0, operation, jump });
+
+	while (bound > cycleCount + cycles) {
+		uint8_t value = read8(0xFF00 | port);
+		bool zero = operation == 0xE6 ? (value & operand) == 0 : value == operand;
+		bool carry = operation == 0xFE && value < operand;
+		bool taken = jump == 0x20 ? !zero : jump == 0x28 ? zero : jump == 0x30 ? !carry : carry;
+		if (!taken) {
+			return;
+		}
+
+		// Iterations that end before the bound and read before the value can change
+		uint64_t count = (bound - 1 - cycleCount) / cycles;
+		uint64_t stable = lcd && gpu ? gpu->cyclesUntilModeChange() : UINT64_MAX;
+		if (stable != UINT64_MAX) {
+			count = std::min(count, (stable + cycles - 1) / cycles);
+		}
+		if (count == 0) {
+			return;
+		}
+		A = value;
+		if (operation == 0xE6) {
+			andOp(A, operand);
+		}
+		else {
+			comp(A, operand);
+		}
+		cycleCount += count * cycles;
+	}
+}
 
 // Fetch-Decode-Execute Cycle
 uint8_t CPU::fetch() {
-	return memory[PC++];
+	return read8(PC++);
 }
 
 uint16_t CPU::fetch16BitImmediate() {
-	uint16_t lowByte = memory[PC++];
-	uint16_t highByte = memory[PC++];
+	uint16_t lowByte = read8(PC++);
+	uint16_t highByte = read8(PC++);
 	return (highByte << 8) | lowByte;
 }
 
-void CPU::executeNextInstruction() {
-	if (ime) {
+template<typename Tracing>
+void CPU::execute() {
+	uint8_t cycles = 0;
+	if (ime && pendingInterrupts) {
 		handleInterrupts();
+		cycles += 20;
 	}
 
 	uint8_t opcode = fetch();
+	cycles += instructionCycles[opcode];
+	if constexpr (Tracing::enabled) {
+		uint8_t flags = (zeroFlag ? 0x80 : 0) | (subtractFlag ? 0x40 : 0) | (halfCarryFlag ? 0x20 : 0) | (carryFlag ? 0x10 : 0);
+		trace->record({ cycleCount, static_cast<uint16_t>(PC - 1), SP, opcode, A, flags, B, C, D, E, H, L });
+	}
 
 	switch (opcode) {
 	// Load OpCodes
@@ -804,6 +1722,7 @@ void CPU::executeNextInstruction() {
 		break;
 	case 0x34:
 		incPair(H, L);
+		break;
 
 	case 0x3D:
 		dec(A);
@@ -828,6 +1747,7 @@ void CPU::executeNextInstruction() {
 		break;
 	case 0x35:
 		decPair(H, L);
+		break;
 
 	// 16 Bit Arithmetic Instructions
 	case 0x09:
@@ -842,11 +1762,33 @@ void CPU::executeNextInstruction() {
 	case 0x39:
 		addPairs(H, L, getSPHigh(), getSPLow());
 		break;
-	case 0xE8:{
-		int8_t immediateValue = static_cast<int8_t>(fetch());
-		SP += immediateValue;
+	case 0xE8:
+		addToSP(static_cast<int8_t>(fetch()));
+		break;
+	case 0x03:
+		incrementRegisterPair(B, C);
+		break;
+	case 0x13:
+		incrementRegisterPair(D, E);
+		break;
+	case 0x23:
+		incrementRegisterPair(H, L);
+		break;
+	case 0x33:
+		SP++;
+		break;
+	case 0x0B:
+		decrementRegisterPair(B, C);
+		break;
+	case 0x1B:
+		decrementRegisterPair(D, E);
+		break;
+	case 0x2B:
+		decrementRegisterPair(H, L);
+		break;
+	case 0x3B:
+		SP--;
 		break;
-	}
 
 	// Logical Instructions
 	case 0xA0: // and
@@ -947,8 +1889,10 @@ void CPU::executeNextInstruction() {
 		break;
 	case 0xBC:
 		comp(A, H);
+		break;
 	case 0xBD:
 		comp(A, L);
+		break;
 	case 0xBE:
 		compPair(A, H, L);
 		break;
@@ -960,14 +1904,87 @@ void CPU::executeNextInstruction() {
 		break;
 
 	// Other Opcodes
-	case 0xC3: {
-		uint16_t address = fetch() | (fetch() << 8);
-		jp(address);
+	case 0xC3:
+		jp(fetch16BitImmediate());
+		break;
+	case 0x18:
+		jr(static_cast<int8_t>(fetch()));
+		break;
+	case 0x20:
+		cycles += jrIf(!zeroFlag);
+		break;
+	case 0x28:
+		cycles += jrIf(zeroFlag);
+		break;
+	case 0x30:
+		cycles += jrIf(!carryFlag);
+		break;
+	case 0x38:
+		cycles += jrIf(carryFlag);
 		break;
-	}
 	default:
 		std::cerr << "Unknown opcode: 0x" << std::hex << (int)opcode << std::dec << std::endl;
 		break;
 	}
 	updateIME();
-}
\ No newline at end of file
+
+	cycleCount += cycles;
+}
+
+void CPU::executeNextInstruction() {
+	execute<NoTrace>();
+	if (cycleCount >= nextEventCycle) {
+		serviceEvents();
+	}
+}
+
+template<typename Tracing, typename Watching>
+StopReason CPU::run(uint64_t frame, uint64_t limit) {
+	// Resuming from a breakpoint runs that instruction instead of stopping again
+	bool resuming = false;
+	if constexpr (Watching::enabled) {
+		resuming = debugger->getStopInfo().reason == StopReason::Breakpoint && debugger->getStopInfo().address == PC;
+		debugger->clearStop();
+	}
+	// The GPU may have been reconfigured or reloaded since the last call
+	scheduleGPU();
+
+	StopReason reason = StopReason::FrameComplete;
+	while (gpu->getFrameCount() == frame && cycleCount < limit) {
+		// Only the plain core fuses: a trace or debug point has to see every instruction
+		if constexpr (!Tracing::enabled && !Watching::enabled) {
+			if (loopPending) {
+				loopPending = false;
+				fuseLoop(limit);
+			}
+		}
+		if constexpr (Watching::enabled) {
+			if (!resuming && debugger->checkBreakpoint(PC)) {
+				reason = StopReason::Breakpoint;
+				break;
+			}
+			resuming = false;
+		}
+
+		execute<Tracing>();
+		if (cycleCount >= nextEventCycle) {
+			serviceEvents();
+		}
+		if constexpr (Watching::enabled) {
+			if (debugger->isStopped()) {
+				reason = debugger->getStopInfo().reason;
+				break;
+			}
+		}
+	}
+	syncGPU(); // Everything outside the loop sees the GPU as of cycleCount
+	return reason;
+}
+
+// Runtime factory over the core instantiations
+CPU::CoreLoop CPU::selectCore() const {
+	if (trace) {
+		return debugger ? &CPU::run<Trace, Watch> : &CPU::run<Trace, NoWatch>;
+	}
+	return debugger ? &CPU::run<NoTrace, Watch> : &CPU::run<NoTrace, NoWatch>;
+}
\ No newline at end of file
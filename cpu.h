@@ -1,7 +1,88 @@
 	#include <iostream>
+	#include <array>
+	#include <cstdint>
+	#include <memory>
+	#include <vector>
+	#include "cartridge.h"
+	#include "debugger.h"
+	#include "pagedram.h"
 	#ifndef cpu_H
 	#define cpu_H
 
+	// Interrupt bits shared by IE (0xFFFF) and IF (0xFF0F), in priority order
+	constexpr uint8_t INTERRUPT_VBLANK = 0x01;
+	constexpr uint8_t INTERRUPT_STAT = 0x02;
+	constexpr uint8_t INTERRUPT_TIMER = 0x04;
+	constexpr uint8_t INTERRUPT_SERIAL = 0x08;
+	constexpr uint8_t INTERRUPT_JOYPAD = 0x10;
+
+	// Joypad buttons, as passed to setJoypad
+	constexpr uint8_t JOYPAD_RIGHT = 0x01;
+	constexpr uint8_t JOYPAD_LEFT = 0x02;
+	constexpr uint8_t JOYPAD_UP = 0x04;
+	constexpr uint8_t JOYPAD_DOWN = 0x08;
+	constexpr uint8_t JOYPAD_A = 0x10;
+	constexpr uint8_t JOYPAD_B = 0x20;
+	constexpr uint8_t JOYPAD_SELECT = 0x40;
+	constexpr uint8_t JOYPAD_START = 0x80;
+
+	class GPU;
+	class APU;
+
+	// Compile-time feature policies of the interpreter core (see CPU::run)
+	struct NoTrace {
+		static constexpr bool enabled = false;
+	};
+	struct Trace {
+		static constexpr bool enabled = true; // Record every instruction into the attached TraceBuffer
+	};
+	struct NoWatch {
+		static constexpr bool enabled = false;
+	};
+	struct Watch {
+		static constexpr bool enabled = true; // Check breakpoints and debugger stops around every instruction
+	};
+
+	// 256-byte pages; a null entry sends the access down the slow path (I/O, MBC, unmapped)
+	constexpr int MEMORY_PAGE_SIZE = 0x100;
+	constexpr int MEMORY_PAGE_COUNT = 0x100;
+
+	// Work RAM and cartridge RAM sizes in copy-on-write chunks
+	constexpr size_t WRAM_SIZE = 0x2000;
+	constexpr size_t MAX_SRAM_SIZE = 0x20000; // MBC5: 16 banks of 8 KB
+
+	// Page table of the CPU bus. It points into the owning CPU's own regions, so copies
+	// deliberately start out empty: call CPU::mapMemory() after copying a CPU.
+	struct MemoryMap {
+		const uint8_t* read[MEMORY_PAGE_COUNT] = {};
+		mutable uint8_t* write[MEMORY_PAGE_COUNT] = {};
+
+		MemoryMap() = default;
+		MemoryMap(const MemoryMap&) {}
+		MemoryMap& operator=(const MemoryMap&) { return *this; }
+
+		// Cartridge RAM and work RAM (0xA000-0xFDFF) writes go back through the slow path.
+		// Call on a CPU whose RAM chunks a copy is about to share.
+		void revokeRAMWrites() const {
+			for (int page = 0xA0; page < 0xFE; ++page) {
+				if (write[page]) {
+					write[page] = nullptr;
+				}
+			}
+		}
+	};
+
+	// MBC3 real time clock. Registers: seconds, minutes, hours, day counter low and day high
+	// (bit 0 day counter bit 8, bit 6 halt, bit 7 day counter carry). The clock counts
+	// emulated cycles and is only brought up to date when it is accessed.
+	struct RealTimeClock {
+		uint8_t registers[5];
+		uint8_t latched[5];  // What reads return, copied from registers by a latch
+		uint64_t cycle;      // cycleCount the registers were last brought up to
+		uint32_t subsecond;  // Cycles into the current second
+		uint8_t latchValue;  // Last write to 0x6000-0x7FFF: 0x00 then 0x01 latches
+	};
+
 	class CPU {
 	public:
 		// General Purpose Registers
@@ -11,19 +92,135 @@
 		uint16_t PC, SP;
 
 		// Flags
-		bool zeroFlag, carryFlag, halfCarryFlag, ime, pendingIME;
+		bool zeroFlag, subtractFlag, carryFlag, halfCarryFlag, ime, pendingIME;
+
+		// Memory: cartridge ROM is shared read-only between instances, work RAM and
+		// cartridge RAM are shared copy-on-write between copies, the rest is per instance
+		std::shared_ptr<const Cartridge> cartridge;
+		PagedRAM<WRAM_SIZE / MEMORY_CHUNK_SIZE> wram;
+		std::array<uint8_t, 0x80> io; // Backing store for I/O registers without side effects
+		std::array<uint8_t, 0x7F> hram;
+		PagedRAM<MAX_SRAM_SIZE / MEMORY_CHUNK_SIZE> sram; // Cartridge RAM
+		MemoryMap memoryMap;
+
+		// Memory bank controller state
+		uint16_t romBank;
+		uint8_t ramBank;
+		uint8_t bankUpper;
+		bool ramEnabled;
+		bool bankingMode;
+		RealTimeClock rtc;
+
+		// Interrupt Enable/Flag registers and their cached intersection (IE & IF)
+		uint8_t interruptEnable, interruptFlags, pendingInterrupts;
 
-		// Memory(64KB)
-		uint8_t memory[65536];
+		// T-cycles executed since power on
+		uint64_t cycleCount;
 
-		// Timer Variables
-		uint32_t timerCounter;
-		uint8_t timerValue;
-		uint8_t timerFrequency;
+		// OAM DMA: the bus below the I/O page is held until this cycle (0 with no DMA running).
+		// The page table maps it to open bus meanwhile, the end is an interpreter loop event.
+		uint64_t dmaEndCycle;
+
+		// Attached Graphics Processing Unit (owns VRAM and OAM)
+		GPU* gpu;
+
+		// Attached Audio Processing Unit
+		APU* apu;
+
+		// Attached debugger (null unless breakpoints or watchpoints are set)
+		Debugger* debugger;
+
+		// Attached instruction trace (null unless tracing)
+		TraceBuffer* trace;
+
+		// Joypad: buttons currently held and the P1 row select bits
+		uint8_t joypadButtons;
+		uint8_t joypadSelect;
+
+		// Timer: nothing ticks per instruction. The 16 bit system counter (DIV is its upper
+		// byte) is cycleCount - dividerBase, and TIMA is caught up on access by counting the
+		// falling edges of the counter bit TAC selects. Its next overflow is an event at
+		// timerOverflowCycle, handled by the interpreter loop.
+		uint64_t dividerBase;
+		uint64_t timerCycle;         // cycleCount timerValue is current for
+		uint64_t timerOverflowCycle; // UINT64_MAX while the timer is stopped
+		uint8_t timerValue;          // TIMA
+		uint8_t timerModulo;         // TMA
+		uint8_t timerControl;        // TAC
+
+		// The GPU is not stepped per instruction either: it is caught up to cycleCount when the
+		// CPU touches LCD registers, VRAM or OAM, and at gpuEventCycle, its next possible
+		// interrupt or frame end. Part of the CPU state so save states and forks stay in step.
+		uint64_t gpuCycle;      // cycleCount the GPU has been stepped to
+		uint64_t gpuEventCycle; // UINT64_MAX with the LCD off
+
+		// Earliest of timerOverflowCycle and gpuEventCycle: the interpreter loop's one check
+		uint64_t nextEventCycle;
+
+		// Set by a conditional JR jumping backwards: the interpreter loop then offers the loop
+		// it landed on to fuseLoop
+		bool loopPending;
 
 		// Constructor
 		CPU();
 
+		// Memory bus
+		uint8_t read8(uint16_t address);
+		void write8(uint16_t address, uint8_t value);
+		uint8_t readSlow(uint16_t address);
+		void writeSlow(uint16_t address, uint8_t value);
+		uint8_t readBus(uint16_t address);
+		void writeBus(uint16_t address, uint8_t value);
+
+		// Memory mapping and banking
+		void insertCartridge(std::shared_ptr<const Cartridge> cartridge);
+		void mapMemory();
+		void mapROM();
+		void mapRAM();
+		void mapWRAM();
+		void mapDMA();
+		size_t lowROMBank() const;
+		size_t sramOffset(uint16_t address) const;
+		bool isSRAMMapped() const;
+		bool isRTCMapped() const;
+		void protectWatchedPages();
+		void writeMBC(uint16_t address, uint8_t value);
+
+		// MBC3 clock
+		void updateRTC();
+		void advanceRTC(uint64_t seconds);
+		void latchRTC();
+		void writeRTC(uint8_t value);
+
+		// I/O register dispatch (0xFF00-0xFF7F)
+		using IOReadHandler = uint8_t (CPU::*)(uint16_t address);
+		using IOWriteHandler = void (CPU::*)(uint16_t address, uint8_t value);
+		struct IOHandler {
+			IOReadHandler read;
+			IOWriteHandler write;
+		};
+		static const std::array<IOHandler, 0x80> ioHandlers;
+
+		uint8_t readJoypad(uint16_t address);
+		void writeJoypad(uint16_t address, uint8_t value);
+		uint8_t readIORegister(uint16_t address);
+		void writeIORegister(uint16_t address, uint8_t value);
+		uint8_t readIF(uint16_t address);
+		void writeIF(uint16_t address, uint8_t value);
+		uint8_t readDIV(uint16_t address);
+		void writeDIV(uint16_t address, uint8_t value);
+		uint8_t readTIMA(uint16_t address);
+		void writeTIMA(uint16_t address, uint8_t value);
+		uint8_t readTMA(uint16_t address);
+		void writeTMA(uint16_t address, uint8_t value);
+		uint8_t readTAC(uint16_t address);
+		void writeTAC(uint16_t address, uint8_t value);
+		uint8_t readLCDRegister(uint16_t address);
+		void writeLCDRegister(uint16_t address, uint8_t value);
+		void writeDMA(uint16_t address, uint8_t value);
+		uint8_t readSoundRegister(uint16_t address);
+		void writeSoundRegister(uint16_t address, uint8_t value);
+
 		// SP sets/gets
 		uint8_t getSPHigh();
 		uint8_t getSPLow();
@@ -46,21 +243,37 @@
 		// Jump Instructions
 		void jp(uint16_t address);
 		void jpIfZero(uint16_t address);
+		void jr(int8_t offset);
+		uint8_t jrIf(bool condition);
+
+		// Superinstructions: copy, fill and polling loops run as a whole
+		struct FusedTransfer {
+			bool copy;        // (HL+) to (DE), otherwise value to (HL) (fill)
+			int step;         // HL direction of a fill
+			uint8_t value;    // Fill byte
+			uint8_t* counter; // DEC r counter, null for BC (DEC BC / LD A,B / OR C)
+			unsigned cycles;  // One iteration, jump taken
+			size_t length;    // Bytes of code
+		};
+		void fuseLoop(uint64_t limit);
+		void fuseTransfer(const FusedTransfer& loop, uint64_t bound);
+		void fusePoll(const uint8_t* code, uint64_t bound);
 
 		// Arithmetic Instructions
 		void add(uint8_t &destReg, uint8_t srcReg);
 		void addPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2);
 		void addPairs(uint8_t& highDest, uint8_t& lowDest, uint8_t highSrc, uint8_t lowSrc);
+		void addToSP(int8_t offset);
 		void adc(uint8_t& destReg, uint8_t srcReg);
 		void adcPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2);
 		void sub(uint8_t &destReg, uint8_t srcReg);
 		void subPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2);
 		void sbc(uint8_t& destReg, uint8_t srcReg);
 		void sbcPair(uint8_t& destReg, uint8_t srcReg1, uint8_t srcReg2);
-		void inc(uint8_t destReg);
-		void dec(uint8_t destReg);
-		void incPair(uint8_t& destReg1, uint8_t& destReg2);
-		void decPair(uint8_t& destReg1, uint8_t& destReg2);
+		void inc(uint8_t& destReg);
+		void dec(uint8_t& destReg);
+		void incPair(uint8_t srcReg1, uint8_t srcReg2);
+		void decPair(uint8_t srcReg1, uint8_t srcReg2);
 
 		// Logical instructions
 		void andOp(uint8_t &destReg, uint8_t srcReg);
@@ -83,6 +296,9 @@
 		void compPair(uint8_t srcReg1, uint8_t srcReg2, uint8_t srcReg3);
 
 		// Interrupt handling
+		void requestInterrupt(uint8_t interrupt);
+		void setInterruptEnable(uint8_t value);
+		void setInterruptFlags(uint8_t value);
 		void serviceInterrupt(uint16_t interrupt);
 		void handleInterrupts();
 		void executeEI();
@@ -94,11 +310,29 @@
 		uint16_t pop();
 
 		// Timers and clocks
-		void updateTimers(int cycles);
-		void updateClock();
+		uint16_t systemCounter() const;
+		bool timerSignal() const;
+		void updateTimer();
+		void incrementTimer(uint64_t count);
+		void scheduleTimer();
+		void serviceTimer();
+		void scheduleEvents();
+		void serviceEvents();
 
 		// Graphics Processing Unit
-		void updateGraphics();
+		void connectGPU(GPU* gpu);
+		void syncGPU();
+		void scheduleGPU();
+
+		// Audio Processing Unit
+		void connectAPU(APU* apu);
+
+		// Debugger (takes effect at the next mapMemory)
+		void connectDebugger(Debugger* debugger);
+		void connectTrace(TraceBuffer* trace);
+
+		// Input
+		void setJoypad(uint8_t buttons);
 
 		// Misc.
 		void reset();
@@ -106,7 +340,15 @@
 		// Fetch-Decode-Execute Cycle
 		uint8_t fetch();
 		uint16_t fetch16BitImmediate();
-		void executeNextInstruction();
+		void executeNextInstruction(); // Production core, no tracing
+		template<typename Tracing> inline __attribute__((always_inline)) void execute();
+
+		// Interpreter loop: runs until the GPU completes frame, cycleCount reaches limit or a
+		// debug point stops it. Each policy combination is a separately compiled loop with the
+		// instruction switch inlined; selectCore picks the one matching what is attached.
+		template<typename Tracing, typename Watching> StopReason run(uint64_t frame, uint64_t limit);
+		using CoreLoop = StopReason (CPU::*)(uint64_t frame, uint64_t limit);
+		CoreLoop selectCore() const;
 	};
 
-	#endif
\ No newline at end of file
+	#endif
\ No newline at end of file
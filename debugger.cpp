@@ -0,0 +1,122 @@
+#include "debugger.h"
+#include <algorithm>
+#include <cstdio>
+
+// Constructor
+Debugger::Debugger() : nextId(1) {
+    pageFlags.fill(0);
+    clearStop();
+}
+
+int Debugger::addBreakpoint(uint16_t address, WatchCondition condition) {
+    return addWatchpoint(address, address, WATCH_EXECUTE, std::move(condition));
+}
+
+int Debugger::addWatchpoint(uint16_t start, uint16_t end, uint8_t access, WatchCondition condition) {
+    if (end < start) {
+        std::swap(start, end);
+    }
+    int id = nextId++;
+    points.push_back({ id, start, end, access, std::move(condition) });
+    updatePageFlags();
+    return id;
+}
+
+bool Debugger::removePoint(int id) {
+    auto it = std::find_if(points.begin(), points.end(), [id](const DebugPoint& point) {
+        return point.id == id;
+    });
+    if (it == points.end()) {
+        return false;
+    }
+    points.erase(it);
+    updatePageFlags();
+    return true;
+}
+
+void Debugger::clear() {
+    points.clear();
+    updatePageFlags();
+}
+
+bool Debugger::empty() const {
+    return points.empty();
+}
+
+void Debugger::updatePageFlags() {
+    pageFlags.fill(0);
+    for (const DebugPoint& point : points) {
+        for (int page = point.start >> 8; page <= point.end >> 8; ++page) {
+            pageFlags[page] |= point.access;
+        }
+    }
+}
+
+void Debugger::onAccess(uint16_t address, uint8_t value, uint8_t access) {
+    if (isStopped()) {
+        return; // Report the first hit of the instruction
+    }
+    for (const DebugPoint& point : points) {
+        if ((point.access & access) && address >= point.start && address <= point.end
+            && (!point.condition || point.condition(address, value))) {
+            StopReason reason = access == WATCH_READ ? StopReason::ReadWatch : StopReason::WriteWatch;
+            stop = { reason, point.id, address, value };
+            return;
+        }
+    }
+}
+
+bool Debugger::checkBreakpoint(uint16_t pc) {
+    if (!(pageFlags[pc >> 8] & WATCH_EXECUTE)) {
+        return false;
+    }
+    for (const DebugPoint& point : points) {
+        if ((point.access & WATCH_EXECUTE) && pc >= point.start && pc <= point.end
+            && (!point.condition || point.condition(pc, 0))) {
+            stop = { StopReason::Breakpoint, point.id, pc, 0 };
+            return true;
+        }
+    }
+    return false;
+}
+
+void Debugger::clearStop() {
+    stop = { StopReason::None, 0, 0, 0 };
+}
+
+// Constructor
+TraceBuffer::TraceBuffer(size_t capacity) : recorded(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    entries.resize(size);
+    mask = size - 1;
+}
+
+void TraceBuffer::clear() {
+    recorded = 0;
+}
+
+size_t TraceBuffer::size() const {
+    return static_cast<size_t>(std::min<uint64_t>(recorded, entries.size()));
+}
+
+const TraceEntry& TraceBuffer::operator[](size_t index) const {
+    return entries[(recorded - size() + index) & mask];
+}
+
+uint64_t TraceBuffer::getRecorded() const {
+    return recorded;
+}
+
+void TraceBuffer::write(std::ostream& out) const {
+    char line[96];
+    for (size_t i = 0; i < size(); ++i) {
+        const TraceEntry& entry = (*this)[i];
+        std::snprintf(line, sizeof(line), "%10llu %04X %02X  A=%02X F=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X\n",
+            static_cast<unsigned long long>(entry.cycle), entry.pc, entry.opcode, entry.a, entry.f,
+            entry.b, entry.c, entry.d, entry.e, entry.h, entry.l, entry.sp);
+        out << line;
+    }
+}
@@ -0,0 +1,108 @@
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+#ifndef debugger_H
+#define debugger_H
+
+// Access kinds, also used as per-page flag bits
+constexpr uint8_t WATCH_READ = 0x01;
+constexpr uint8_t WATCH_WRITE = 0x02;
+constexpr uint8_t WATCH_EXECUTE = 0x04;
+
+// Why a run returned to the caller
+enum class StopReason {
+    None,
+    FrameComplete,
+    Breakpoint,
+    ReadWatch,
+    WriteWatch
+};
+
+struct StopInfo {
+    StopReason reason;
+    int id;           // Breakpoint or watchpoint that fired
+    uint16_t address; // PC for breakpoints, accessed address for watchpoints
+    uint8_t value;    // Value read or written (0 for breakpoints)
+};
+
+// Extra test run when a watched address is accessed or a breakpoint is reached (value 0)
+using WatchCondition = std::function<bool(uint16_t address, uint8_t value)>;
+
+// Breakpoints and watchpoints. Pages holding one are flagged so the CPU routes only
+// those pages through the slow path; everything else keeps its direct mapping.
+class Debugger {
+private:
+    struct DebugPoint {
+        int id;
+        uint16_t start;
+        uint16_t end; // Inclusive
+        uint8_t access;
+        WatchCondition condition;
+    };
+    std::vector<DebugPoint> points;
+    std::array<uint8_t, 256> pageFlags;
+    int nextId;
+    StopInfo stop;
+
+    void updatePageFlags();
+
+public:
+    // Constructor
+    Debugger();
+
+    // Returns an id for removePoint
+    int addBreakpoint(uint16_t address, WatchCondition condition = nullptr);
+    int addWatchpoint(uint16_t start, uint16_t end, uint8_t access, WatchCondition condition = nullptr);
+    bool removePoint(int id);
+    void clear();
+    bool empty() const;
+
+    uint8_t getPageFlags(uint8_t page) const { return pageFlags[page]; }
+
+    // Called by the CPU for accesses to flagged pages
+    void onAccess(uint16_t address, uint8_t value, uint8_t access);
+    // Called before each instruction while any point is set
+    bool checkBreakpoint(uint16_t pc);
+
+    bool isStopped() const { return stop.reason != StopReason::None; }
+    const StopInfo& getStopInfo() const { return stop; }
+    void clearStop();
+};
+
+// CPU state at the start of one instruction
+struct TraceEntry {
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t opcode;
+    uint8_t a, f, b, c, d, e, h, l;
+};
+
+// Ring of the most recent instructions, filled by the tracing CPU core
+class TraceBuffer {
+private:
+    std::vector<TraceEntry> entries;
+    size_t mask;
+    uint64_t recorded;
+
+public:
+    // Constructor (capacity is rounded up to a power of two)
+    explicit TraceBuffer(size_t capacity = 4096);
+
+    void record(const TraceEntry& entry) { entries[recorded++ & mask] = entry; }
+    void clear();
+
+    // Entries held, oldest first
+    size_t size() const;
+    const TraceEntry& operator[](size_t index) const;
+    // Instructions recorded since the last clear, including overwritten ones
+    uint64_t getRecorded() const;
+
+    // One line per entry: cycle, PC, opcode and registers
+    void write(std::ostream& out) const;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include "frameexchange.h"
+#include <algorithm>
+
+// Constructor
+FrameExchange::FrameExchange() : slots(new Slot[3]), middle(1), back(0), publishedFrames(0), front(2) {
+    for (int i = 0; i < 3; ++i) {
+        std::fill(std::begin(slots[i].pixels), std::end(slots[i].pixels), 0);
+        slots[i].sequence = 0;
+    }
+}
+
+uint8_t* FrameExchange::backBuffer() {
+    return slots[back].pixels;
+}
+
+void FrameExchange::publish(uint64_t sequence) {
+    slots[back].sequence = sequence;
+    uint8_t previous = middle.exchange(static_cast<uint8_t>(back) | FRESH, std::memory_order_acq_rel);
+    back = previous & INDEX_MASK;
+    publishedFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t FrameExchange::getPublishedFrames() const {
+    return publishedFrames.load(std::memory_order_relaxed);
+}
+
+bool FrameExchange::acquire() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+        return false;
+    }
+    uint8_t previous = middle.exchange(static_cast<uint8_t>(front), std::memory_order_acq_rel);
+    front = previous & INDEX_MASK;
+    return true;
+}
+
+const uint8_t* FrameExchange::frontBuffer() const {
+    return slots[front].pixels;
+}
+
+uint64_t FrameExchange::frontSequence() const {
+    return slots[front].sequence;
+}
@@ -0,0 +1,46 @@
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "gpu.h"
+
+#ifndef frameexchange_H
+#define frameexchange_H
+
+// Triple buffer between the GPU (producer) and one consumer thread. The GPU renders into
+// the back buffer and publishes it at VBlank with an atomic swap against the middle buffer;
+// the consumer swaps the middle buffer into the front when it holds something newer.
+// Neither side ever waits or copies.
+class FrameExchange {
+private:
+    struct Slot {
+        alignas(64) uint8_t pixels[FRAME_BUFFER_SIZE];
+        uint64_t sequence;
+    };
+    std::unique_ptr<Slot[]> slots;
+
+    // Index of the middle slot, plus FRESH when the consumer has not taken it yet
+    static constexpr uint8_t FRESH = 0x04;
+    static constexpr uint8_t INDEX_MASK = 0x03;
+    std::atomic<uint8_t> middle;
+
+    alignas(64) int back; // Producer side
+    std::atomic<uint64_t> publishedFrames;
+    alignas(64) int front; // Consumer side
+
+public:
+    // Constructor
+    FrameExchange();
+
+    // Producer (the GPU): buffer to draw into, then hand it over with its frame number
+    uint8_t* backBuffer();
+    void publish(uint64_t sequence);
+    uint64_t getPublishedFrames() const;
+
+    // Consumer: move the newest published frame to the front, false if nothing new.
+    // Gaps between successive frontSequence values are frames the consumer missed.
+    bool acquire();
+    const uint8_t* frontBuffer() const;
+    uint64_t frontSequence() const;
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "frameserver.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// shm_open names are a single component starting with '/'
+static std::string sharedName(const std::string& name) {
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+// Slot stride, rounded up to whole cache lines
+static size_t slotStride() {
+    return (FRAME_SERVER_PIXEL_OFFSET + FRAME_BUFFER_SIZE + 63) & ~static_cast<size_t>(63);
+}
+
+// Constructor
+FrameServer::FrameServer() : mapping(nullptr), mappingSize(0), header(nullptr), slotCount(0), back(0),
+    publishedFrames(0), source(nullptr) {
+}
+
+// Whether the object under name was left by a producer that has since exited: complete
+// header, recorded process gone. Anything else (a live producer, one still creating it,
+// an object that is not ours) is left alone.
+static bool isAbandoned(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= FRAME_SERVER_HEADER_SIZE) {
+        memory = mmap(nullptr, FRAME_SERVER_HEADER_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    const SharedFrameHeader* existing = static_cast<const SharedFrameHeader*>(memory);
+    bool abandoned = existing->magic.load(std::memory_order_acquire) == FRAME_SERVER_MAGIC
+        && kill(static_cast<pid_t>(existing->producerPid), 0) != 0 && errno == ESRCH;
+    munmap(memory, FRAME_SERVER_HEADER_SIZE);
+    return abandoned;
+}
+
+FrameServer::~FrameServer() {
+    close();
+}
+
+bool FrameServer::open(const std::string& name, int slotCount) {
+    close();
+    this->name = sharedName(name);
+    this->slotCount = std::clamp(slotCount, 2, 0xFFFF);
+
+    int fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST && isAbandoned(this->name)) {
+        shm_unlink(this->name.c_str()); // Start from a fresh object, not a crashed run's
+        fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0) {
+        return false;
+    }
+    size_t size = FRAME_SERVER_HEADER_SIZE + slotStride() * this->slotCount;
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // The mapping keeps the object alive
+    if (memory == MAP_FAILED) {
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    mapping = static_cast<uint8_t*>(memory);
+    mappingSize = size;
+
+    // ftruncate zero fills, so every slot starts published-empty (sequence 0)
+    header = new (mapping) SharedFrameHeader;
+    header->version = FRAME_SERVER_VERSION;
+    header->slotCount = static_cast<uint16_t>(this->slotCount);
+    header->width = SCREEN_WIDTH;
+    header->height = SCREEN_HEIGHT;
+    header->bytesPerPixel = 4;
+    header->pixelOffset = FRAME_SERVER_PIXEL_OFFSET;
+    header->slotSize = static_cast<uint32_t>(slotStride());
+    header->producerPid = static_cast<uint32_t>(getpid());
+    header->publishedFrames.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < this->slotCount; ++i) {
+        new (slot(i)) SharedFrameSlot{};
+    }
+    // Magic last: a reader that sees it sees a complete header
+    header->magic.store(FRAME_SERVER_MAGIC, std::memory_order_release);
+
+    back = 0;
+    publishedFrames = 0;
+    beginSlot();
+    return true;
+}
+
+void FrameServer::close() {
+    if (!mapping) {
+        return;
+    }
+    if (source) {
+        source->setFrameServer(nullptr); // Draws into its own storage again, not the unmapped slot
+    }
+    munmap(mapping, mappingSize);
+    shm_unlink(name.c_str());
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+}
+
+bool FrameServer::isOpen() const {
+    return mapping != nullptr;
+}
+
+SharedFrameSlot* FrameServer::slot(int index) const {
+    return reinterpret_cast<SharedFrameSlot*>(mapping + FRAME_SERVER_HEADER_SIZE + slotStride() * index);
+}
+
+// Mark the back slot as being written (odd sequence) before any pixel lands in it
+void FrameServer::beginSlot() {
+    SharedFrameSlot* current = slot(back);
+    current->sequence.store(current->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+uint8_t* FrameServer::backBuffer() {
+    return reinterpret_cast<uint8_t*>(slot(back)) + FRAME_SERVER_PIXEL_OFFSET;
+}
+
+void FrameServer::publish(uint64_t frameNumber) {
+    SharedFrameSlot* current = slot(back);
+    current->frameNumber.store(frameNumber, std::memory_order_relaxed);
+    current->sequence.store(current->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    header->publishedFrames.store(++publishedFrames, std::memory_order_release);
+
+    back = (back + 1) % slotCount;
+    beginSlot();
+}
+
+void FrameServer::submit(const uint8_t* frameBuffer, uint64_t frameNumber) {
+    std::memcpy(backBuffer(), frameBuffer, FRAME_BUFFER_SIZE);
+    publish(frameNumber);
+}
+
+uint64_t FrameServer::getPublishedFrames() const {
+    return publishedFrames;
+}
+
+// Constructor
+FrameClient::FrameClient() : mapping(nullptr), mappingSize(0), header(nullptr) {
+}
+
+FrameClient::~FrameClient() {
+    close();
+}
+
+bool FrameClient::open(const std::string& name) {
+    close();
+    int fd = shm_open(sharedName(name).c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < FRAME_SERVER_HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    void* memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    mapping = static_cast<const uint8_t*>(memory);
+    mappingSize = info.st_size;
+    header = reinterpret_cast<const SharedFrameHeader*>(mapping);
+
+    if (header->magic.load(std::memory_order_acquire) != FRAME_SERVER_MAGIC || header->version != FRAME_SERVER_VERSION
+        || FRAME_SERVER_HEADER_SIZE + static_cast<size_t>(header->slotSize) * header->slotCount > mappingSize) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void FrameClient::close() {
+    if (mapping) {
+        munmap(const_cast<uint8_t*>(mapping), mappingSize);
+    }
+    mapping = nullptr;
+    mappingSize = 0;
+    header = nullptr;
+}
+
+bool FrameClient::isOpen() const {
+    return mapping != nullptr;
+}
+
+int FrameClient::getWidth() const {
+    return header->width;
+}
+
+int FrameClient::getHeight() const {
+    return header->height;
+}
+
+uint64_t FrameClient::getPublishedFrames() const {
+    return header->publishedFrames.load(std::memory_order_acquire);
+}
+
+const SharedFrameSlot* FrameClient::slot(int index) const {
+    return reinterpret_cast<const SharedFrameSlot*>(mapping + FRAME_SERVER_HEADER_SIZE
+        + static_cast<size_t>(header->slotSize) * index);
+}
+
+bool FrameClient::acquire(SharedFrameView& view) const {
+    uint64_t published = getPublishedFrames();
+    if (published == 0) {
+        return false;
+    }
+    int index = static_cast<int>((published - 1) % header->slotCount);
+    const SharedFrameSlot* newest = slot(index);
+
+    uint64_t sequence = newest->sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+        return false; // Lapped: the producer is drawing into it again
+    }
+    view.pixels = reinterpret_cast<const uint8_t*>(newest) + header->pixelOffset;
+    view.frameNumber = newest->frameNumber.load(std::memory_order_relaxed);
+    view.sequence = sequence;
+    view.slot = index;
+    return isValid(view); // frameNumber must belong to this sequence
+}
+
+bool FrameClient::isValid(const SharedFrameView& view) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot(view.slot)->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
@@ -0,0 +1,122 @@
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "gpu.h"
+
+#ifndef frameserver_H
+#define frameserver_H
+
+// Layout of the shared memory object (same host, so native byte order):
+//   SharedFrameHeader, then slotCount slots of slotSize bytes, each a
+//   SharedFrameSlot followed by the frame's pixels at pixelOffset.
+// Slots are seqlocks: the sequence is odd while the producer draws into the slot and
+// even once it is published. A reader takes the newest slot, uses the pixels in place
+// and checks afterwards that the sequence did not move (see FrameClient).
+struct SharedFrameHeader {
+    std::atomic<uint32_t> magic; // 'GBSM', stored last with release: the rest is valid once it reads back
+    uint16_t version;
+    uint16_t slotCount;
+    uint16_t width;
+    uint16_t height;
+    uint16_t bytesPerPixel;
+    uint16_t pixelOffset;    // From the start of a slot
+    uint32_t slotSize;
+    uint32_t producerPid;
+    std::atomic<uint64_t> publishedFrames; // The newest frame is in slot (publishedFrames - 1) % slotCount
+};
+
+struct SharedFrameSlot {
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> frameNumber; // Relaxed: the sequence orders it like the pixels
+};
+
+constexpr uint32_t FRAME_SERVER_MAGIC = 0x4D534247; // "GBSM"
+constexpr uint16_t FRAME_SERVER_VERSION = 1;
+constexpr size_t FRAME_SERVER_HEADER_SIZE = 64;
+constexpr size_t FRAME_SERVER_PIXEL_OFFSET = 64;
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+    "shared frame counters must be lock free");
+static_assert(sizeof(SharedFrameHeader) <= FRAME_SERVER_HEADER_SIZE, "shared frame header too large");
+
+// Publishes frames into a POSIX shared memory ring (shm_open) for viewers and encoders in
+// other processes. Attach it to a GPU (GPU::setFrameServer) to have frames drawn straight
+// into the shared slots, or submit frames by hand.
+class FrameServer {
+    friend class GPU;
+
+private:
+    std::string name;
+    uint8_t* mapping;
+    size_t mappingSize;
+    SharedFrameHeader* header;
+    int slotCount;
+    int back; // Slot being drawn
+    uint64_t publishedFrames;
+    GPU* source; // GPU drawing into the slots, kept by GPU::setFrameServer
+
+    SharedFrameSlot* slot(int index) const;
+    void beginSlot();
+
+public:
+    // Constructor
+    FrameServer();
+    ~FrameServer();
+    FrameServer(const FrameServer&) = delete;
+    FrameServer& operator=(const FrameServer&) = delete;
+
+    // Create the named object, e.g. "/gameboy"; false on failure, including when another
+    // live producer already serves that name (one left behind by a dead one is replaced)
+    bool open(const std::string& name, int slotCount = 4);
+    // Detach the attached GPU, then unmap and unlink; mapped readers keep their view until
+    // they close it
+    void close();
+    bool isOpen() const;
+
+    // Slot to draw into, then hand it over with its frame number
+    uint8_t* backBuffer();
+    void publish(uint64_t frameNumber);
+    // Copy a finished RGBA frame into the back slot and publish it
+    void submit(const uint8_t* frameBuffer, uint64_t frameNumber);
+    uint64_t getPublishedFrames() const;
+};
+
+// A frame read in place from the ring; only valid if FrameClient::isValid says so after use
+struct SharedFrameView {
+    const uint8_t* pixels;
+    uint64_t frameNumber;
+    uint64_t sequence;
+    int slot;
+};
+
+// Read side: maps a FrameServer's object read only
+class FrameClient {
+private:
+    const uint8_t* mapping;
+    size_t mappingSize;
+    const SharedFrameHeader* header;
+
+    const SharedFrameSlot* slot(int index) const;
+
+public:
+    // Constructor
+    FrameClient();
+    ~FrameClient();
+    FrameClient(const FrameClient&) = delete;
+    FrameClient& operator=(const FrameClient&) = delete;
+
+    bool open(const std::string& name);
+    void close();
+    bool isOpen() const;
+
+    int getWidth() const;
+    int getHeight() const;
+    uint64_t getPublishedFrames() const;
+
+    // Newest published frame, false if there is none or the producer is already redrawing it
+    bool acquire(SharedFrameView& view) const;
+    // Whether the producer left the frame alone while it was being read
+    bool isValid(const SharedFrameView& view) const;
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include "framesink.h"
+#include "gpu.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef GB_USE_ZLIB
+#include <zlib.h>
+#endif
+
+// Constructor
+FrameSink::FrameSink() : fd(-1), ownsDescriptor(false), frameBytes(SCREEN_WIDTH * SCREEN_HEIGHT * 4),
+    pendingOffset(0), writtenFrames(0), droppedFrames(0), pngHead(0), pngCount(0),
+    pngDroppedFrames(0), pngStopping(false) {
+}
+
+FrameSink::~FrameSink() {
+    disablePNG();
+    close();
+}
+
+bool FrameSink::openFile(const std::string& filePath) {
+    close();
+    fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ownsDescriptor = true;
+    return openDescriptor(fd);
+}
+
+bool FrameSink::openPipe(const std::string& pipePath) {
+    close();
+    if (mkfifo(pipePath.c_str(), 0644) != 0 && errno != EEXIST) {
+        return false;
+    }
+
+    fd = ::open(pipePath.c_str(), O_WRONLY | O_NONBLOCK);
+    if (fd < 0 && errno == ENXIO) {
+        // No reader yet: hold the read end ourselves so opening never blocks
+        fd = ::open(pipePath.c_str(), O_RDWR | O_NONBLOCK);
+    }
+#ifdef F_SETPIPE_SZ
+    if (fd >= 0) {
+        fcntl(fd, F_SETPIPE_SZ, 1 << 20); // Room for several frames
+    }
+#endif
+    ownsDescriptor = true;
+    return openDescriptor(fd);
+}
+
+bool FrameSink::openDescriptor(int descriptor) {
+    if (descriptor < 0) {
+        return false;
+    }
+    fd = descriptor;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    pending.reserve(sizeof(FrameHeader) + frameBytes);
+    pending.clear();
+    pendingOffset = 0;
+    return true;
+}
+
+void FrameSink::close() {
+    if (fd >= 0 && ownsDescriptor) {
+        ::close(fd);
+    }
+    fd = -1;
+    ownsDescriptor = false;
+    pending.clear();
+    pendingOffset = 0;
+}
+
+// writev that reports a departed reader as EPIPE without touching the process's SIGPIPE
+// disposition: the signal is blocked on this thread for the call, and one the call raised is
+// consumed (unless one was already pending, which stays for its owner)
+static ssize_t writeWithoutSIGPIPE(int fd, const iovec* parts, int count) {
+    sigset_t pipeSignal, previous, pending;
+    sigemptyset(&pipeSignal);
+    sigaddset(&pipeSignal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSignal, &previous);
+    sigpending(&pending);
+    bool alreadyPending = sigismember(&pending, SIGPIPE);
+
+    ssize_t written = ::writev(fd, parts, count);
+    if (written < 0 && errno == EPIPE && !alreadyPending) {
+        int error = errno;
+        timespec immediately = { 0, 0 };
+        while (sigtimedwait(&pipeSignal, nullptr, &immediately) < 0 && errno == EINTR) {
+        }
+        errno = error;
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return written;
+}
+
+// Try to finish a partially written frame; true when nothing is left
+bool FrameSink::flushPending() {
+    while (pendingOffset < pending.size()) {
+        iovec rest = { pending.data() + pendingOffset, pending.size() - pendingOffset };
+        ssize_t written = writeWithoutSIGPIPE(fd, &rest, 1);
+        if (written <= 0) {
+            return false;
+        }
+        pendingOffset += written;
+    }
+    pending.clear();
+    pendingOffset = 0;
+    return true;
+}
+
+// Header and frame go out in a single writev straight from the frame buffer
+void FrameSink::submit(const uint8_t* frameBuffer, uint64_t frameNumber) {
+    if (!pngDirectory.empty()) {
+        std::unique_lock<std::mutex> lock(pngMutex);
+        if (pngCount == pngSlots.size()) {
+            pngDroppedFrames++;
+        }
+        else {
+            PNGSlot& slot = pngSlots[(pngHead + pngCount) % pngSlots.size()];
+            std::memcpy(slot.pixels.data(), frameBuffer, frameBytes);
+            slot.frameNumber = frameNumber;
+            pngCount++;
+            pngReady.notify_one();
+        }
+    }
+
+    if (fd < 0) {
+        return;
+    }
+    if (!pending.empty() && !flushPending()) {
+        droppedFrames++;
+        return;
+    }
+
+    FrameHeader header = {};
+    header.magic = FRAME_HEADER_MAGIC;
+    header.width = SCREEN_WIDTH;
+    header.height = SCREEN_HEIGHT;
+    header.bytesPerPixel = 4;
+    header.droppedFrames = static_cast<uint32_t>(droppedFrames);
+    header.frameNumber = frameNumber;
+
+    iovec parts[2];
+    parts[0].iov_base = &header;
+    parts[0].iov_len = sizeof(header);
+    parts[1].iov_base = const_cast<uint8_t*>(frameBuffer);
+    parts[1].iov_len = frameBytes;
+
+    ssize_t written = writeWithoutSIGPIPE(fd, parts, 2);
+    if (written < 0) {
+        droppedFrames++; // EAGAIN (reader is behind) or the reader went away
+        return;
+    }
+    writtenFrames++;
+
+    // Rare: the pipe took part of the frame; keep the rest so the stream stays framed
+    size_t total = sizeof(header) + frameBytes;
+    if (static_cast<size_t>(written) < total) {
+        size_t offset = written;
+        if (offset < sizeof(header)) {
+            pending.insert(pending.end(), reinterpret_cast<uint8_t*>(&header) + offset,
+                reinterpret_cast<uint8_t*>(&header) + sizeof(header));
+            offset = sizeof(header);
+        }
+        pending.insert(pending.end(), frameBuffer + (offset - sizeof(header)), frameBuffer + frameBytes);
+        pendingOffset = 0;
+    }
+}
+
+// PNG sequence
+bool FrameSink::enablePNG(const std::string& directory, int queueDepth) {
+    disablePNG();
+    mkdir(directory.c_str(), 0755);
+
+    pngDirectory = directory;
+    pngSlots.assign(std::max(queueDepth, 1), PNGSlot{ std::vector<uint8_t>(frameBytes), 0 });
+    pngHead = pngCount = 0;
+    pngStopping = false;
+    pngWorker = std::thread(&FrameSink::pngLoop, this);
+    return true;
+}
+
+void FrameSink::disablePNG() {
+    if (!pngWorker.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pngMutex);
+        pngStopping = true;
+    }
+    pngReady.notify_one();
+    pngWorker.join();
+    pngDirectory.clear();
+    pngSlots.clear();
+}
+
+void FrameSink::pngLoop() {
+    std::unique_lock<std::mutex> lock(pngMutex);
+    while (true) {
+        pngReady.wait(lock, [this] { return pngCount > 0 || pngStopping; });
+        if (pngCount == 0) {
+            return; // Stopping and drained
+        }
+
+        // Encode outside the lock; the producer never touches a queued slot
+        PNGSlot& slot = pngSlots[pngHead];
+        lock.unlock();
+
+        std::vector<uint8_t> png = encodePNG(slot.pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT);
+        char name[32];
+        std::snprintf(name, sizeof(name), "/frame_%08llu.png", static_cast<unsigned long long>(slot.frameNumber));
+        if (FILE* file = std::fopen((pngDirectory + name).c_str(), "wb")) {
+            std::fwrite(png.data(), 1, png.size(), file);
+            std::fclose(file);
+        }
+
+        lock.lock();
+        pngHead = (pngHead + 1) % pngSlots.size();
+        pngCount--;
+    }
+}
+
+uint64_t FrameSink::getWrittenFrames() const {
+    return writtenFrames;
+}
+
+uint64_t FrameSink::getDroppedFrames() const {
+    return droppedFrames;
+}
+
+uint64_t FrameSink::getDroppedPNGFrames() const {
+    return pngDroppedFrames;
+}
+
+// PNG encoding helpers
+static uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> values;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+            }
+            values[i] = value;
+        }
+        return values;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void appendChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+    appendBigEndian(out, static_cast<uint32_t>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    appendBigEndian(out, crc32(&out[start], out.size() - start));
+}
+
+// zlib stream: deflate when built with GB_USE_ZLIB, stored blocks otherwise
+static std::vector<uint8_t> zlibCompress(const std::vector<uint8_t>& data) {
+#ifdef GB_USE_ZLIB
+    uLongf length = compressBound(data.size());
+    std::vector<uint8_t> out(length);
+    compress2(out.data(), &length, data.data(), data.size(), 6);
+    out.resize(length);
+    return out;
+#else
+    std::vector<uint8_t> out = { 0x78, 0x01 };
+    size_t offset = 0;
+    do {
+        size_t block = std::min<size_t>(data.size() - offset, 65535);
+        out.push_back(offset + block == data.size() ? 1 : 0);
+        out.push_back(block & 0xFF);
+        out.push_back(block >> 8);
+        out.push_back(~block & 0xFF);
+        out.push_back((~block >> 8) & 0xFF);
+        out.insert(out.end(), data.begin() + offset, data.begin() + offset + block);
+        offset += block;
+    } while (offset < data.size());
+
+    uint32_t a = 1, b = 0; // Adler-32
+    for (uint8_t byte : data) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    appendBigEndian(out, (b << 16) | a);
+    return out;
+#endif
+}
+
+std::vector<uint8_t> encodePNG(const uint8_t* pixels, int width, int height) {
+    // Game Boy frames rarely use more than a handful of colours
+    std::vector<uint32_t> palette;
+    for (int i = 0; i < width * height && palette.size() <= 16; ++i) {
+        uint32_t color;
+        std::memcpy(&color, pixels + i * 4, 4);
+        if (std::find(palette.begin(), palette.end(), color) == palette.end()) {
+            palette.push_back(color);
+        }
+    }
+    bool indexed = palette.size() <= 16;
+    int bitDepth = indexed ? (palette.size() <= 4 ? 2 : 4) : 8;
+
+    std::vector<uint8_t> raw;
+    if (indexed) {
+        int pixelsPerByte = 8 / bitDepth;
+        int rowBytes = (width + pixelsPerByte - 1) / pixelsPerByte;
+        raw.assign(static_cast<size_t>(height) * (rowBytes + 1), 0);
+        for (int y = 0; y < height; ++y) {
+            uint8_t* row = &raw[y * (rowBytes + 1) + 1]; // Filter byte 0 (none)
+            for (int x = 0; x < width; ++x) {
+                uint32_t color;
+                std::memcpy(&color, pixels + (y * width + x) * 4, 4);
+                int index = static_cast<int>(std::find(palette.begin(), palette.end(), color) - palette.begin());
+                int shift = 8 - bitDepth * (x % pixelsPerByte + 1);
+                row[x / pixelsPerByte] |= index << shift;
+            }
+        }
+    }
+    else {
+        raw.reserve(static_cast<size_t>(height) * (width * 4 + 1));
+        for (int y = 0; y < height; ++y) {
+            raw.push_back(0);
+            raw.insert(raw.end(), pixels + y * width * 4, pixels + (y + 1) * width * 4);
+        }
+    }
+
+    std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    std::vector<uint8_t> ihdr;
+    appendBigEndian(ihdr, width);
+    appendBigEndian(ihdr, height);
+    ihdr.push_back(bitDepth);
+    ihdr.push_back(indexed ? 3 : 6); // Palette or RGBA
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+    ihdr.push_back(0);
+    appendChunk(png, "IHDR", ihdr);
+
+    if (indexed) {
+        std::vector<uint8_t> plte, trns;
+        bool opaque = true;
+        for (uint32_t color : palette) {
+            const uint8_t* rgba = reinterpret_cast<const uint8_t*>(&color);
+            plte.insert(plte.end(), rgba, rgba + 3);
+            trns.push_back(rgba[3]);
+            opaque = opaque && rgba[3] == 0xFF;
+        }
+        appendChunk(png, "PLTE", plte);
+        if (!opaque) {
+            appendChunk(png, "tRNS", trns);
+        }
+    }
+
+    appendChunk(png, "IDAT", zlibCompress(raw));
+    appendChunk(png, "IEND", {});
+    return png;
+}
@@ -0,0 +1,82 @@
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef framesink_H
+#define framesink_H
+
+// Header written in front of every raw frame (little endian)
+struct FrameHeader {
+    uint32_t magic;          // 'GBFR'
+    uint16_t width;
+    uint16_t height;
+    uint16_t bytesPerPixel;
+    uint16_t reserved;
+    uint32_t droppedFrames;  // Frames dropped by the sink before this one
+    uint64_t frameNumber;
+};
+
+constexpr uint32_t FRAME_HEADER_MAGIC = 0x52464247; // "GBFR"
+
+// Streams frames to a file descriptor, file or named pipe without blocking emulation
+class FrameSink {
+private:
+    int fd;
+    bool ownsDescriptor;
+    size_t frameBytes;
+
+    // Tail of a frame the pipe only partially accepted
+    std::vector<uint8_t> pending;
+    size_t pendingOffset;
+
+    uint64_t writtenFrames;
+    uint64_t droppedFrames;
+
+    // Optional PNG sequence, encoded on a worker thread
+    struct PNGSlot {
+        std::vector<uint8_t> pixels;
+        uint64_t frameNumber;
+    };
+    std::string pngDirectory;
+    std::vector<PNGSlot> pngSlots;
+    size_t pngHead;
+    size_t pngCount;
+    uint64_t pngDroppedFrames;
+    bool pngStopping;
+    std::mutex pngMutex;
+    std::condition_variable pngReady;
+    std::thread pngWorker;
+
+    bool flushPending();
+    void pngLoop();
+
+public:
+    // Constructor
+    FrameSink();
+    ~FrameSink();
+
+    // Output targets (raw stream)
+    bool openFile(const std::string& filePath);
+    bool openPipe(const std::string& pipePath);
+    bool openDescriptor(int descriptor);
+    void close();
+
+    // Write every submitted frame as <directory>/frame_<number>.png
+    bool enablePNG(const std::string& directory, int queueDepth = 4);
+    void disablePNG();
+
+    // Submit a completed RGBA frame; never blocks, drops and counts instead
+    void submit(const uint8_t* frameBuffer, uint64_t frameNumber);
+
+    uint64_t getWrittenFrames() const;
+    uint64_t getDroppedFrames() const;
+    uint64_t getDroppedPNGFrames() const;
+};
+
+// Encode an RGBA image as PNG (indexed when it has at most 16 colours)
+std::vector<uint8_t> encodePNG(const uint8_t* pixels, int width, int height);
+
+#endif
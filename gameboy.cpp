@@ -0,0 +1,263 @@
+#include "gameboy.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+// Constructor
+GameBoy::GameBoy() {
+    cpu.connectGPU(&gpu);
+    cpu.connectAPU(&apu);
+    reset();
+}
+
+GameBoy::~GameBoy() {
+    detachSaveFile();
+}
+
+// Reset function
+void GameBoy::reset() {
+    cpu.reset();
+    gpu.reset();
+    apu.reset(cpu.cycleCount);
+}
+
+// Load a cartridge from a ROM file
+bool GameBoy::loadROM(const std::string& filePath) {
+    std::shared_ptr<const Cartridge> cartridge = Cartridge::load(filePath);
+    if (!cartridge) {
+        return false;
+    }
+    insertCartridge(std::move(cartridge));
+    return true;
+}
+
+void GameBoy::insertCartridge(std::shared_ptr<const Cartridge> cartridge) {
+    detachSaveFile(); // The save belongs to the previous cartridge
+    cpu.insertCartridge(std::move(cartridge));
+    reset();
+}
+
+void GameBoy::copyFrom(const GameBoy& other) {
+    gpu.copyFrom(other.gpu);
+
+    // Shares work RAM and cartridge RAM chunks with other until either side writes
+    other.cpu.memoryMap.revokeRAMWrites();
+    cpu = other.cpu;
+    cpu.connectDebugger(debugger.empty() ? nullptr : &debugger);
+    cpu.connectTrace(trace.get());
+    cpu.connectGPU(&gpu);
+    cpu.connectAPU(other.cpu.apu ? &apu : nullptr);
+    apu.copyFrom(other.apu);
+}
+
+std::unique_ptr<GameBoy> GameBoy::fork() const {
+    auto child = std::make_unique<GameBoy>();
+    child->copyFrom(*this);
+    child->gpu.setFrameSkip(gpu.getFrameSkip());
+    child->gpu.setAccuracy(gpu.getAccuracy());
+    return child;
+}
+
+void GameBoy::setPipelinedRendering(bool enabled) {
+    gpu.setPipelined(enabled);
+    cpu.mapMemory(); // VRAM writes go through the GPU while pipelined
+}
+
+void GameBoy::setInput(uint8_t buttons) {
+    cpu.setJoypad(buttons);
+}
+
+// Run one frame on the core instantiation matching the attached debug features
+StopReason GameBoy::runFrame() {
+    uint64_t start = telemetry ? telemetryTicks() : 0;
+    uint64_t frame = gpu.getFrameCount();
+    uint64_t limit = cpu.cycleCount + CYCLES_PER_FRAME;
+    StopReason reason = (cpu.*cpu.selectCore())(frame, limit);
+    if (saveFile && !speculative && reason == StopReason::FrameComplete && ++framesSinceFlush >= saveFlushInterval) {
+        StageTimer timer(telemetry.get(), TelemetryStage::Output);
+        flushSaveFile();
+    }
+    if (telemetry) {
+        telemetry->endRun(telemetryTicks() - start, reason == StopReason::FrameComplete);
+    }
+    return reason;
+}
+
+// Debug points
+int GameBoy::addBreakpoint(uint16_t address, WatchCondition condition) {
+    int id = debugger.addBreakpoint(address, std::move(condition));
+    attachDebugger();
+    return id;
+}
+
+int GameBoy::addWatchpoint(uint16_t start, uint16_t end, uint8_t access, WatchCondition condition) {
+    int id = debugger.addWatchpoint(start, end, access, std::move(condition));
+    attachDebugger();
+    return id;
+}
+
+void GameBoy::removeDebugPoint(int id) {
+    debugger.removePoint(id);
+    attachDebugger();
+}
+
+void GameBoy::clearDebugPoints() {
+    debugger.clear();
+    attachDebugger();
+}
+
+const StopInfo& GameBoy::getStopInfo() const {
+    return debugger.getStopInfo();
+}
+
+void GameBoy::enableTrace(size_t entries) {
+    trace = std::make_unique<TraceBuffer>(entries);
+    cpu.connectTrace(trace.get());
+}
+
+void GameBoy::disableTrace() {
+    cpu.connectTrace(nullptr);
+    trace.reset();
+}
+
+const TraceBuffer* GameBoy::getTrace() const {
+    return trace.get();
+}
+
+void GameBoy::enableTelemetry() {
+    if (!telemetry) {
+        telemetry = std::make_unique<FrameTelemetry>();
+    }
+    gpu.setTelemetry(telemetry.get());
+    apu.setTelemetry(telemetry.get());
+}
+
+void GameBoy::disableTelemetry() {
+    gpu.setTelemetry(nullptr);
+    apu.setTelemetry(nullptr);
+    telemetry.reset();
+}
+
+FrameTelemetry* GameBoy::getTelemetry() {
+    return telemetry.get();
+}
+
+const FrameTelemetry* GameBoy::getTelemetry() const {
+    return telemetry.get();
+}
+
+// Only a machine with debug points routes anything through the debugger
+void GameBoy::attachDebugger() {
+    cpu.connectDebugger(debugger.empty() ? nullptr : &debugger);
+    cpu.mapMemory();
+}
+
+// Copy a CPU with its RAM copied into destination's own chunks instead of shared: the
+// chunks are moved aside around the assignment, so neither side is left with a shared one
+static void copyCPUState(CPU& destination, const CPU& source) {
+    auto wram = std::move(destination.wram);
+    auto sram = std::move(destination.sram);
+    destination = source;
+    destination.wram = std::move(wram);
+    destination.sram = std::move(sram);
+    destination.wram.copyContents(source.wram);
+    destination.sram.copyContents(source.sram);
+}
+
+// Save states
+void GameBoy::saveState(Snapshot& snapshot) const {
+    copyCPUState(snapshot.cpu, cpu);
+    gpu.saveState(snapshot.gpu);
+    apu.saveState(snapshot.apu);
+}
+
+void GameBoy::loadState(const Snapshot& snapshot) {
+    copyCPUState(cpu, snapshot.cpu);
+    cpu.connectDebugger(debugger.empty() ? nullptr : &debugger);
+    cpu.connectTrace(trace.get());
+    cpu.connectGPU(&gpu); // Keep this machine's devices attached
+    cpu.connectAPU(snapshot.cpu.apu ? &apu : nullptr);
+    gpu.loadState(snapshot.gpu);
+    apu.loadState(snapshot.apu);
+}
+
+// Battery saves
+bool GameBoy::attachSaveFile(const std::string& path) {
+    detachSaveFile();
+    bool rtc = cpu.cartridge && cpu.cartridge->rtc;
+    if (cpu.sram.empty() && !rtc) {
+        return false;
+    }
+    auto file = std::make_unique<SaveFile>();
+    if (!file->open(path, cpu.sram.size(), rtc)) {
+        return false;
+    }
+
+    // The file is authoritative (a new one is all zeroes, like fresh cartridge RAM)
+    for (size_t offset = 0; offset < cpu.sram.size(); offset += MEMORY_CHUNK_SIZE) {
+        size_t length = std::min(MEMORY_CHUNK_SIZE, cpu.sram.size() - offset);
+        std::memcpy(cpu.sram.unshare(offset), file->ram() + offset, length);
+    }
+    if (RTCFooter* footer = file->rtc(); footer && footer->timestamp) {
+        for (int i = 0; i < 5; ++i) {
+            cpu.rtc.registers[i] = static_cast<uint8_t>(footer->registers[i]);
+            cpu.rtc.latched[i] = static_cast<uint8_t>(footer->latched[i]);
+        }
+        cpu.rtc.cycle = cpu.cycleCount;
+        cpu.rtc.subsecond = 0;
+        // The cartridge battery kept the clock running meanwhile
+        int64_t now = static_cast<int64_t>(std::time(nullptr));
+        cpu.advanceRTC(now > static_cast<int64_t>(footer->timestamp) ? now - footer->timestamp : 0);
+    }
+
+    saveFile = std::move(file);
+    flushedRAM = cpu.sram;
+    cpu.mapRAM(); // Shared chunks are read only in the page table now
+    framesSinceFlush = 0;
+    return true;
+}
+
+void GameBoy::detachSaveFile() {
+    if (!saveFile) {
+        return;
+    }
+    flushSaveFile();
+    saveFile.reset(); // Unmapping waits for the data to reach the disk
+    flushedRAM.assign(0);
+}
+
+void GameBoy::flushSaveFile() {
+    if (!saveFile) {
+        return;
+    }
+    size_t size = std::min(cpu.sram.size(), saveFile->getRAMSize());
+    for (size_t offset = 0; offset < size; offset += MEMORY_CHUNK_SIZE) {
+        if (!cpu.sram.sharesChunk(flushedRAM, offset)) {
+            size_t length = std::min(MEMORY_CHUNK_SIZE, size - offset);
+            std::memcpy(saveFile->ram() + offset, cpu.sram.readPointer(offset), length);
+            saveFile->markDirty(offset, length);
+        }
+    }
+    if (RTCFooter* footer = saveFile->rtc()) {
+        cpu.updateRTC();
+        for (int i = 0; i < 5; ++i) {
+            footer->registers[i] = cpu.rtc.registers[i];
+            footer->latched[i] = cpu.rtc.latched[i];
+        }
+        footer->timestamp = static_cast<uint64_t>(std::time(nullptr));
+        saveFile->markDirty(saveFile->getRAMSize(), sizeof(RTCFooter));
+    }
+    saveFile->flush();
+
+    flushedRAM = cpu.sram;
+    cpu.mapRAM();
+    framesSinceFlush = 0;
+}
+
+void GameBoy::setSaveFlushInterval(int frames) {
+    saveFlushInterval = std::max(frames, 1);
+}
+
+void GameBoy::setSpeculative(bool speculative) {
+    this->speculative = speculative;
+}
@@ -0,0 +1,109 @@
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "cpu.h"
+#include "gpu.h"
+#include "apu.h"
+#include "debugger.h"
+#include "savefile.h"
+#include "telemetry.h"
+
+#ifndef gameboy_H
+#define gameboy_H
+
+// T-cycles in one 59.7 Hz frame (154 lines of 456 cycles)
+constexpr int CYCLES_PER_FRAME = 70224;
+
+// Machine snapshot: CPU registers and memory plus GPU and APU state (the ROM is shared, not
+// copied). RAM is copied into the snapshot's own chunks, never shared with the machine.
+struct Snapshot {
+    CPU cpu;
+    GPUState gpu;
+    APUState apu;
+};
+
+// A complete machine: CPU with its GPU and APU connected
+class GameBoy {
+public:
+    CPU cpu;
+    GPU gpu;
+    APU apu;
+    Debugger debugger;
+
+    // Constructor
+    GameBoy();
+    ~GameBoy();
+    GameBoy(const GameBoy&) = delete;
+    GameBoy& operator=(const GameBoy&) = delete;
+
+    // Reset all components
+    void reset();
+    // Load a cartridge (shared with other instances loading the same file)
+    bool loadROM(const std::string& filePath);
+    void insertCartridge(std::shared_ptr<const Cartridge> cartridge);
+
+    // Copy another machine's state; RAM is shared copy-on-write, the audio output starts empty
+    void copyFrom(const GameBoy& other);
+    // New machine sharing this one's RAM until either writes (use MachinePool::fork in hot loops)
+    std::unique_ptr<GameBoy> fork() const;
+
+    // Draw scanlines on a worker thread while the CPU keeps running (same pixels)
+    void setPipelinedRendering(bool enabled);
+
+    // Buttons held (JOYPAD_* bits)
+    void setInput(uint8_t buttons);
+    // Run until the next VBlank (or one frame of cycles with the LCD off); returns early
+    // when a breakpoint or watchpoint fires, the next call resumes the same frame
+    StopReason runFrame();
+
+    // Breakpoints and watchpoints (pages without one keep full speed), ids for removal
+    int addBreakpoint(uint16_t address, WatchCondition condition = nullptr);
+    int addWatchpoint(uint16_t start, uint16_t end, uint8_t access, WatchCondition condition = nullptr);
+    void removeDebugPoint(int id);
+    void clearDebugPoints();
+    const StopInfo& getStopInfo() const;
+
+    // Record the most recent instructions (runFrame switches to the tracing core)
+    void enableTrace(size_t entries = 4096);
+    void disableTrace();
+    const TraceBuffer* getTrace() const; // Null while tracing is off
+
+    // Per-frame timing of CPU, PPU, APU, output and render worker waits, aggregated into
+    // histograms (scrape from any thread, or FrameTelemetry::setDumpFile for a JSON file).
+    // Off by default; costs a few timer reads per frame. Forks do not inherit it.
+    void enableTelemetry();
+    void disableTelemetry();
+    FrameTelemetry* getTelemetry(); // Null while telemetry is off
+    const FrameTelemetry* getTelemetry() const;
+
+    // Save states (the snapshot is owned by the caller; reusing one does not allocate)
+    void saveState(Snapshot& snapshot) const;
+    void loadState(const Snapshot& snapshot);
+
+    // Battery save: cartridge RAM (and the MBC3 clock) is loaded from the file and written
+    // back to it every few frames from runFrame, only the 4 KB chunks written since the
+    // last flush. Forks do not inherit the file. False without cartridge RAM or clock.
+    bool attachSaveFile(const std::string& path);
+    void detachSaveFile(); // Flushes first
+    void flushSaveFile();
+    void setSaveFlushInterval(int frames); // Default 60 (about a second)
+    // Frames run while set are rolled back afterwards (RunAhead): they neither flush the
+    // battery save nor count towards the flush interval
+    void setSpeculative(bool speculative);
+
+private:
+    std::unique_ptr<TraceBuffer> trace;
+    std::unique_ptr<FrameTelemetry> telemetry;
+
+    // Cartridge RAM as of the last flush: sharing its chunks with cpu.sram makes the first
+    // write to each one take the copy-on-write path, which is what marks it changed
+    std::unique_ptr<SaveFile> saveFile;
+    PagedRAM<MAX_SRAM_SIZE / MEMORY_CHUNK_SIZE> flushedRAM;
+    int saveFlushInterval = 60;
+    int framesSinceFlush = 0;
+    bool speculative = false;
+
+    void attachDebugger();
+};
+
+#endif
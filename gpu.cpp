@@ -1,49 +1,251 @@
 #include "gpu.h"
+#include "cpu.h"
+#include "renderpipeline.h"
+#include "frameexchange.h"
+#include "frameserver.h"
+#include "telemetry.h"
 #include <algorithm> // For fill function
+#include <cstring>
 #include <stdexcept> // For exceptions
 
+// Shade colours of the built-in schemes, lightest first
+static const std::array<uint32_t, 4> COLOR_SCHEMES[] = {
+    { 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 }, // Grayscale
+    { 0xFF9BBC0F, 0xFF8BAC0F, 0xFF306230, 0xFF0F380F }, // Green
+    { 0xFFC4CFA1, 0xFF8B956D, 0xFF4D533C, 0xFF1F1F1F }  // Pocket
+};
+
 // Constructor
-GPU::GPU() : cycleCounter(0), mode(GPUMode::OAM), currentScanline(0) {
+GPU::GPU() : frameBuffer(frameStorage), displayBuffer(frameStorage), exchange(nullptr), server(nullptr), telemetry(nullptr), cycleCounter(0), mode(GPUMode::OAM), currentScanline(0),
+    shadeColors(COLOR_SCHEMES[0]), accuracy(PPUAccuracy::Scanline) {
     reset();
 }
 
+GPU::~GPU() {
+    if (server) {
+        setFrameServer(nullptr); // The server must not detach a destroyed GPU when it closes
+    }
+}
+
 // Reset function
 void GPU::reset() {
+    if (pipeline) {
+        pipeline->finish();
+    }
     mode = GPUMode::OAM;
     cycleCounter = 0;
     currentScanline = 0;
-    std::fill(std::begin(frameBuffer), std::end(frameBuffer), 0);
+    lcdc = 0x91; // LCD on, BG on, unsigned tile data (post boot ROM state)
+    stat = 0;
+    scrollY = scrollX = 0;
+    lyc = 0;
+    dma = 0;
+    bgp = 0xFC;
+    obp0 = obp1 = 0xFF;
+    updatePalettes();
+    windowY = windowX = 0;
+    windowLine = 0;
+    statLine = false;
+    interruptRequests = 0;
+    frameCount = 0;
+    renderEvery = 1;
+    renderRequested = false;
+    lastFrameRendered = false;
+    beginFrame();
+    clearFrameBuffer();
+    std::fill(vram.begin(), vram.end(), 0);
     clearSprites(); // Clear any existing sprites on reset
 }
 
 // GPU step function
-void GPU::step(uint8_t cycles) {
+uint8_t GPU::step(uint8_t cycles) {
+    return accuracy == PPUAccuracy::PixelFIFO ? stepWith<PixelFIFOPolicy>(cycles) : stepWith<ScanlinePolicy>(cycles);
+}
+
+uint8_t GPU::advance(uint64_t cycles) {
+    if (!(lcdc & 0x80)) {
+        return 0;
+    }
+    // Chunks no longer than the shortest mode, so each transition happens in the chunk that reaches it
+    uint8_t interrupts = 0;
+    while (cycles > 0) {
+        uint8_t chunk = static_cast<uint8_t>(std::min<uint64_t>(cycles, 80));
+        interrupts |= step(chunk);
+        cycles -= chunk;
+    }
+    if (accuracy == PPUAccuracy::PixelFIFO && mode == GPUMode::VRAM && cycleCounter > 0) {
+        interrupts |= step(0); // Dots left over from the OAM scan: draw the pixels up to now
+    }
+    return interrupts;
+}
+
+// Walk the fixed mode lengths forward to the first transition that raises the STAT line or
+// enters VBlank. Mode 3 with the pixel FIFO only has a lower bound (one dot per pixel), so
+// the walk ends there and the next sync looks again.
+uint64_t GPU::cyclesUntilEvent() const {
+    if (!(lcdc & 0x80)) {
+        return UINT64_MAX;
+    }
+    bool pixelFIFO = accuracy == PPUAccuracy::PixelFIFO;
+    GPUMode nextMode = mode;
+    int line = currentScanline;
+    int elapsed = cycleCounter;
+    bool high = statLine;
+    uint64_t cycles = 0;
+    for (;;) {
+        switch (nextMode) {
+        case GPUMode::OAM:
+            cycles += std::max(modeLength(nextMode) - elapsed, 0);
+            nextMode = GPUMode::VRAM;
+            break;
+        case GPUMode::VRAM:
+            if (pixelFIFO) {
+                return cycles + std::max(SCREEN_WIDTH - fifo.x - elapsed, 1);
+            }
+            cycles += std::max(modeLength(nextMode) - elapsed, 0);
+            nextMode = GPUMode::HBlank;
+            break;
+        case GPUMode::HBlank:
+            cycles += std::max(modeLength(nextMode) - elapsed, 0);
+            if (++line == SCREEN_HEIGHT) {
+                return cycles;
+            }
+            nextMode = GPUMode::OAM;
+            break;
+        case GPUMode::VBlank:
+            cycles += std::max(modeLength(nextMode) - elapsed, 0);
+            if (++line > 153) {
+                line = 0;
+                nextMode = GPUMode::OAM;
+            }
+            break;
+        }
+        bool next = isStatLineHigh(nextMode, line);
+        if (next && !high) {
+            return cycles;
+        }
+        if (pixelFIFO && nextMode == GPUMode::VRAM) {
+            return cycles + SCREEN_WIDTH;
+        }
+        high = next;
+        elapsed = 0;
+    }
+}
+
+uint64_t GPU::cyclesUntilModeChange() const {
+    if (!(lcdc & 0x80)) {
+        return UINT64_MAX;
+    }
+    if (accuracy == PPUAccuracy::PixelFIFO && mode == GPUMode::VRAM) {
+        return std::max(SCREEN_WIDTH - fifo.x - cycleCounter, 1); // At least one dot per pixel
+    }
+    return std::max(modeLength(mode) - cycleCounter, 0);
+}
+
+// The scanline renderer reads at the end of mode 3, the pixel FIFO from its OAM scan at the
+// start of mode 3 on
+uint64_t GPU::cyclesUntilVRAMRead() const {
+    if (!(lcdc & 0x80)) {
+        return UINT64_MAX;
+    }
+    bool pixelFIFO = accuracy == PPUAccuracy::PixelFIFO;
+    uint64_t lineStart = pixelFIFO ? 80 : 80 + 172; // From the start of a line
+    uint64_t left = cyclesUntilModeChange();
+    switch (mode) {
+    case GPUMode::OAM:
+        return pixelFIFO ? left : left + 172;
+    case GPUMode::VRAM:
+        return pixelFIFO ? 0 : left;
+    case GPUMode::HBlank:
+        return left + (currentScanline + 1 < SCREEN_HEIGHT ? 0 : 10 * 456) + lineStart;
+    case GPUMode::VBlank:
+        return left + (153 - currentScanline) * 456 + lineStart;
+    }
+    return 0;
+}
+
+// Lines whose drawing is timed (the render worker's own time shows up as Wait instead)
+bool GPU::isTelemetryLine() const {
+    return telemetry && renderingFrame
+        && currentScanline % TELEMETRY_PPU_STRIDE == static_cast<int>(frameCount % TELEMETRY_PPU_STRIDE);
+}
+
+// Fixed length of each mode in dots (mode 3 with the pixel FIFO has none, HBlank makes up the line)
+int GPU::modeLength(GPUMode mode) const {
+    switch (mode) {
+    case GPUMode::OAM: return 80;
+    case GPUMode::VRAM: return 172;
+    case GPUMode::HBlank: return accuracy == PPUAccuracy::PixelFIFO ? 376 - fifo.dots : 204;
+    case GPUMode::VBlank: return 456;
+    }
+    return 456;
+}
+
+template<typename Accuracy>
+uint8_t GPU::stepWith(uint8_t cycles) {
+    if (!(lcdc & 0x80)) {
+        return 0; // LCD is off
+    }
+
+    interruptRequests = 0;
     cycleCounter += cycles;
 
     switch (mode) {
     case GPUMode::OAM:
         if (cycleCounter >= 80) {
             cycleCounter -= 80;
-            mode = GPUMode::VRAM;
+            setMode(GPUMode::VRAM);
+            if constexpr (Accuracy::pixelFIFO) {
+                startPixelFIFO();
+            }
         }
         break;
     case GPUMode::VRAM:
-        if (cycleCounter >= 172) {
+        if constexpr (Accuracy::pixelFIFO) {
+            StageTimer timer(isTelemetryLine() ? telemetry : nullptr, TelemetryStage::PPU, TELEMETRY_PPU_STRIDE);
+            while (cycleCounter > 0 && fifo.x < SCREEN_WIDTH) {
+                tickPixelFIFO();
+                cycleCounter--;
+            }
+            if (fifo.x == SCREEN_WIDTH) {
+                finishPixelFIFO();
+                setMode(GPUMode::HBlank);
+            }
+        }
+        else if (cycleCounter >= 172) {
             cycleCounter -= 172;
-            mode = GPUMode::HBlank;
-            renderScanLine();
+            if (renderingFrame && pipeline) {
+                pipeline->recordLine(*this);
+                if (isWindowVisible()) {
+                    windowLine++; // Kept in step for save states; the worker draws with the logged value
+                }
+            }
+            else if (renderingFrame) {
+                StageTimer timer(isTelemetryLine() ? telemetry : nullptr, TelemetryStage::PPU, TELEMETRY_PPU_STRIDE);
+                renderScanLine();
+            }
+            setMode(GPUMode::HBlank);
         }
         break;
     case GPUMode::HBlank:
-        if (cycleCounter >= 204) {
-            cycleCounter -= 204;
+        // Mode 3 and HBlank share 376 dots; the FIFO's mode 3 varies in length
+        if (cycleCounter >= (Accuracy::pixelFIFO ? 376 - fifo.dots : 204)) {
+            cycleCounter -= Accuracy::pixelFIFO ? 376 - fifo.dots : 204;
             currentScanline++;
             if (currentScanline == SCREEN_HEIGHT) {
-                mode = GPUMode::VBlank;
-                renderFrame();
+                setMode(GPUMode::VBlank);
+                interruptRequests |= INTERRUPT_VBLANK;
+                if (pipeline && renderingFrame) {
+                    pipeline->finish(); // Frame complete when control returns at VBlank
+                }
+                lastFrameRendered = renderingFrame;
+                frameCount++;
+                if ((exchange || server) && renderingFrame) {
+                    publishFrame();
+                }
             }
             else {
-                mode = GPUMode::OAM;
+                setMode(GPUMode::OAM);
             }
         }
         break;
@@ -53,114 +255,726 @@ void GPU::step(uint8_t cycles) {
             currentScanline++;
             if (currentScanline > 153) { // 10 lines in VBlank
                 currentScanline = 0;
-                mode = GPUMode::OAM;
+                windowLine = 0;
+                beginFrame();
+                setMode(GPUMode::OAM);
+            }
+            else {
+                updateStatLine();
             }
         }
         break;
     }
+
+    return interruptRequests;
 }
 
-// Draw a single tile
-void GPU::drawTile(int x, int y, uint8_t tileId, bool isBackground) {
-    uint8_t* tileData = getTileData(tileId);
+// Decide whether the frame about to start produces pixels
+void GPU::beginFrame() {
+    renderingFrame = renderRequested || (renderEvery > 0 && frameCount % renderEvery == 0);
+    renderRequested = false;
+}
 
-    for (int row = 0; row < TITLE_SIZE; ++row) {
-        for (int col = 0; col < TITLE_SIZE; ++col) {
-            int pixelIndex = row * TITLE_SIZE + col;
-            uint8_t colorIndex = tileData[pixelIndex];
-            uint32_t color = getColorFromIndex(colorIndex);
+void GPU::setAccuracy(PPUAccuracy accuracy) {
+    if (accuracy == PPUAccuracy::PixelFIFO && this->accuracy != accuracy && mode == GPUMode::VRAM) {
+        startPixelFIFO(); // Switched mid-line: redraw the line from its first pixel
+    }
+    this->accuracy = accuracy;
+}
 
-            int framebufferIndex = ((y + row) * SCREEN_WIDTH + (x + col)) * 4;
+PPUAccuracy GPU::getAccuracy() const {
+    return accuracy;
+}
 
-            if (x + col < SCREEN_WIDTH && y + row < SCREEN_HEIGHT) {
-                frameBuffer[framebufferIndex] = (color >> 24) & 0xFF;
-                frameBuffer[framebufferIndex + 1] = (color >> 16) & 0xFF;
-                frameBuffer[framebufferIndex + 2] = (color >> 8) & 0xFF;
-                frameBuffer[framebufferIndex + 3] = color & 0xFF;
-            }
+void GPU::setFrameSkip(int renderEvery) {
+    this->renderEvery = renderEvery < 0 ? 0 : renderEvery;
+}
+
+int GPU::getFrameSkip() const {
+    return renderEvery;
+}
+
+void GPU::requestFrame() {
+    renderRequested = true;
+    if (currentScanline == 0 && mode == GPUMode::OAM) {
+        beginFrame(); // Nothing drawn yet in this frame
+    }
+}
+
+bool GPU::isFrameRendered() const {
+    return lastFrameRendered;
+}
+
+// Switch mode and re-evaluate the STAT interrupt line
+void GPU::setMode(GPUMode newMode) {
+    mode = newMode;
+    updateStatLine();
+}
+
+// STAT interrupt fires on the rising edge of the OR of all enabled sources
+void GPU::updateStatLine() {
+    bool line = isStatLineHigh(mode, currentScanline);
+    if (line && !statLine) {
+        interruptRequests |= INTERRUPT_STAT;
+    }
+    statLine = line;
+}
+
+bool GPU::isStatLineHigh(GPUMode mode, int line) const {
+    return (line == lyc && (stat & 0x40)) ||
+        (mode == GPUMode::HBlank && (stat & 0x08)) ||
+        (mode == GPUMode::VBlank && (stat & 0x10)) ||
+        (mode == GPUMode::OAM && (stat & 0x20));
+}
+
+// Read an LCD register
+uint8_t GPU::readRegister(uint16_t address) {
+    switch (address) {
+    case 0xFF40: return lcdc;
+    case 0xFF41: return 0x80 | (stat & 0x78) | (currentScanline == lyc ? 0x04 : 0) | static_cast<uint8_t>(mode);
+    case 0xFF42: return scrollY;
+    case 0xFF43: return scrollX;
+    case 0xFF44: return static_cast<uint8_t>(currentScanline);
+    case 0xFF45: return lyc;
+    case 0xFF46: return dma;
+    case 0xFF47: return bgp;
+    case 0xFF48: return obp0;
+    case 0xFF49: return obp1;
+    case 0xFF4A: return windowY;
+    case 0xFF4B: return windowX;
+    default: return 0xFF;
+    }
+}
+
+// Write an LCD register
+uint8_t GPU::writeRegister(uint16_t address, uint8_t value) {
+    interruptRequests = 0;
+    switch (address) {
+    case 0xFF40:
+        if ((lcdc & 0x80) && !(value & 0x80)) {
+            // LCD switched off: LY resets, the PPU idles in HBlank and the STAT line drops
+            currentScanline = 0;
+            cycleCounter = 0;
+            windowLine = 0;
+            mode = GPUMode::HBlank;
+            statLine = false;
         }
+        else if (!(lcdc & 0x80) && (value & 0x80)) {
+            mode = GPUMode::OAM;
+        }
+        lcdc = value;
+        break;
+    case 0xFF41: stat = value & 0x78; break;
+    case 0xFF42: scrollY = value; break;
+    case 0xFF43: scrollX = value; break;
+    case 0xFF44: break; // LY is read only
+    case 0xFF45: lyc = value; break;
+    case 0xFF46: dma = value; break;
+    case 0xFF47: bgp = value; updatePalettes(); break;
+    case 0xFF48: obp0 = value; updatePalettes(); break;
+    case 0xFF49: obp1 = value; updatePalettes(); break;
+    case 0xFF4A: windowY = value; break;
+    case 0xFF4B: windowX = value; break;
+    default: break;
+    }
+
+    // Enabling a source, changing LYC or switching the LCD on can raise the line at once
+    if ((lcdc & 0x80) && (address == 0xFF40 || address == 0xFF41 || address == 0xFF45)) {
+        updateStatLine();
+    }
+    return interruptRequests;
+}
+
+// Decode one pixel of a 2bpp tile row
+uint8_t GPU::getTilePixel(const uint8_t* tileData, int row, int col) {
+    uint8_t low = tileData[row * 2];
+    uint8_t high = tileData[row * 2 + 1];
+    int bit = 7 - col;
+    return ((low >> bit) & 1) | (((high >> bit) & 1) << 1);
+}
+
+// Draw the background layer for the current scanline
+void GPU::drawBackgroundLine(uint8_t* lineColors) {
+    if (!(lcdc & 0x01)) {
+        std::fill(lineColors, lineColors + SCREEN_WIDTH, 0);
+        return;
+    }
+
+    uint16_t mapBase = (lcdc & 0x08) ? 0x1C00 : 0x1800;
+    int mapY = (currentScanline + scrollY) & 0xFF;
+
+    for (int x = 0; x < SCREEN_WIDTH; ++x) {
+        int mapX = (x + scrollX) & 0xFF;
+        uint8_t tileId = vram[mapBase + (mapY / TITLE_SIZE) * TITLE_MAP_SIZE + mapX / TITLE_SIZE];
+        const uint8_t* tileData = (lcdc & 0x10) ? getTileData(tileId)
+            : &vram[0x1000 + static_cast<int8_t>(tileId) * 16];
+
+        lineColors[x] = getTilePixel(tileData, mapY % TITLE_SIZE, mapX % TITLE_SIZE);
     }
 }
 
-// Draw a single sprite
-void GPU::drawSprite(int x, int y, uint8_t tileId, bool xFlip, bool yFlip) {
-    uint8_t* spriteData = getTileData(tileId);
+// Draw the window layer over the background for the current scanline
+void GPU::drawWindowLine(uint8_t* lineColors) {
+    if (!isWindowVisible()) {
+        return;
+    }
+
+    uint16_t mapBase = (lcdc & 0x40) ? 0x1C00 : 0x1800;
+    int startX = windowX - 7;
+
+    for (int x = std::max(startX, 0); x < SCREEN_WIDTH; ++x) {
+        int mapX = x - startX;
+        uint8_t tileId = vram[mapBase + (windowLine / TITLE_SIZE) * TITLE_MAP_SIZE + mapX / TITLE_SIZE];
+        const uint8_t* tileData = (lcdc & 0x10) ? getTileData(tileId)
+            : &vram[0x1000 + static_cast<int8_t>(tileId) * 16];
+
+        lineColors[x] = getTilePixel(tileData, windowLine % TITLE_SIZE, mapX % TITLE_SIZE);
+    }
+    windowLine++;
+}
+
+bool GPU::isWindowVisible() const {
+    return (lcdc & 0x20) && (lcdc & 0x01) && currentScanline >= windowY && windowX <= 166;
+}
+
+// Draw up to 10 sprites over the current scanline's pixels
+void GPU::drawSpriteLine(const uint8_t* lineColors, uint32_t* linePixels) {
+    if (!(lcdc & 0x02)) {
+        return;
+    }
+
+    int height = (lcdc & 0x04) ? 16 : 8;
+    int visible[MAX_SPRITES_PER_LINE];
+    int count = 0;
+
+    for (int spriteIndex = 0; spriteIndex < MAX_SPRITES && count < MAX_SPRITES_PER_LINE; ++spriteIndex) {
+        int spriteY = oam[spriteIndex * 4] - 16; // Adjust for sprite offset
+        if (currentScanline >= spriteY && currentScanline < spriteY + height) {
+            visible[count++] = spriteIndex;
+        }
+    }
+
+    // Lower X wins, ties go to the lower OAM index; draw lowest priority first
+    std::stable_sort(visible, visible + count, [this](int a, int b) {
+        return oam[a * 4 + 1] < oam[b * 4 + 1];
+    });
+
+    for (int i = count - 1; i >= 0; --i) {
+        int spriteIndex = visible[i];
+        int spriteY = oam[spriteIndex * 4] - 16;
+        int spriteX = oam[spriteIndex * 4 + 1] - 8;
+        uint8_t tileId = oam[spriteIndex * 4 + 2];
+        uint8_t attributes = oam[spriteIndex * 4 + 3];
+
+        bool xFlip = attributes & 0x20;
+        bool yFlip = attributes & 0x40;
+        bool behindBackground = attributes & 0x80;
+        const uint32_t* colors = spriteColors[(attributes >> 4) & 1]; // OBP0 or OBP1
+
+        int row = currentScanline - spriteY;
+        if (yFlip) {
+            row = height - 1 - row;
+        }
+        if (height == 16) {
+            tileId &= 0xFE;
+        }
+        const uint8_t* spriteData = getTileData(tileId);
 
-    for (int row = 0; row < TITLE_SIZE; row++) {
         for (int col = 0; col < TITLE_SIZE; ++col) {
-            int spriteRow = yFlip ? (TITLE_SIZE - 1 - row) : row;
-            int spriteCol = xFlip ? (TITLE_SIZE - 1 - col) : col;
+            int x = spriteX + col;
+            if (x < 0 || x >= SCREEN_WIDTH) continue;
 
-            int pixelIndex = spriteRow * TITLE_SIZE + spriteCol;
-            uint8_t colorIndex = spriteData[pixelIndex];
+            uint8_t colorIndex = getTilePixel(spriteData, row, xFlip ? (TITLE_SIZE - 1 - col) : col);
             if (colorIndex == 0) continue; // Skip transparent pixels
+            if (behindBackground && lineColors[x] != 0) continue;
 
-            uint32_t color = getColorFromIndex(colorIndex);
-            int framebufferIndex = ((y + row) * SCREEN_WIDTH + (x + col)) * 4;
+            linePixels[x] = colors[colorIndex];
+        }
+    }
+}
 
-            if (x + col < SCREEN_WIDTH && y + row < SCREEN_HEIGHT) {
-                frameBuffer[framebufferIndex] = (color >> 24) & 0xFF;
-                frameBuffer[framebufferIndex + 1] = (color >> 16) & 0xFF;
-                frameBuffer[framebufferIndex + 2] = (color >> 8) & 0xFF;
-                frameBuffer[framebufferIndex + 3] = color & 0xFF;
-            }
+// Set up the fetcher and FIFOs at the start of mode 3
+void GPU::startPixelFIFO() {
+    fifo.backgroundPosition = 0;
+    fifo.backgroundCount = 0;
+    std::fill(std::begin(fifo.spriteColor), std::end(fifo.spriteColor), 0);
+    fifo.x = 0;
+    fifo.discard = scrollX & 7;
+    fifo.dots = 0;
+    fifo.stall = 6; // The first tile is fetched twice, the first result is thrown away
+    fifo.fetchStep = 0;
+    fifo.fetchX = 0;
+    fifo.window = false;
+    fifo.pendingSprite = -1;
+    fifo.nextSprite = 0;
+    fifo.spriteCount = 0;
+
+    // OAM scan: the first 10 sprites on this line, fetched in X order (OAM order on ties)
+    int height = (lcdc & 0x04) ? 16 : 8;
+    for (int spriteIndex = 0; spriteIndex < MAX_SPRITES && fifo.spriteCount < MAX_SPRITES_PER_LINE; ++spriteIndex) {
+        int spriteY = oam[spriteIndex * 4] - 16;
+        if (currentScanline >= spriteY && currentScanline < spriteY + height) {
+            fifo.sprites[fifo.spriteCount++] = static_cast<uint8_t>(spriteIndex);
         }
     }
+    std::stable_sort(fifo.sprites, fifo.sprites + fifo.spriteCount, [this](uint8_t a, uint8_t b) {
+        return oam[a * 4 + 1] < oam[b * 4 + 1];
+    });
+}
+
+// One dot of mode 3: fetch, then shift one pixel out to the LCD
+void GPU::tickPixelFIFO() {
+    fifo.dots++;
+    if (fifo.stall > 0) {
+        if (--fifo.stall == 0 && fifo.pendingSprite >= 0) {
+            fetchSprite(fifo.pendingSprite);
+            fifo.pendingSprite = -1;
+        }
+        return;
+    }
+
+    // Window start: drop the background pixels and restart the fetcher on window tiles
+    if (!fifo.window && isWindowVisible() && fifo.x + 7 >= windowX) {
+        fifo.window = true;
+        fifo.fetchStep = 0;
+        fifo.fetchX = 0;
+        fifo.backgroundCount = 0;
+        fifo.discard = fifo.x == 0 ? std::max(7 - windowX, 0) : 0;
+    }
+
+    // Sprite reached: the background fetch has to have pixels ready, then 6 dots of sprite fetch
+    if ((lcdc & 0x02) && fifo.nextSprite < fifo.spriteCount
+        && oam[fifo.sprites[fifo.nextSprite] * 4 + 1] <= fifo.x + 8) {
+        if (fifo.backgroundCount == 0) {
+            stepFetcher();
+            return;
+        }
+        fifo.pendingSprite = fifo.sprites[fifo.nextSprite++];
+        fifo.stall = 5;
+        return;
+    }
+
+    stepFetcher();
+    if (fifo.backgroundCount == 0) {
+        return;
+    }
+    uint8_t color = fifo.background[fifo.backgroundPosition++];
+    fifo.backgroundCount--;
+    if (fifo.discard > 0) {
+        fifo.discard--;
+        return;
+    }
+
+    // Mix with the sprite FIFO using the palettes as they are at this dot
+    int slot = fifo.x & 7;
+    uint8_t spriteColor = fifo.spriteColor[slot];
+    fifo.spriteColor[slot] = 0;
+
+    uint32_t pixel = blankColor; // Background off shows shade 0
+    if (lcdc & 0x01) {
+        pixel = backgroundColors[color];
+    }
+    else {
+        color = 0;
+    }
+    if (spriteColor && (lcdc & 0x02) && !((fifo.spriteAttributes[slot] & 0x80) && color != 0)) {
+        pixel = spriteColors[(fifo.spriteAttributes[slot] >> 4) & 1][spriteColor];
+    }
+    fifo.line[fifo.x++] = pixel;
+}
+
+// Background/window fetcher: tile number, low byte and high byte take 2 dots each,
+// then the 8 pixels are pushed as soon as the FIFO is empty
+void GPU::stepFetcher() {
+    switch (fifo.fetchStep++) {
+    case 1: {
+        int row, tileX;
+        uint16_t mapBase;
+        if (fifo.window) {
+            mapBase = (lcdc & 0x40) ? 0x1C00 : 0x1800;
+            row = windowLine;
+            tileX = fifo.fetchX & 31;
+        }
+        else {
+            mapBase = (lcdc & 0x08) ? 0x1C00 : 0x1800;
+            row = (currentScanline + scrollY) & 0xFF;
+            tileX = ((scrollX >> 3) + fifo.fetchX) & 31;
+        }
+        fifo.tileId = vram[mapBase + (row / TITLE_SIZE) * TITLE_MAP_SIZE + tileX];
+        fifo.tileRow = static_cast<uint8_t>(row % TITLE_SIZE);
+        break;
+    }
+    case 3:
+        fifo.tileLow = fetcherTileData()[fifo.tileRow * 2];
+        break;
+    case 5:
+        fifo.tileHigh = fetcherTileData()[fifo.tileRow * 2 + 1];
+        break;
+    case 6:
+        if (fifo.backgroundCount > 0) {
+            fifo.fetchStep = 6; // Wait for the FIFO to drain
+            break;
+        }
+        for (int col = 0; col < TITLE_SIZE; ++col) {
+            int bit = 7 - col;
+            fifo.background[col] = ((fifo.tileLow >> bit) & 1) | (((fifo.tileHigh >> bit) & 1) << 1);
+        }
+        fifo.backgroundPosition = 0;
+        fifo.backgroundCount = TITLE_SIZE;
+        fifo.fetchX++;
+        fifo.fetchStep = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+const uint8_t* GPU::fetcherTileData() {
+    return (lcdc & 0x10) ? getTileData(fifo.tileId) : &vram[0x1000 + static_cast<int8_t>(fifo.tileId) * 16];
+}
+
+// Merge a sprite's row into the sprite FIFO; pixels already there (lower X or OAM index) win
+void GPU::fetchSprite(int spriteIndex) {
+    int height = (lcdc & 0x04) ? 16 : 8;
+    int spriteY = oam[spriteIndex * 4] - 16;
+    int spriteX = oam[spriteIndex * 4 + 1] - 8;
+    uint8_t tileId = oam[spriteIndex * 4 + 2];
+    uint8_t attributes = oam[spriteIndex * 4 + 3];
+
+    int row = currentScanline - spriteY;
+    if (attributes & 0x40) {
+        row = height - 1 - row;
+    }
+    if (height == 16) {
+        tileId &= 0xFE;
+    }
+    const uint8_t* spriteData = getTileData(tileId);
+
+    for (int col = 0; col < TITLE_SIZE; ++col) {
+        int x = spriteX + col;
+        if (x < fifo.x) continue; // Off the left edge
+
+        uint8_t colorIndex = getTilePixel(spriteData, row, (attributes & 0x20) ? (TITLE_SIZE - 1 - col) : col);
+        if (colorIndex != 0 && fifo.spriteColor[x & 7] == 0) {
+            fifo.spriteColor[x & 7] = colorIndex;
+            fifo.spriteAttributes[x & 7] = attributes;
+        }
+    }
+}
+
+// End of mode 3: copy the line out and advance the window
+void GPU::finishPixelFIFO() {
+    if (renderingFrame && currentScanline < SCREEN_HEIGHT) {
+        std::memcpy(frameBuffer + currentScanline * SCREEN_WIDTH * 4, fifo.line, sizeof(fifo.line));
+    }
+    if (fifo.window) {
+        windowLine++;
+    }
 }
 
 // Render a full frame
 void GPU::renderFrame() {
-    for (int scanline = 0; scanline < SCREEN_HEIGHT; ++scanline) {
+    int savedScanline = currentScanline;
+    int savedWindowLine = windowLine;
+
+    windowLine = 0;
+    for (currentScanline = 0; currentScanline < SCREEN_HEIGHT; ++currentScanline) {
         renderScanLine();
     }
+
+    currentScanline = savedScanline;
+    windowLine = savedWindowLine;
 }
 
 // Render a single scanline
 void GPU::renderScanLine() {
-    for (int tileX = 0; tileX < SCREEN_WIDTH / TITLE_SIZE; ++tileX) {
-        int mapX = (tileX * TITLE_SIZE + scrollX) % (TITLE_MAP_SIZE * TITLE_SIZE);
-        int mapY = (currentScanline + scrollY) % (TITLE_MAP_SIZE * TITLE_SIZE);
+    if (currentScanline >= SCREEN_HEIGHT) {
+        return;
+    }
 
-        uint8_t tileId = backgroundTileMap[mapY / TITLE_SIZE][mapX / TITLE_SIZE];
-        drawTile(tileX * TITLE_SIZE, currentScanline, tileId, true);
+    // Colour indices first, then the palette applied to the whole line
+    uint8_t lineColors[SCREEN_WIDTH];
+    uint32_t linePixels[SCREEN_WIDTH];
+    drawBackgroundLine(lineColors);
+    drawWindowLine(lineColors);
+    if (lcdc & 0x01) {
+        for (int x = 0; x < SCREEN_WIDTH; ++x) {
+            linePixels[x] = backgroundColors[lineColors[x]];
+        }
+    }
+    else {
+        std::fill(linePixels, linePixels + SCREEN_WIDTH, blankColor); // Background off shows shade 0
     }
+    drawSpriteLine(lineColors, linePixels);
+    std::memcpy(frameBuffer + currentScanline * SCREEN_WIDTH * 4, linePixels, sizeof(linePixels));
+}
 
-    for (int spriteIndex = 0; spriteIndex < MAX_SPRITES; ++spriteIndex) {
-        int spriteY = oam[spriteIndex * 4] - 16; // Adjust for sprite offset
-        int spriteX = oam[spriteIndex * 4 + 1] - 8; // Adjust for sprite offset
-        uint8_t tileId = oam[spriteIndex * 4 + 2];
-        uint8_t attributes = oam[spriteIndex * 4 + 3];
+// Save the GPU state (the frame buffer is left alone so it keeps the last drawn frame)
+void GPU::saveState(GPUState& state) const {
+    state.vram = vram;
+    state.oam = oam;
+    state.mode = mode;
+    state.cycleCounter = cycleCounter;
+    state.currentScanline = currentScanline;
+    state.lcdc = lcdc;
+    state.stat = stat;
+    state.scrollY = scrollY;
+    state.scrollX = scrollX;
+    state.lyc = lyc;
+    state.dma = dma;
+    state.bgp = bgp;
+    state.obp0 = obp0;
+    state.obp1 = obp1;
+    state.windowY = windowY;
+    state.windowX = windowX;
+    state.windowLine = windowLine;
+    state.statLine = statLine;
+    state.frameCount = frameCount;
+}
 
-        if (currentScanline >= spriteY && currentScanline < spriteY + TITLE_SIZE) {
-            bool xFlip = attributes & 0x20;
-            bool yFlip = attributes & 0x40;
-            drawSprite(spriteX, spriteY, tileId, xFlip, yFlip);
-        }
+void GPU::loadState(const GPUState& state) {
+    if (pipeline) {
+        pipeline->finish(); // VRAM changes under the log; the next line resyncs the shadow
+    }
+    vram = state.vram;
+    oam = state.oam;
+    mode = state.mode;
+    cycleCounter = state.cycleCounter;
+    currentScanline = state.currentScanline;
+    lcdc = state.lcdc;
+    stat = state.stat;
+    scrollY = state.scrollY;
+    scrollX = state.scrollX;
+    lyc = state.lyc;
+    dma = state.dma;
+    bgp = state.bgp;
+    obp0 = state.obp0;
+    obp1 = state.obp1;
+    updatePalettes();
+    windowY = state.windowY;
+    windowX = state.windowX;
+    windowLine = state.windowLine;
+    statLine = state.statLine;
+    frameCount = state.frameCount;
+    if (accuracy == PPUAccuracy::PixelFIFO && mode == GPUMode::VRAM) {
+        startPixelFIFO(); // The FIFO is not part of the state; redraw the line from its start
+    }
+}
+
+// Direct machine to machine copy of the save state fields (no intermediate GPUState)
+void GPU::copyFrom(const GPU& other) {
+    if (pipeline) {
+        pipeline->finish();
     }
+    vram = other.vram;
+    oam = other.oam;
+    mode = other.mode;
+    cycleCounter = other.cycleCounter;
+    currentScanline = other.currentScanline;
+    lcdc = other.lcdc;
+    stat = other.stat;
+    scrollY = other.scrollY;
+    scrollX = other.scrollX;
+    lyc = other.lyc;
+    dma = other.dma;
+    bgp = other.bgp;
+    obp0 = other.obp0;
+    obp1 = other.obp1;
+    updatePalettes();
+    windowY = other.windowY;
+    windowX = other.windowX;
+    windowLine = other.windowLine;
+    statLine = other.statLine;
+    frameCount = other.frameCount;
+    fifo = other.fifo;
 }
 
 // Framebuffer pointer access
 uint8_t* GPU::getFrameBuffer() {
-    return frameBuffer;
+    if (pipeline) {
+        pipeline->finish();
+    }
+    return displayBuffer;
 }
 
-// Access tile data
-uint8_t* GPU::getTileData(uint8_t tileId) {
-    int tileAddress = tileId * 16; // Adjust according to your tile data layout
-    return &vram[tileAddress];
+void GPU::clearFrameBuffer() {
+    if (pipeline) {
+        pipeline->finish();
+    }
+    std::fill(frameBuffer, frameBuffer + FRAME_BUFFER_SIZE, 0);
+    displayBuffer = frameBuffer;
 }
 
-// Get color from palette
-uint32_t GPU::getColorFromIndex(uint8_t colorIndex) {
-    switch (colorIndex) {
-    case 0: return 0xFF000000; // Black
-    case 1: return 0xFF555555; // Dark Gray
-    case 2: return 0xFFAAAAAA; // Light Gray
-    case 3: return 0xFFFFFFFF; // White
-    default: return 0xFF000000; // Default to black
+void GPU::setPipelined(bool enabled) {
+    if (enabled && !pipeline) {
+        pipeline = std::make_unique<RenderPipeline>();
+        pipeline->setTelemetry(telemetry);
+        updateRenderTarget(); // The worker draws straight into this GPU's frame buffer
+    }
+    else if (!enabled && pipeline) {
+        pipeline->finish();
+        pipeline.reset();
     }
 }
 
+void GPU::setFrameExchange(FrameExchange* exchange) {
+    keepDisplayedFrame();
+    this->exchange = exchange;
+    updateRenderTarget();
+}
+
+bool GPU::setFrameServer(FrameServer* server) {
+    if (server && !server->isOpen()) {
+        return false;
+    }
+    if (this->server) {
+        this->server->source = nullptr;
+    }
+    if (server && server->source && server->source != this) {
+        server->source->setFrameServer(nullptr);
+    }
+    if (!exchange) {
+        keepDisplayedFrame(); // With an exchange attached the frames are shown from it
+    }
+    this->server = server;
+    if (server) {
+        server->source = this;
+    }
+    updateRenderTarget();
+    return true;
+}
+
+void GPU::setTelemetry(FrameTelemetry* telemetry) {
+    this->telemetry = telemetry;
+    if (pipeline) {
+        pipeline->setTelemetry(telemetry);
+    }
+}
+
+// Hand the finished frame to the attached consumers and move on to their next buffers
+void GPU::publishFrame() {
+    StageTimer timer(telemetry, TelemetryStage::Output);
+    if (server) {
+        if (frameBuffer == server->backBuffer()) {
+            server->publish(frameCount);
+        }
+        else {
+            server->submit(frameBuffer, frameCount);
+        }
+    }
+    if (exchange) {
+        exchange->publish(frameCount);
+    }
+    displayBuffer = frameBuffer;
+    updateRenderTarget();
+}
+
+// Consumers are about to change: the last frame moves into this GPU's own storage, as the
+// buffer holding it may belong to one that is going away
+void GPU::keepDisplayedFrame() {
+    if (displayBuffer != frameStorage) {
+        std::memcpy(frameStorage, displayBuffer, FRAME_BUFFER_SIZE);
+        displayBuffer = frameStorage;
+    }
+}
+
+// Point drawing (inline or on the render worker) at the current back buffer
+void GPU::updateRenderTarget() {
+    frameBuffer = exchange ? exchange->backBuffer() : server ? server->backBuffer() : frameStorage;
+    if (pipeline) {
+        pipeline->setRenderTarget(frameBuffer);
+    }
+}
+
+bool GPU::isPipelined() const {
+    return pipeline != nullptr;
+}
+
+void GPU::writeVRAM(uint16_t offset, uint8_t value) {
+    vram[offset] = value;
+    if (pipeline) {
+        pipeline->recordWrite(offset, value);
+    }
+}
+
+void GPU::writeOAM(uint16_t offset, uint8_t value) {
+    oam[offset] = value;
+    if (pipeline) {
+        pipeline->recordWrite(VRAM_SIZE + offset, value);
+    }
+}
+
+void GPU::loadOAM(const uint8_t* source) {
+    std::memcpy(oam.data(), source, OAM_SIZE);
+    if (pipeline) {
+        for (int i = 0; i < OAM_SIZE; ++i) {
+            pipeline->recordWrite(VRAM_SIZE + i, source[i]);
+        }
+    }
+}
+
+void GPU::copyToVRAM(uint16_t offset, const uint8_t* source, size_t length) {
+    if (pipeline) {
+        for (size_t i = 0; i < length; ++i) {
+            writeVRAM(static_cast<uint16_t>(offset + i), source[i]);
+        }
+        return;
+    }
+    std::memcpy(&vram[offset], source, length);
+}
+
+void GPU::fillVRAM(uint16_t offset, uint8_t value, size_t length) {
+    if (pipeline) {
+        for (size_t i = 0; i < length; ++i) {
+            writeVRAM(static_cast<uint16_t>(offset + i), value);
+        }
+        return;
+    }
+    std::memset(&vram[offset], value, length);
+}
+
+void GPU::setColorScheme(ColorScheme scheme) {
+    setShadeColors(COLOR_SCHEMES[static_cast<int>(scheme)]);
+}
+
+void GPU::setShadeColors(const std::array<uint32_t, 4>& colors) {
+    shadeColors = colors;
+    updatePalettes();
+}
+
+const std::array<uint32_t, 4>& GPU::getShadeColors() const {
+    return shadeColors;
+}
+
+// Rebuild the lookup tables after a palette register or the shade colours change
+void GPU::updatePalettes() {
+    // 0xAARRGGBB to a pixel stored as R, G, B, A
+    uint32_t pixels[4];
+    for (int shade = 0; shade < 4; ++shade) {
+        uint32_t color = shadeColors[shade];
+        uint8_t bytes[4] = { static_cast<uint8_t>(color >> 16), static_cast<uint8_t>(color >> 8),
+            static_cast<uint8_t>(color), static_cast<uint8_t>(color >> 24) };
+        std::memcpy(&pixels[shade], bytes, sizeof(bytes));
+    }
+
+    for (int index = 0; index < 4; ++index) {
+        backgroundColors[index] = pixels[(bgp >> (index * 2)) & 0x03];
+        spriteColors[0][index] = pixels[(obp0 >> (index * 2)) & 0x03];
+        spriteColors[1][index] = pixels[(obp1 >> (index * 2)) & 0x03];
+    }
+    blankColor = pixels[0];
+}
+
+uint64_t GPU::getFrameCount() const {
+    return frameCount;
+}
+
+// Access tile data
+uint8_t* GPU::getTileData(uint8_t tileId) {
+    int tileAddress = tileId * 16; // 16 bytes per 8x8 2bpp tile, from 0x8000
+    return &vram[tileAddress];
+}
+
 // Add a sprite to the GPU
 void GPU::addSprite(uint8_t tileId, int x, int y, bool xFlip, bool yFlip) {
     for (int i = 0; i < MAX_SPRITES; ++i) {
@@ -184,4 +998,4 @@ void GPU::removeSprite(int index) {
 // Clear all sprites
 void GPU::clearSprites() {
     std::fill(oam.begin(), oam.end(), 0);
-}
\ No newline at end of file
+}
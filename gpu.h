@@ -1,5 +1,6 @@
 #include <array>
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -13,60 +14,256 @@ constexpr int TITLE_SIZE = 8;
 constexpr int TITLE_MAP_SIZE = 32;
 constexpr int VRAM_SIZE = 8192;
 constexpr int MAX_SPRITES = 40; // Game Boy hardware limit for max sprites per frame
+constexpr int MAX_SPRITES_PER_LINE = 10; // Hardware limit for sprites on one scanline
+constexpr int OAM_SIZE = MAX_SPRITES * 4; // 4 bytes per sprite
+constexpr size_t FRAME_BUFFER_SIZE = SCREEN_WIDTH * SCREEN_HEIGHT * 4; // RGBA
 
-// VRAM and OAM memory
-std::array<uint8_t, VRAM_SIZE> vram;
-std::array<uint8_t, MAX_SPRITES * 4> oam; // 4 bytes per sprite
+// Built-in colour schemes for the four DMG shades (lightest first)
+enum class ColorScheme {
+    Grayscale,
+    Green,  // Original DMG screen
+    Pocket  // Game Boy Pocket screen
+};
 
-// Scroll registers
-uint8_t scrollX = 0;
-uint8_t scrollY = 0;
+// PPU timing model, selectable per GPU
+enum class PPUAccuracy {
+    Scanline,  // Fixed 80/172/204 mode lengths, whole lines drawn at the end of mode 3
+    PixelFIFO  // Dot by dot fetcher and FIFOs: mode 3 stretches with SCX, window and sprites,
+               // and register writes take effect at the pixel being drawn
+};
 
-// Background tile map (assuming a 32x32 grid of tiles)
-std::array<std::array<uint8_t, TITLE_MAP_SIZE>, TITLE_MAP_SIZE> backgroundTileMap;
+// Compile-time accuracy policies for GPU::stepWith
+struct ScanlinePolicy {
+    static constexpr bool pixelFIFO = false;
+};
+struct PixelFIFOPolicy {
+    static constexpr bool pixelFIFO = true;
+};
 
-// Enum to manage GPU
+// Enum to manage GPU (values match the STAT mode bits)
 enum class GPUMode {
     HBlank, VBlank, OAM, VRAM
 };
 
+// Everything a save state needs from the GPU (not the frame buffer or frame skip settings)
+struct GPUState {
+    std::array<uint8_t, VRAM_SIZE> vram;
+    std::array<uint8_t, OAM_SIZE> oam;
+    GPUMode mode;
+    uint16_t cycleCounter;
+    int currentScanline;
+    uint8_t lcdc, stat, scrollY, scrollX, lyc, dma, bgp, obp0, obp1, windowY, windowX;
+    int windowLine;
+    bool statLine;
+    uint64_t frameCount;
+};
+
+class RenderPipeline;
+class FrameExchange;
+class FrameServer;
+class FrameTelemetry;
+
 class GPU {
+    friend class RenderPipeline;
+
 private:
-    // RGBA frame buffer
-    uint8_t frameBuffer[SCREEN_WIDTH * SCREEN_HEIGHT * 4];
+    // RGBA frame buffer: drawn into through frameBuffer, which points at frameStorage
+    // or at the back buffer of an attached FrameExchange or FrameServer
+    uint8_t frameStorage[FRAME_BUFFER_SIZE];
+    uint8_t* frameBuffer;
+    // Newest complete frame for getFrameBuffer: frameBuffer until a frame is published, then
+    // the published buffer, which the producer does not get back before the next publish
+    uint8_t* displayBuffer;
+    FrameExchange* exchange;
+    FrameServer* server;
+    FrameTelemetry* telemetry;
     // GPU mode
     GPUMode mode;
     // Counts cycles per line/frame
     uint16_t cycleCounter;
     int currentScanline;
 
+    // LCD registers (0xFF40-0xFF4B)
+    uint8_t lcdc;
+    uint8_t stat;
+    uint8_t scrollY;
+    uint8_t scrollX;
+    uint8_t lyc;
+    uint8_t dma;
+    uint8_t bgp;
+    uint8_t obp0;
+    uint8_t obp1;
+    uint8_t windowY;
+    uint8_t windowX;
+
+    // Shade colours (0xAARRGGBB, lightest first) and the per-palette lookup tables built from
+    // them and BGP/OBP0/OBP1, holding pixels already in frame buffer byte order
+    std::array<uint32_t, 4> shadeColors;
+    uint32_t backgroundColors[4];
+    uint32_t spriteColors[2][4];
+    uint32_t blankColor; // Shade 0, shown while the background is off
+
+    // Internal window line counter and STAT interrupt line state
+    int windowLine;
+    bool statLine;
+    // Interrupts raised during the current step
+    uint8_t interruptRequests;
+    // Frames completed since reset
+    uint64_t frameCount;
+
+    // Frame skipping: render 1 in renderEvery frames (0 = only on request)
+    int renderEvery;
+    bool renderRequested;
+    bool renderingFrame;
+    bool lastFrameRendered;
+
+    // Pixel FIFO state for the line in mode 3 (PixelFIFO accuracy only)
+    struct PixelFIFO {
+        uint8_t background[8]; // Colour indices, popped from backgroundPosition
+        int backgroundPosition;
+        int backgroundCount;
+        uint8_t spriteColor[8]; // Indexed by screen x & 7, 0 = transparent
+        uint8_t spriteAttributes[8];
+
+        int x;        // Next pixel sent to the LCD
+        int discard;  // Pixels still to drop (SCX & 7, or window left of the screen)
+        int dots;     // Dots spent in mode 3 so far
+        int stall;    // Dots left of the startup delay or a sprite fetch
+
+        int fetchStep; // 0-5 tile/low/high reads (2 dots each), 6 waits to push
+        int fetchX;    // Tile column of the next fetch
+        uint8_t tileId, tileRow, tileLow, tileHigh;
+        bool window;   // Fetching window tiles since the window started on this line
+
+        uint8_t sprites[MAX_SPRITES_PER_LINE]; // OAM indices on this line, by X
+        int spriteCount;
+        int nextSprite;
+        int pendingSprite; // Being fetched, -1 if none
+
+        uint32_t line[SCREEN_WIDTH];
+    };
+    PPUAccuracy accuracy;
+    PixelFIFO fifo;
+
+    // Optional worker thread drawing the lines (null when rendering inline)
+    std::unique_ptr<RenderPipeline> pipeline;
+
     // Additional private functions for rendering
-    void drawTile(int x, int y, uint8_t tileId, bool isBackground);
-    void drawSprite(int x, int y, uint8_t tileId, bool xFlip, bool yFlip);
+    void drawBackgroundLine(uint8_t* lineColors);
+    void drawWindowLine(uint8_t* lineColors);
+    void drawSpriteLine(const uint8_t* lineColors, uint32_t* linePixels);
+    uint8_t getTilePixel(const uint8_t* tileData, int row, int col);
+    bool isWindowVisible() const;
+
+    // Pixel FIFO
+    void startPixelFIFO();
+    void tickPixelFIFO();
+    void stepFetcher();
+    const uint8_t* fetcherTileData();
+    void fetchSprite(int spriteIndex);
+    void finishPixelFIFO();
+
+    // Mode and interrupt helpers
+    template<typename Accuracy> uint8_t stepWith(uint8_t cycles);
+    void setMode(GPUMode newMode);
+    void updateStatLine();
+    bool isStatLineHigh(GPUMode mode, int line) const;
+    int modeLength(GPUMode mode) const;
+    bool isTelemetryLine() const;
+    void beginFrame();
+    void updateRenderTarget();
+    void publishFrame();
+    void keepDisplayedFrame();
+    void updatePalettes();
 
     // Helper functions for loading textures
     void loadTexture(const std::string& filePath);
     void addSprite(int x, int y, uint8_t tileId, bool xFlip, bool yFlip);
 
 public:
+    // VRAM and OAM memory
+    std::array<uint8_t, VRAM_SIZE> vram;
+    std::array<uint8_t, OAM_SIZE> oam;
+
     // Constructor
     GPU();
+    ~GPU();
 
     // Reset GPU
     void reset();
-    // GPU cycle operations
-    void step(uint8_t cycles);
+    // GPU cycle operations, returns the interrupt flags raised (VBlank/STAT)
+    uint8_t step(uint8_t cycles);
+    // Catch up on any number of cycles at once (the CPU steps the GPU only when something
+    // observes it or its next event is due), returns the interrupt flags raised on the way
+    uint8_t advance(uint64_t cycles);
+    // Cycles until the next mode change that raises an interrupt or completes the frame,
+    // UINT64_MAX with the LCD off. Only LCD register writes can bring it closer.
+    uint64_t cyclesUntilEvent() const;
+    // Cycles at least left in the current mode (LY and STAT hold until then), and before
+    // the GPU next reads VRAM or OAM (writes until then cannot change what it draws);
+    // UINT64_MAX with the LCD off
+    uint64_t cyclesUntilModeChange() const;
+    uint64_t cyclesUntilVRAMRead() const;
     // Render a single scanline
     void renderScanLine();
     // Render the full frame
     void renderFrame();
 
-    // Access frame buffer pointer
+    // LCD register access for the CPU's I/O page; a write returns the interrupts it raises
+    // (STAT, when it moves the STAT line)
+    uint8_t readRegister(uint16_t address);
+    uint8_t writeRegister(uint16_t address, uint8_t value);
+
+    // Save states
+    void saveState(GPUState& state) const;
+    void loadState(const GPUState& state);
+    void copyFrom(const GPU& other);
+
+    // The frame as of the last runFrame: the buffer being drawn, or with a FrameExchange or
+    // FrameServer attached the last frame published to it (use the exchange from other threads)
     uint8_t* getFrameBuffer();
+    void clearFrameBuffer();
+
+    // Draw on a worker thread, overlapped with emulation (identical pixels). The CPU must
+    // then route VRAM/OAM writes through writeVRAM/writeOAM/loadOAM (see CPU::mapMemory).
+    void setPipelined(bool enabled);
+    bool isPipelined() const;
+    void writeVRAM(uint16_t offset, uint8_t value);
+    void writeOAM(uint16_t offset, uint8_t value);
+    void loadOAM(const uint8_t* source); // OAM DMA
+    void copyToVRAM(uint16_t offset, const uint8_t* source, size_t length); // Fused CPU loops
+    void fillVRAM(uint16_t offset, uint8_t value, size_t length);
+
+    // Timing model (Scanline by default). PixelFIFO always draws inline, even when pipelined
+    void setAccuracy(PPUAccuracy accuracy);
+    PPUAccuracy getAccuracy() const;
+
+    // Colours of the four shades, applied through BGP/OBP0/OBP1 from the next line drawn
+    // (the next frame when pipelined)
+    void setColorScheme(ColorScheme scheme);
+    void setShadeColors(const std::array<uint32_t, 4>& colors); // 0xAARRGGBB, lightest first
+    const std::array<uint32_t, 4>& getShadeColors() const;
+
+    // Publish every rendered frame to a triple buffer for consumers on other threads (null detaches)
+    void setFrameExchange(FrameExchange* exchange);
+    // Publish every rendered frame to a shared memory ring for other processes (null detaches).
+    // Drawn straight into the shared slot unless a FrameExchange is attached too. A server
+    // feeds one GPU: attaching it detaches it from any other, closing it detaches it too.
+    // False (and nothing attached) if the server is not open.
+    bool setFrameServer(FrameServer* server);
+    // Report drawing, publishing and render worker waits to a machine's telemetry (null detaches)
+    void setTelemetry(FrameTelemetry* telemetry);
+    // Number of frames completed (incremented on entering VBlank)
+    uint64_t getFrameCount() const;
+
+    // Frame skipping keeps timing, LY/STAT and interrupts exact but skips pixel work
+    void setFrameSkip(int renderEvery); // 1 = every frame, N = 1 in N, 0 = on request only
+    int getFrameSkip() const;
+    void requestFrame(); // Render the next frame regardless of the skip setting
+    bool isFrameRendered() const; // Whether the last completed frame was drawn
 
     // Helper functions
     uint8_t* getTileData(uint8_t tileId);
-    uint32_t getColorFromIndex(uint8_t colorIndex);
 
     // Functions to manage sprites
     void addSprite(uint8_t tileId, int x, int y, bool xFlip = false, bool yFlip = false);
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#ifndef pagedram_H
+#define pagedram_H
+
+// Copy-on-write granule: copies of a machine share chunks until one side writes to them
+constexpr size_t MEMORY_CHUNK_SIZE = 0x1000;
+
+struct MemoryChunk {
+    uint8_t data[MEMORY_CHUNK_SIZE];
+};
+
+// RAM region of up to Chunks shared chunks. Copying the region only copies chunk
+// references; writers call unshare() (or check writePointer) before modifying a chunk.
+template <size_t Chunks>
+class PagedRAM {
+private:
+    std::array<std::shared_ptr<MemoryChunk>, Chunks> chunks;
+    size_t bytes = 0;
+
+public:
+    // Allocate zeroed storage (rounded up to whole chunks, at most Chunks)
+    void assign(size_t size) {
+        bytes = std::min(size, Chunks * MEMORY_CHUNK_SIZE);
+        for (size_t i = 0; i < Chunks; ++i) {
+            chunks[i].reset();
+            if (i * MEMORY_CHUNK_SIZE < bytes) {
+                chunks[i] = std::make_shared<MemoryChunk>(); // Value initialised: zeroed
+            }
+        }
+    }
+
+    // Zero the contents without disturbing other machines sharing the chunks
+    void clear() {
+        for (size_t i = 0; i * MEMORY_CHUNK_SIZE < bytes; ++i) {
+            if (chunks[i].use_count() == 1) {
+                std::memset(chunks[i]->data, 0, MEMORY_CHUNK_SIZE);
+            }
+            else {
+                chunks[i] = std::make_shared<MemoryChunk>();
+            }
+        }
+    }
+
+    // Become a copy of other without sharing: its bytes are copied into this region's own
+    // chunks, which are only allocated the first time (or when this region shares them)
+    void copyContents(const PagedRAM& other) {
+        bytes = other.bytes;
+        for (size_t i = 0; i * MEMORY_CHUNK_SIZE < bytes; ++i) {
+            if (chunks[i] && chunks[i].use_count() == 1) {
+                std::memcpy(chunks[i]->data, other.chunks[i]->data, MEMORY_CHUNK_SIZE);
+            }
+            else {
+                chunks[i] = std::make_shared<MemoryChunk>(*other.chunks[i]);
+            }
+        }
+    }
+
+    size_t size() const { return bytes; }
+    bool empty() const { return bytes == 0; }
+
+    // Whether both regions still hold the same chunk at offset (neither wrote to it since
+    // one was copied from the other)
+    bool sharesChunk(const PagedRAM& other, size_t offset) const {
+        return chunks[offset / MEMORY_CHUNK_SIZE] == other.chunks[offset / MEMORY_CHUNK_SIZE];
+    }
+
+    const uint8_t* readPointer(size_t offset) const {
+        return chunks[offset / MEMORY_CHUNK_SIZE]->data + offset % MEMORY_CHUNK_SIZE;
+    }
+
+    // Direct write access, or nullptr while the chunk is still shared
+    uint8_t* writePointer(size_t offset) {
+        std::shared_ptr<MemoryChunk>& chunk = chunks[offset / MEMORY_CHUNK_SIZE];
+        return chunk.use_count() == 1 ? chunk->data + offset % MEMORY_CHUNK_SIZE : nullptr;
+    }
+
+    // Take a private copy of the chunk holding offset (no-op if already private)
+    uint8_t* unshare(size_t offset) {
+        std::shared_ptr<MemoryChunk>& chunk = chunks[offset / MEMORY_CHUNK_SIZE];
+        if (chunk.use_count() != 1) {
+            chunk = std::make_shared<MemoryChunk>(*chunk);
+        }
+        return chunk->data + offset % MEMORY_CHUNK_SIZE;
+    }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "pool.h"
+#include <new>
+#include <sys/mman.h>
+
+// Constructor
+MachinePool::MachinePool(int capacity, std::shared_ptr<const Cartridge> cartridge, bool useHugePages)
+    : arena(nullptr), arenaBytes(0), capacity(capacity > 0 ? capacity : 0), hugePages(false) {
+    slotBytes = (sizeof(GameBoy) + POOL_SLOT_ALIGNMENT - 1) & ~(POOL_SLOT_ALIGNMENT - 1);
+
+    pristine = std::make_unique<GameBoy>();
+    if (cartridge) {
+        pristine->insertCartridge(std::move(cartridge));
+    }
+
+    if (!allocateArena(useHugePages)) {
+        throw std::bad_alloc();
+    }
+
+    // Construct everything now so acquire never pays for constructors or page faults
+    freeSlots.reserve(this->capacity);
+    inUse.assign(this->capacity, false);
+    for (int i = this->capacity - 1; i >= 0; --i) {
+        new (slot(i)) GameBoy();
+        freeSlots.push_back(i);
+    }
+}
+
+MachinePool::~MachinePool() {
+    for (int i = 0; i < capacity; ++i) {
+        slot(i)->~GameBoy();
+    }
+    if (arena) {
+        munmap(arena, arenaBytes);
+    }
+}
+
+bool MachinePool::allocateArena(bool useHugePages) {
+    arenaBytes = slotBytes * capacity;
+    if (arenaBytes == 0) {
+        return true;
+    }
+
+    void* memory = MAP_FAILED;
+    if (useHugePages) {
+        arenaBytes = (arenaBytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+        // Reserved huge pages first, then fall back to transparent huge pages
+        memory = mmap(nullptr, arenaBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hugePages = memory != MAP_FAILED;
+#endif
+    }
+    if (memory == MAP_FAILED) {
+        memory = mmap(nullptr, arenaBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        if (useHugePages) {
+            hugePages = madvise(memory, arenaBytes, MADV_HUGEPAGE) == 0;
+        }
+#endif
+    }
+
+    arena = static_cast<uint8_t*>(memory);
+    return true;
+}
+
+GameBoy* MachinePool::slot(int index) const {
+    return reinterpret_cast<GameBoy*>(arena + index * slotBytes);
+}
+
+GameBoy& MachinePool::getTemplate() {
+    return *pristine;
+}
+
+int MachinePool::takeSlot() {
+    std::lock_guard<std::mutex> lock(slotMutex);
+    if (freeSlots.empty()) {
+        return -1;
+    }
+    int index = freeSlots.back();
+    freeSlots.pop_back();
+    inUse[index] = true;
+    return index;
+}
+
+GameBoy* MachinePool::acquire() {
+    int index = takeSlot();
+    if (index < 0) {
+        return nullptr;
+    }
+
+    GameBoy* machine = slot(index);
+    reset(*machine);
+    return machine;
+}
+
+GameBoy* MachinePool::fork(const GameBoy& parent) {
+    int index = takeSlot();
+    if (index < 0) {
+        return nullptr;
+    }
+
+    GameBoy* child = slot(index);
+    child->copyFrom(parent);
+    child->gpu.setFrameSkip(parent.gpu.getFrameSkip());
+    child->gpu.setAccuracy(parent.gpu.getAccuracy());
+    return child;
+}
+
+bool MachinePool::release(GameBoy* machine) {
+    if (!machine) {
+        return false;
+    }
+    // Only the start of a slot that is handed out; clearing its bit now makes a second
+    // release fail, and the slot is not free again until the scrub below is done
+    uintptr_t offset = reinterpret_cast<uintptr_t>(machine) - reinterpret_cast<uintptr_t>(arena);
+    if (offset >= slotBytes * capacity || offset % slotBytes != 0) {
+        return false;
+    }
+    int index = static_cast<int>(offset / slotBytes);
+    {
+        std::lock_guard<std::mutex> lock(slotMutex);
+        if (!inUse[index]) {
+            return false;
+        }
+        inUse[index] = false;
+    }
+
+    // Flush and drop the battery save now: the next owner's frames must never write to it
+    machine->detachSaveFile();
+    // Nothing else the previous owner attached carries over either
+    machine->clearDebugPoints();
+    machine->disableTrace();
+    machine->disableTelemetry();
+    machine->setPipelinedRendering(false);
+    machine->gpu.setFrameExchange(nullptr);
+    machine->gpu.setFrameServer(nullptr);
+
+    std::lock_guard<std::mutex> lock(slotMutex);
+    freeSlots.push_back(index);
+    return true;
+}
+
+void MachinePool::reset(GameBoy& machine) const {
+    machine.copyFrom(*pristine);
+    machine.gpu.setFrameSkip(pristine->gpu.getFrameSkip());
+    machine.gpu.setAccuracy(pristine->gpu.getAccuracy());
+    machine.gpu.clearFrameBuffer();
+}
+
+int MachinePool::size() const {
+    return capacity;
+}
+
+int MachinePool::available() {
+    std::lock_guard<std::mutex> lock(slotMutex);
+    return static_cast<int>(freeSlots.size());
+}
+
+bool MachinePool::usingHugePages() const {
+    return hugePages;
+}
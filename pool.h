@@ -0,0 +1,60 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "gameboy.h"
+
+#ifndef pool_H
+#define pool_H
+
+// Slots start on a cache line so neighbouring machines never share one
+constexpr size_t POOL_SLOT_ALIGNMENT = 64;
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// Fixed number of machines living in one arena, recycled instead of freed
+class MachinePool {
+private:
+    uint8_t* arena;
+    size_t arenaBytes;
+    size_t slotBytes;
+    int capacity;
+    bool hugePages;
+
+    // Every acquired or reset machine starts as a copy of this one
+    std::unique_ptr<GameBoy> pristine;
+
+    std::vector<int> freeSlots;
+    std::vector<bool> inUse; // By slot, guarded by slotMutex like freeSlots
+    std::mutex slotMutex;
+
+    GameBoy* slot(int index) const;
+    int takeSlot();
+    bool allocateArena(bool useHugePages);
+
+public:
+    // Constructor (all machines are built up front, huge pages are used when the system allows it)
+    MachinePool(int capacity, std::shared_ptr<const Cartridge> cartridge, bool useHugePages = false);
+    ~MachinePool();
+    MachinePool(const MachinePool&) = delete;
+    MachinePool& operator=(const MachinePool&) = delete;
+
+    // The state new and reset machines copy; adjust it before acquiring (e.g. detach audio)
+    GameBoy& getTemplate();
+
+    // Take a machine in the template state, nullptr when the pool is exhausted
+    GameBoy* acquire();
+    // Hand a machine back for reuse; false (and nothing happens) for a machine that is not
+    // out of this pool, e.g. one already released or from another arena
+    bool release(GameBoy* machine);
+    // Return a machine to the template state (copies the mutable regions only)
+    void reset(GameBoy& machine) const;
+    // Take a machine sharing parent's RAM copy-on-write, nullptr when the pool is exhausted
+    GameBoy* fork(const GameBoy& parent);
+
+    int size() const;
+    int available();
+    bool usingHugePages() const;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "renderpipeline.h"
+
+// Polls before the worker goes to sleep waiting for the next line
+constexpr int RENDER_SPIN_COUNT = 4000;
+
+// Constructor
+RenderPipeline::RenderPipeline() : log(RENDER_LOG_SIZE), head(0), tail(0), wakeups(0),
+    stopping(false), active(false), telemetry(nullptr) {
+    worker = std::thread(&RenderPipeline::workerLoop, this);
+}
+
+RenderPipeline::~RenderPipeline() {
+    stopping.store(true, std::memory_order_release);
+    wake();
+    worker.join();
+}
+
+void RenderPipeline::wake() {
+    wakeups.fetch_add(1, std::memory_order_release);
+    wakeups.notify_one();
+}
+
+void RenderPipeline::workerLoop() {
+    size_t position = tail.load(std::memory_order_relaxed);
+    int spins = 0;
+    // Spinning only pays off when the emulation thread has a core of its own
+    int spinLimit = std::thread::hardware_concurrency() > 1 ? RENDER_SPIN_COUNT : 0;
+
+    while (true) {
+        uint32_t observed = wakeups.load(std::memory_order_acquire);
+        if (position == head.load(std::memory_order_acquire)) {
+            if (stopping.load(std::memory_order_acquire)) {
+                return;
+            }
+            if (++spins < spinLimit) {
+                continue;
+            }
+            wakeups.wait(observed, std::memory_order_acquire);
+            spins = 0;
+            continue;
+        }
+        spins = 0;
+
+        const RenderCommand& command = log[position & (RENDER_LOG_SIZE - 1)];
+        if (command.type == RenderCommandType::Write) {
+            if (command.offset < VRAM_SIZE) {
+                renderer.vram[command.offset] = command.value;
+            }
+            else {
+                renderer.oam[command.offset - VRAM_SIZE] = command.value;
+            }
+        }
+        else {
+            renderer.currentScanline = command.scanline;
+            renderer.lcdc = command.lcdc;
+            renderer.scrollY = command.scrollY;
+            renderer.scrollX = command.scrollX;
+            renderer.windowY = command.windowY;
+            renderer.windowX = command.windowX;
+            if (renderer.bgp != command.bgp || renderer.obp0 != command.obp0 || renderer.obp1 != command.obp1) {
+                renderer.bgp = command.bgp;
+                renderer.obp0 = command.obp0;
+                renderer.obp1 = command.obp1;
+                renderer.updatePalettes();
+            }
+            renderer.windowLine = command.windowLine;
+            renderer.renderScanLine();
+        }
+        tail.store(++position, std::memory_order_release);
+    }
+}
+
+void RenderPipeline::push(const RenderCommand& command) {
+    size_t position = head.load(std::memory_order_relaxed);
+    if (position - tail.load(std::memory_order_acquire) >= RENDER_LOG_SIZE) {
+        StageTimer timer(telemetry, TelemetryStage::Wait);
+        wake(); // A log full of writes may not have woken the worker yet
+        while (position - tail.load(std::memory_order_acquire) >= RENDER_LOG_SIZE) {
+            std::this_thread::yield();
+        }
+    }
+    log[position & (RENDER_LOG_SIZE - 1)] = command;
+    head.store(position + 1, std::memory_order_release);
+}
+
+void RenderPipeline::beginFrame(const GPU& source) {
+    finish();
+    // The worker is idle until the next push, so the shadow can be written directly
+    renderer.vram = source.vram;
+    renderer.oam = source.oam;
+    renderer.setShadeColors(source.shadeColors);
+    active = true;
+}
+
+void RenderPipeline::recordLine(const GPU& source) {
+    if (!active) {
+        beginFrame(source); // First line since the last finish
+    }
+    RenderCommand command = {};
+    command.type = RenderCommandType::Line;
+    command.scanline = static_cast<uint8_t>(source.currentScanline);
+    command.lcdc = source.lcdc;
+    command.scrollY = source.scrollY;
+    command.scrollX = source.scrollX;
+    command.windowY = source.windowY;
+    command.windowX = source.windowX;
+    command.bgp = source.bgp;
+    command.obp0 = source.obp0;
+    command.obp1 = source.obp1;
+    command.windowLine = static_cast<uint8_t>(source.windowLine);
+    push(command);
+    wake();
+}
+
+void RenderPipeline::recordWrite(uint16_t offset, uint8_t value) {
+    if (!active) {
+        return; // Picked up by the copy at the next beginFrame
+    }
+    RenderCommand command = {};
+    command.type = RenderCommandType::Write;
+    command.offset = offset;
+    command.value = value;
+    push(command);
+}
+
+void RenderPipeline::finish() {
+    active = false;
+    size_t position = head.load(std::memory_order_relaxed);
+    if (tail.load(std::memory_order_acquire) == position) {
+        return;
+    }
+    StageTimer timer(telemetry, TelemetryStage::Wait);
+    wake();
+    while (tail.load(std::memory_order_acquire) != position) {
+        std::this_thread::yield();
+    }
+}
+
+void RenderPipeline::setRenderTarget(uint8_t* target) {
+    finish();
+    renderer.frameBuffer = target;
+}
+
+void RenderPipeline::setTelemetry(FrameTelemetry* telemetry) {
+    this->telemetry = telemetry;
+}
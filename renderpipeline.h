@@ -0,0 +1,70 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "gpu.h"
+#include "telemetry.h"
+
+#ifndef renderpipeline_H
+#define renderpipeline_H
+
+// Entry of the render log: a VRAM/OAM write or a scanline to draw
+enum class RenderCommandType : uint8_t {
+    Write, // offset < VRAM_SIZE is VRAM, above that OAM
+    Line
+};
+
+struct RenderCommand {
+    RenderCommandType type;
+    uint8_t value;
+    uint16_t offset;
+
+    // Line inputs
+    uint8_t scanline, lcdc, scrollY, scrollX, windowY, windowX, bgp, obp0, obp1;
+    uint8_t windowLine;
+};
+
+// Commands in flight (power of two); the emulation thread waits when the worker falls this far behind
+constexpr size_t RENDER_LOG_SIZE = 4096;
+
+// Draws scanlines on a worker thread. The emulation thread logs each line's register
+// values and any VRAM/OAM writes made mid-frame; the worker replays them on a shadow GPU
+// with the same drawing code, so pixels match inline rendering exactly.
+class RenderPipeline {
+private:
+    GPU renderer; // Shadow VRAM/OAM and registers, draws into the source GPU's frame buffer
+
+    std::vector<RenderCommand> log;
+    std::atomic<size_t> head; // Written by the emulation thread
+    std::atomic<size_t> tail; // Written by the worker
+    std::atomic<uint32_t> wakeups;
+    std::atomic<bool> stopping;
+    bool active; // Inside a rendered frame (emulation thread only)
+    FrameTelemetry* telemetry; // Time the emulation thread spends waiting for the worker
+    std::thread worker;
+
+    void workerLoop();
+    void push(const RenderCommand& command);
+    void wake();
+
+    // Waits for the worker, then copies VRAM/OAM to the shadow
+    void beginFrame(const GPU& source);
+
+public:
+    // Constructor
+    RenderPipeline();
+    ~RenderPipeline();
+
+    // Queue the current scanline with source's registers (the first line after finish resyncs the shadow)
+    void recordLine(const GPU& source);
+    // Queue a mid-frame write (no-op between finish and the next line)
+    void recordWrite(uint16_t offset, uint8_t value);
+    // Wait until every queued line is drawn; call after changing VRAM/OAM behind the log's back
+    void finish();
+
+    // Draw into target from the next line on (waits for the worker first)
+    void setRenderTarget(uint8_t* target);
+    void setTelemetry(FrameTelemetry* telemetry);
+};
+
+#endif
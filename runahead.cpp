@@ -0,0 +1,66 @@
+#include "runahead.h"
+#include <chrono>
+
+// Constructor
+RunAhead::RunAhead(GameBoy& machine, int frames) : machine(machine), frames(frames),
+    lastOverheadMicroseconds(0.0), averageOverheadMicroseconds(0.0), hostFrames(0) {
+}
+
+void RunAhead::setFrames(int frames) {
+    this->frames = frames < 0 ? 0 : frames;
+}
+
+int RunAhead::getFrames() const {
+    return frames;
+}
+
+// One host frame: a real frame with audio, then N silent frames of which only the last is drawn
+StopReason RunAhead::runFrame(uint8_t buttons) {
+    machine.setInput(buttons);
+    if (frames == 0) {
+        return machine.runFrame();
+    }
+
+    // The real frame is never shown, so skip its pixel work
+    int frameSkip = machine.gpu.getFrameSkip();
+    machine.gpu.setFrameSkip(0);
+    StopReason reason = machine.runFrame();
+    if (reason != StopReason::FrameComplete) {
+        // Stopped mid-frame: nothing to speculate from until the real frame completes
+        machine.gpu.setFrameSkip(frameSkip);
+        return reason;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    machine.saveState(snapshot);
+    machine.apu.setMuted(true); // Speculative frames see live sound registers but produce no audio
+    machine.setSpeculative(true); // Nor may they reach the battery save
+
+    for (int i = 1; i <= frames && reason == StopReason::FrameComplete; ++i) {
+        if (i == frames) {
+            machine.gpu.requestFrame();
+        }
+        reason = machine.runFrame();
+    }
+
+    // Restoring leaves the frame buffer holding the run-ahead frame (or, after a stop, the
+    // partial one); the debugger keeps the stop, the machine is back at the real frame
+    machine.loadState(snapshot);
+    machine.apu.setMuted(false);
+    machine.setSpeculative(false);
+    machine.gpu.setFrameSkip(frameSkip);
+    auto end = std::chrono::steady_clock::now();
+
+    lastOverheadMicroseconds = std::chrono::duration<double, std::micro>(end - start).count();
+    hostFrames++;
+    averageOverheadMicroseconds += (lastOverheadMicroseconds - averageOverheadMicroseconds) / hostFrames;
+    return reason;
+}
+
+double RunAhead::getLastOverheadMicroseconds() const {
+    return lastOverheadMicroseconds;
+}
+
+double RunAhead::getAverageOverheadMicroseconds() const {
+    return averageOverheadMicroseconds;
+}
@@ -0,0 +1,36 @@
+#include <cstdint>
+#include "gameboy.h"
+
+#ifndef runahead_H
+#define runahead_H
+
+// Run-ahead: show the frame N frames in the future, then roll back to the real one
+class RunAhead {
+private:
+    GameBoy& machine;
+    int frames;
+    Snapshot snapshot; // Preallocated, reused every frame
+
+    // Overhead of the speculative work (snapshot, N frames, restore)
+    double lastOverheadMicroseconds;
+    double averageOverheadMicroseconds;
+    uint64_t hostFrames;
+
+public:
+    // Constructor
+    RunAhead(GameBoy& machine, int frames = 1);
+
+    void setFrames(int frames);
+    int getFrames() const;
+
+    // Emulate one host frame with the given input. A breakpoint or watchpoint stops it like
+    // GameBoy::runFrame: in the real frame before any speculation, in a speculative one after
+    // rolling back to the real frame.
+    StopReason runFrame(uint8_t buttons);
+
+    // Time spent per host frame on top of the real frame
+    double getLastOverheadMicroseconds() const;
+    double getAverageOverheadMicroseconds() const;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "savefile.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Constructor
+SaveFile::SaveFile() : mapping(nullptr), mappingSize(0), ramSize(0), hasRTC(false), dirtyBegin(0), dirtyEnd(0) {
+}
+
+SaveFile::~SaveFile() {
+    close();
+}
+
+bool SaveFile::open(const std::string& path, size_t ramSize, bool rtc) {
+    close();
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    size_t required = ramSize + (rtc ? sizeof(RTCFooter) : 0);
+    if (fstat(fd, &info) != 0 || required == 0) {
+        ::close(fd);
+        return false;
+    }
+    // Never shrink: other tools may keep extra data after the image
+    size_t size = std::max(required, static_cast<size_t>(info.st_size));
+    if (static_cast<size_t>(info.st_size) < required && ftruncate(fd, static_cast<off_t>(required)) != 0) {
+        ::close(fd);
+        return false;
+    }
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd); // The mapping keeps the file open
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+
+    this->path = path;
+    mapping = static_cast<uint8_t*>(memory);
+    mappingSize = size;
+    this->ramSize = ramSize;
+    hasRTC = rtc;
+    dirtyBegin = dirtyEnd = 0;
+    return true;
+}
+
+void SaveFile::close() {
+    if (!mapping) {
+        return;
+    }
+    markDirty(0, mappingSize); // Whatever the kernel has not written back yet
+    flush(true);
+    munmap(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+}
+
+bool SaveFile::isOpen() const {
+    return mapping != nullptr;
+}
+
+const std::string& SaveFile::getPath() const {
+    return path;
+}
+
+uint8_t* SaveFile::ram() {
+    return mapping;
+}
+
+size_t SaveFile::getRAMSize() const {
+    return ramSize;
+}
+
+RTCFooter* SaveFile::rtc() {
+    return hasRTC ? reinterpret_cast<RTCFooter*>(mapping + ramSize) : nullptr;
+}
+
+void SaveFile::markDirty(size_t offset, size_t length) {
+    size_t end = std::min(offset + length, mappingSize);
+    if (dirtyBegin == dirtyEnd) {
+        dirtyBegin = offset;
+        dirtyEnd = end;
+    }
+    else {
+        dirtyBegin = std::min(dirtyBegin, offset);
+        dirtyEnd = std::max(dirtyEnd, end);
+    }
+}
+
+void SaveFile::flush(bool wait) {
+    if (!mapping || dirtyBegin == dirtyEnd) {
+        return;
+    }
+    // msync wants a page aligned start
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = dirtyBegin / page * page;
+    msync(mapping + begin, dirtyEnd - begin, wait ? MS_SYNC : MS_ASYNC);
+    dirtyBegin = dirtyEnd = 0;
+}
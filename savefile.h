@@ -0,0 +1,55 @@
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifndef savefile_H
+#define savefile_H
+
+// MBC3 clock as stored after the RAM image in .sav files (the common 48 byte footer):
+// current and latched registers as 32 bit words, then the UNIX time it was written at.
+// Little-endian hosts only, like the rest of the save format.
+struct RTCFooter {
+    uint32_t registers[5]; // Seconds, minutes, hours, day low, day high
+    uint32_t latched[5];
+    uint64_t timestamp;
+};
+
+static_assert(sizeof(RTCFooter) == 48, "RTC footer layout");
+
+// Battery save mapped into memory (MAP_SHARED): the RAM image, then the RTC footer for
+// clock cartridges. Updates are plain stores into the mapping; the ranges marked dirty
+// are handed to msync in one call per flush instead of a write per byte.
+class SaveFile {
+private:
+    std::string path;
+    uint8_t* mapping;
+    size_t mappingSize;
+    size_t ramSize;
+    bool hasRTC;
+    size_t dirtyBegin, dirtyEnd; // Byte range written since the last flush
+
+public:
+    // Constructor
+    SaveFile();
+    ~SaveFile();
+    SaveFile(const SaveFile&) = delete;
+    SaveFile& operator=(const SaveFile&) = delete;
+
+    // Map the file, creating it zero filled (or growing it) to hold ramSize bytes plus the
+    // RTC footer when rtc is set; false on failure
+    bool open(const std::string& path, size_t ramSize, bool rtc);
+    // Flush synchronously and unmap
+    void close();
+    bool isOpen() const;
+    const std::string& getPath() const;
+
+    uint8_t* ram();
+    size_t getRAMSize() const;
+    RTCFooter* rtc(); // Null for cartridges without a clock
+
+    void markDirty(size_t offset, size_t length);
+    // msync the dirty range: scheduled (MS_ASYNC), or waited for with wait set
+    void flush(bool wait = false);
+};
+
+#endif
@@ -0,0 +1,624 @@
+#include "scaler.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Border replicated around the padded input (xBR reads two pixels out)
+constexpr int SCALER_PADDING = 2;
+// Bands handed out per thread, so uneven rows still balance
+constexpr int BANDS_PER_THREAD = 4;
+
+#if defined(__SSE2__)
+// Four pixels of each input, interleaved: a0 b0 a1 b1 ...
+static inline void store2(uint32_t* out, __m128i a, __m128i b) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi32(a, b));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi32(a, b));
+}
+
+// a0 b0 c0 a1 b1 c1 ...
+static inline void store3(uint32_t* out, __m128i a, __m128i b, __m128i c) {
+    __m128 abLow = _mm_castsi128_ps(_mm_unpacklo_epi32(a, b)); // a0 b0 a1 b1
+    __m128 caLow = _mm_castsi128_ps(_mm_unpacklo_epi32(c, a)); // c0 a0 c1 a1
+    __m128 bcLow = _mm_castsi128_ps(_mm_unpacklo_epi32(b, c)); // b0 c0 b1 c1
+    __m128 abHigh = _mm_castsi128_ps(_mm_unpackhi_epi32(a, b)); // a2 b2 a3 b3
+    __m128 caHigh = _mm_castsi128_ps(_mm_unpackhi_epi32(c, a)); // c2 a2 c3 a3
+    __m128 bcHigh = _mm_castsi128_ps(_mm_unpackhi_epi32(b, c)); // b2 c2 b3 c3
+    _mm_storeu_ps(reinterpret_cast<float*>(out), _mm_shuffle_ps(abLow, caLow, _MM_SHUFFLE(3, 0, 1, 0)));
+    _mm_storeu_ps(reinterpret_cast<float*>(out + 4), _mm_shuffle_ps(bcLow, abHigh, _MM_SHUFFLE(1, 0, 3, 2)));
+    _mm_storeu_ps(reinterpret_cast<float*>(out + 8), _mm_shuffle_ps(caHigh, bcHigh, _MM_SHUFFLE(3, 2, 3, 0)));
+}
+
+static inline __m128i load4(const uint32_t* in) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+}
+
+// Four int16 distances widened to int32 (distances are never negative)
+static inline __m128i loadDistances4(const int16_t* in) {
+    return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in)), _mm_setzero_si128());
+}
+
+static inline __m128i blendHalf(__m128i a, __m128i b) {
+    __m128i half = _mm_srli_epi32(_mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi32(static_cast<int>(0xFEFEFEFE))), 1);
+    return _mm_add_epi32(_mm_and_si128(a, b), half);
+}
+
+// 48 |dY| + 7 |dU| + 6 |dV| over eight pixels (at most 15555, so int16 holds it)
+static inline __m128i distance8(__m128i y0, __m128i u0, __m128i v0, __m128i y1, __m128i u1, __m128i v1) {
+    __m128i dy = _mm_max_epi16(_mm_sub_epi16(y0, y1), _mm_sub_epi16(y1, y0));
+    __m128i du = _mm_max_epi16(_mm_sub_epi16(u0, u1), _mm_sub_epi16(u1, u0));
+    __m128i dv = _mm_max_epi16(_mm_sub_epi16(v0, v1), _mm_sub_epi16(v1, v0));
+    return _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dy, _mm_set1_epi16(48)), _mm_mullo_epi16(du, _mm_set1_epi16(7))),
+        _mm_mullo_epi16(dv, _mm_set1_epi16(6)));
+}
+
+static inline __m128i loadShorts8(const int16_t* in) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+}
+
+// mask ? a : b
+static inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+#if defined(__AVX2__)
+// Eight pixels of each input, interleaved (unpack works per 128-bit lane, permute restores order)
+static inline void store2(uint32_t* out, __m256i a, __m256i b) {
+    __m256i low = _mm256_unpacklo_epi32(a, b);  // a0 b0 a1 b1 | a4 b4 a5 b5
+    __m256i high = _mm256_unpackhi_epi32(a, b); // a2 b2 a3 b3 | a6 b6 a7 b7
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute2x128_si256(low, high, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), _mm256_permute2x128_si256(low, high, 0x31));
+}
+
+// Eight pixels of each input, three-way interleaved one 128-bit half at a time
+static inline void store3(uint32_t* out, __m256i a, __m256i b, __m256i c) {
+    store3(out, _mm256_castsi256_si128(a), _mm256_castsi256_si128(b), _mm256_castsi256_si128(c));
+    store3(out + 12, _mm256_extracti128_si256(a, 1), _mm256_extracti128_si256(b, 1), _mm256_extracti128_si256(c, 1));
+}
+
+static inline __m256i load8(const uint32_t* in) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+}
+
+static inline __m256i select(__m256i mask, __m256i a, __m256i b) {
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+static inline __m256i loadDistances8(const int16_t* in) {
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+}
+
+static inline __m256i blendHalf(__m256i a, __m256i b) {
+    __m256i half = _mm256_srli_epi32(_mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi32(static_cast<int>(0xFEFEFEFE))), 1);
+    return _mm256_add_epi32(_mm256_and_si256(a, b), half);
+}
+
+static inline __m256i distance16(__m256i y0, __m256i u0, __m256i v0, __m256i y1, __m256i u1, __m256i v1) {
+    __m256i dy = _mm256_abs_epi16(_mm256_sub_epi16(y0, y1));
+    __m256i du = _mm256_abs_epi16(_mm256_sub_epi16(u0, u1));
+    __m256i dv = _mm256_abs_epi16(_mm256_sub_epi16(v0, v1));
+    return _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dy, _mm256_set1_epi16(48)),
+        _mm256_mullo_epi16(du, _mm256_set1_epi16(7))), _mm256_mullo_epi16(dv, _mm256_set1_epi16(6)));
+}
+
+static inline __m256i loadShorts16(const int16_t* in) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+}
+#endif
+
+// Per channel average of two pixels
+static inline uint32_t blendHalf(uint32_t a, uint32_t b) {
+    return (a & b) + (((a ^ b) & 0xFEFEFEFE) >> 1);
+}
+
+// Constructor
+Scaler::Scaler(ScaleFilter filter, int factor, int width, int height, int threads)
+    : factor(std::max(factor, 1)), paddedStride(0), workers(threads) {
+
+    // Native filter steps first, the remainder as nearest
+    StageType native = StageType::Nearest;
+    int nativeFactor = 1;
+    switch (filter) {
+    case ScaleFilter::Nearest: break;
+    case ScaleFilter::Scale2x: native = StageType::Scale2x; nativeFactor = 2; break;
+    case ScaleFilter::Scale3x: native = StageType::Scale3x; nativeFactor = 3; break;
+    case ScaleFilter::XBR: native = StageType::XBR; nativeFactor = 2; break;
+    }
+
+    int remaining = this->factor;
+    while (nativeFactor > 1 && remaining % nativeFactor == 0) {
+        stages.push_back({ native, nativeFactor, width, height });
+        width *= nativeFactor;
+        height *= nativeFactor;
+        remaining /= nativeFactor;
+    }
+    if (remaining > 1 || stages.empty()) {
+        stages.push_back({ StageType::Nearest, remaining, width, height });
+    }
+    for (size_t i = 0; i + 1 < stages.size(); ++i) {
+        const Stage& next = stages[i + 1];
+        intermediate.emplace_back(static_cast<size_t>(next.width) * next.height);
+    }
+}
+
+int Scaler::getFactor() const {
+    return factor;
+}
+
+int Scaler::outputWidth() const {
+    return stages.back().width * stages.back().factor;
+}
+
+int Scaler::outputHeight() const {
+    return stages.back().height * stages.back().factor;
+}
+
+void Scaler::process(const uint8_t* input, uint8_t* output) {
+    const uint32_t* source = reinterpret_cast<const uint32_t*>(input);
+    for (size_t i = 0; i < stages.size(); ++i) {
+        uint32_t* target = (i + 1 == stages.size()) ? reinterpret_cast<uint32_t*>(output) : intermediate[i].data();
+        runStage(stages[i], source, target);
+        source = target;
+    }
+}
+
+void Scaler::runStage(const Stage& stage, const uint32_t* input, uint32_t* output) {
+    int width = stage.width;
+    switch (stage.type) {
+    case StageType::Nearest:
+        runBands(stage.height, [&](int first, int last) {
+            nearestRows(input, output, width, stage.factor, first, last);
+        });
+        break;
+    case StageType::Scale2x:
+        padInput(input, width, stage.height);
+        runBands(stage.height, [&](int first, int last) { scale2xRows(output, width, first, last); });
+        break;
+    case StageType::Scale3x:
+        padInput(input, width, stage.height);
+        runBands(stage.height, [&](int first, int last) { scale3xRows(output, width, first, last); });
+        break;
+    case StageType::XBR:
+        padInput(input, width, stage.height);
+        computeYUV();
+        computeDistances();
+        runBands(stage.height, [&](int first, int last) { xbrRows(output, width, first, last); });
+        break;
+    }
+}
+
+// Copy the input inside a border made of its edge pixels
+void Scaler::padInput(const uint32_t* input, int width, int height) {
+    paddedStride = width + SCALER_PADDING * 2;
+    padded.resize(static_cast<size_t>(paddedStride) * (height + SCALER_PADDING * 2));
+
+    for (int y = -SCALER_PADDING; y < height + SCALER_PADDING; ++y) {
+        const uint32_t* source = input + std::clamp(y, 0, height - 1) * width;
+        uint32_t* row = padded.data() + (y + SCALER_PADDING) * paddedStride;
+        std::fill(row, row + SCALER_PADDING, source[0]);
+        std::memcpy(row + SCALER_PADDING, source, width * sizeof(uint32_t));
+        std::fill(row + SCALER_PADDING + width, row + paddedStride, source[width - 1]);
+    }
+}
+
+void Scaler::computeYUV() {
+    size_t count = padded.size();
+    lumaY.resize(count);
+    chromaU.resize(count);
+    chromaV.resize(count);
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // Red and blue (and green and alpha) sit in the 16-bit halves of each pixel, so one
+    // madd per pair applies two of the weights
+    const __m128i low = _mm_set1_epi32(0x00FF00FF);
+    for (; i + 4 <= count; i += 4) {
+        __m128i pixels = load4(padded.data() + i);
+        __m128i redBlue = _mm_and_si128(pixels, low);
+        __m128i greenAlpha = _mm_and_si128(_mm_srli_epi32(pixels, 8), low);
+        __m128i y = _mm_add_epi32(_mm_madd_epi16(redBlue, _mm_set_epi16(29, 77, 29, 77, 29, 77, 29, 77)),
+            _mm_madd_epi16(greenAlpha, _mm_set_epi16(0, 150, 0, 150, 0, 150, 0, 150)));
+        __m128i u = _mm_add_epi32(_mm_madd_epi16(redBlue, _mm_set_epi16(128, -43, 128, -43, 128, -43, 128, -43)),
+            _mm_madd_epi16(greenAlpha, _mm_set_epi16(0, -85, 0, -85, 0, -85, 0, -85)));
+        __m128i v = _mm_add_epi32(_mm_madd_epi16(redBlue, _mm_set_epi16(-21, 128, -21, 128, -21, 128, -21, 128)),
+            _mm_madd_epi16(greenAlpha, _mm_set_epi16(0, -107, 0, -107, 0, -107, 0, -107)));
+        y = _mm_srai_epi32(y, 8);
+        u = _mm_srai_epi32(u, 8);
+        v = _mm_srai_epi32(v, 8);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(lumaY.data() + i), _mm_packs_epi32(y, y));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(chromaU.data() + i), _mm_packs_epi32(u, u));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(chromaV.data() + i), _mm_packs_epi32(v, v));
+    }
+#endif
+    for (; i < count; ++i) {
+        uint32_t pixel = padded[i];
+        int r = pixel & 0xFF; // Byte order R, G, B, A
+        int g = (pixel >> 8) & 0xFF;
+        int b = (pixel >> 16) & 0xFF;
+        lumaY[i] = static_cast<int16_t>((77 * r + 150 * g + 29 * b) >> 8);
+        chromaU[i] = static_cast<int16_t>((-43 * r - 85 * g + 128 * b) >> 8);
+        chromaV[i] = static_cast<int16_t>((128 * r - 107 * g - 21 * b) >> 8);
+    }
+}
+
+// Distance planes: each pair xBR weighs is two neighbouring pixels, so every distance is
+// computed once per stage instead of up to ten times per corner
+void Scaler::computeDistances() {
+    size_t count = padded.size();
+    const int16_t* ly = lumaY.data();
+    const int16_t* cu = chromaU.data();
+    const int16_t* cv = chromaV.data();
+    const int offsets[4] = { 1, paddedStride, paddedStride + 1, paddedStride - 1 };
+    std::vector<int16_t>* planes[4] = { &distanceRight, &distanceDown, &distanceDownRight, &distanceDownLeft };
+    // The last row has no lower neighbours and is never read
+    size_t end = count - paddedStride - 1;
+
+    for (int k = 0; k < 4; ++k) {
+        planes[k]->resize(count);
+        int16_t* plane = planes[k]->data();
+        int offset = offsets[k];
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        for (; i + 16 <= end; i += 16) {
+            __m256i distance = distance16(loadShorts16(ly + i), loadShorts16(cu + i), loadShorts16(cv + i),
+                loadShorts16(ly + i + offset), loadShorts16(cu + i + offset), loadShorts16(cv + i + offset));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(plane + i), distance);
+        }
+#endif
+#if defined(__SSE2__)
+        for (; i + 8 <= end; i += 8) {
+            __m128i distance = distance8(loadShorts8(ly + i), loadShorts8(cu + i), loadShorts8(cv + i),
+                loadShorts8(ly + i + offset), loadShorts8(cu + i + offset), loadShorts8(cv + i + offset));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(plane + i), distance);
+        }
+#endif
+        for (; i < end; ++i) {
+            plane[i] = static_cast<int16_t>(48 * std::abs(ly[i] - ly[i + offset]) + 7 * std::abs(cu[i] - cu[i + offset])
+                + 6 * std::abs(cv[i] - cv[i + offset]));
+        }
+    }
+}
+
+// Replicate every pixel scale times across and down
+void Scaler::nearestRows(const uint32_t* input, uint32_t* output, int width, int scale, int firstRow, int lastRow) {
+    size_t outputWidth = static_cast<size_t>(width) * scale;
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        const uint32_t* in = input + static_cast<size_t>(y) * width;
+        uint32_t* out = output + static_cast<size_t>(y) * scale * outputWidth;
+        int x = 0;
+
+#if defined(__AVX2__)
+        if (scale == 2) {
+            for (; x + 8 <= width; x += 8) {
+                __m256i pixels = load8(in + x);
+                store2(out + x * 2, pixels, pixels);
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        if (scale == 2) {
+            for (; x + 4 <= width; x += 4) {
+                __m128i pixels = load4(in + x);
+                store2(out + x * 2, pixels, pixels);
+            }
+        }
+        else if (scale == 3) {
+            for (; x + 4 <= width; x += 4) {
+                __m128i pixels = load4(in + x);
+                store3(out + x * 3, pixels, pixels, pixels);
+            }
+        }
+        else if (scale == 4) {
+            for (; x + 4 <= width; x += 4) {
+                __m128i pixels = load4(in + x);
+                __m128i low = _mm_unpacklo_epi32(pixels, pixels);  // p0 p0 p1 p1
+                __m128i high = _mm_unpackhi_epi32(pixels, pixels); // p2 p2 p3 p3
+                store2(out + x * 4, low, low);
+                store2(out + x * 4 + 8, high, high);
+            }
+        }
+#endif
+        for (; x < width; ++x) {
+            std::fill(out + x * scale, out + (x + 1) * scale, in[x]);
+        }
+
+        for (int copy = 1; copy < scale; ++copy) {
+            std::memcpy(out + copy * outputWidth, out, outputWidth * sizeof(uint32_t));
+        }
+    }
+}
+
+// AdvMAME2x: each pixel E becomes a 2x2 block, corners take an edge neighbour when
+// the two neighbours on that side match and the opposite ones do not
+//    B        E0 E1
+//  D E F      E2 E3
+//    H
+void Scaler::scale2xRows(uint32_t* output, int width, int firstRow, int lastRow) {
+    size_t outputWidth = static_cast<size_t>(width) * 2;
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        const uint32_t* center = padded.data() + (y + SCALER_PADDING) * paddedStride + SCALER_PADDING;
+        const uint32_t* above = center - paddedStride;
+        const uint32_t* below = center + paddedStride;
+        uint32_t* out0 = output + static_cast<size_t>(y) * 2 * outputWidth;
+        uint32_t* out1 = out0 + outputWidth;
+        int x = 0;
+
+#if defined(__AVX2__)
+        for (; x + 8 <= width; x += 8) {
+            __m256i b = load8(above + x), d = load8(center + x - 1), e = load8(center + x);
+            __m256i f = load8(center + x + 1), h = load8(below + x);
+            __m256i db = _mm256_cmpeq_epi32(d, b), bf = _mm256_cmpeq_epi32(b, f);
+            __m256i dh = _mm256_cmpeq_epi32(d, h), hf = _mm256_cmpeq_epi32(h, f);
+
+            __m256i e0 = select(_mm256_andnot_si256(bf, _mm256_andnot_si256(dh, db)), d, e);
+            __m256i e1 = select(_mm256_andnot_si256(db, _mm256_andnot_si256(hf, bf)), f, e);
+            __m256i e2 = select(_mm256_andnot_si256(db, _mm256_andnot_si256(hf, dh)), d, e);
+            __m256i e3 = select(_mm256_andnot_si256(dh, _mm256_andnot_si256(bf, hf)), f, e);
+            store2(out0 + x * 2, e0, e1);
+            store2(out1 + x * 2, e2, e3);
+        }
+#endif
+#if defined(__SSE2__)
+        for (; x + 4 <= width; x += 4) {
+            __m128i b = load4(above + x), d = load4(center + x - 1), e = load4(center + x);
+            __m128i f = load4(center + x + 1), h = load4(below + x);
+            __m128i db = _mm_cmpeq_epi32(d, b), bf = _mm_cmpeq_epi32(b, f);
+            __m128i dh = _mm_cmpeq_epi32(d, h), hf = _mm_cmpeq_epi32(h, f);
+
+            __m128i e0 = select(_mm_andnot_si128(bf, _mm_andnot_si128(dh, db)), d, e);
+            __m128i e1 = select(_mm_andnot_si128(db, _mm_andnot_si128(hf, bf)), f, e);
+            __m128i e2 = select(_mm_andnot_si128(db, _mm_andnot_si128(hf, dh)), d, e);
+            __m128i e3 = select(_mm_andnot_si128(dh, _mm_andnot_si128(bf, hf)), f, e);
+            store2(out0 + x * 2, e0, e1);
+            store2(out1 + x * 2, e2, e3);
+        }
+#endif
+        for (; x < width; ++x) {
+            uint32_t b = above[x], d = center[x - 1], e = center[x], f = center[x + 1], h = below[x];
+            out0[x * 2] = (d == b && b != f && d != h) ? d : e;
+            out0[x * 2 + 1] = (b == f && b != d && f != h) ? f : e;
+            out1[x * 2] = (d == h && d != b && h != f) ? d : e;
+            out1[x * 2 + 1] = (h == f && d != h && b != f) ? f : e;
+        }
+    }
+}
+
+// AdvMAME3x: as Scale2x, edges also fill the middle of each side of the 3x3 block
+//  A B C      E0 E1 E2
+//  D E F      E3 E4 E5
+//  G H I      E6 E7 E8
+void Scaler::scale3xRows(uint32_t* output, int width, int firstRow, int lastRow) {
+    size_t outputWidth = static_cast<size_t>(width) * 3;
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        const uint32_t* center = padded.data() + (y + SCALER_PADDING) * paddedStride + SCALER_PADDING;
+        const uint32_t* above = center - paddedStride;
+        const uint32_t* below = center + paddedStride;
+        uint32_t* out0 = output + static_cast<size_t>(y) * 3 * outputWidth;
+        uint32_t* out1 = out0 + outputWidth;
+        uint32_t* out2 = out1 + outputWidth;
+        int x = 0;
+
+#if defined(__AVX2__)
+        for (; x + 8 <= width; x += 8) {
+            __m256i a = load8(above + x - 1), b = load8(above + x), c = load8(above + x + 1);
+            __m256i d = load8(center + x - 1), e = load8(center + x), f = load8(center + x + 1);
+            __m256i g = load8(below + x - 1), h = load8(below + x), i = load8(below + x + 1);
+            __m256i db = _mm256_cmpeq_epi32(d, b), bf = _mm256_cmpeq_epi32(b, f);
+            __m256i dh = _mm256_cmpeq_epi32(d, h), hf = _mm256_cmpeq_epi32(h, f);
+
+            __m256i edgeDB = _mm256_andnot_si256(bf, _mm256_andnot_si256(dh, db));
+            __m256i edgeBF = _mm256_andnot_si256(db, _mm256_andnot_si256(hf, bf));
+            __m256i edgeDH = _mm256_andnot_si256(db, _mm256_andnot_si256(hf, dh));
+            __m256i edgeHF = _mm256_andnot_si256(dh, _mm256_andnot_si256(bf, hf));
+            __m256i ea = _mm256_cmpeq_epi32(e, a), ec = _mm256_cmpeq_epi32(e, c);
+            __m256i eg = _mm256_cmpeq_epi32(e, g), ei = _mm256_cmpeq_epi32(e, i);
+
+            __m256i e1 = select(_mm256_or_si256(_mm256_andnot_si256(ec, edgeDB), _mm256_andnot_si256(ea, edgeBF)), b, e);
+            __m256i e3 = select(_mm256_or_si256(_mm256_andnot_si256(eg, edgeDB), _mm256_andnot_si256(ea, edgeDH)), d, e);
+            __m256i e5 = select(_mm256_or_si256(_mm256_andnot_si256(ei, edgeBF), _mm256_andnot_si256(ec, edgeHF)), f, e);
+            __m256i e7 = select(_mm256_or_si256(_mm256_andnot_si256(ei, edgeDH), _mm256_andnot_si256(eg, edgeHF)), h, e);
+            store3(out0 + x * 3, select(edgeDB, d, e), e1, select(edgeBF, f, e));
+            store3(out1 + x * 3, e3, e, e5);
+            store3(out2 + x * 3, select(edgeDH, d, e), e7, select(edgeHF, f, e));
+        }
+#endif
+#if defined(__SSE2__)
+        for (; x + 4 <= width; x += 4) {
+            __m128i a = load4(above + x - 1), b = load4(above + x), c = load4(above + x + 1);
+            __m128i d = load4(center + x - 1), e = load4(center + x), f = load4(center + x + 1);
+            __m128i g = load4(below + x - 1), h = load4(below + x), i = load4(below + x + 1);
+            __m128i db = _mm_cmpeq_epi32(d, b), bf = _mm_cmpeq_epi32(b, f);
+            __m128i dh = _mm_cmpeq_epi32(d, h), hf = _mm_cmpeq_epi32(h, f);
+
+            // The four corner rules of Scale2x
+            __m128i edgeDB = _mm_andnot_si128(bf, _mm_andnot_si128(dh, db));
+            __m128i edgeBF = _mm_andnot_si128(db, _mm_andnot_si128(hf, bf));
+            __m128i edgeDH = _mm_andnot_si128(db, _mm_andnot_si128(hf, dh));
+            __m128i edgeHF = _mm_andnot_si128(dh, _mm_andnot_si128(bf, hf));
+            __m128i ea = _mm_cmpeq_epi32(e, a), ec = _mm_cmpeq_epi32(e, c);
+            __m128i eg = _mm_cmpeq_epi32(e, g), ei = _mm_cmpeq_epi32(e, i);
+
+            __m128i e1 = select(_mm_or_si128(_mm_andnot_si128(ec, edgeDB), _mm_andnot_si128(ea, edgeBF)), b, e);
+            __m128i e3 = select(_mm_or_si128(_mm_andnot_si128(eg, edgeDB), _mm_andnot_si128(ea, edgeDH)), d, e);
+            __m128i e5 = select(_mm_or_si128(_mm_andnot_si128(ei, edgeBF), _mm_andnot_si128(ec, edgeHF)), f, e);
+            __m128i e7 = select(_mm_or_si128(_mm_andnot_si128(ei, edgeDH), _mm_andnot_si128(eg, edgeHF)), h, e);
+            store3(out0 + x * 3, select(edgeDB, d, e), e1, select(edgeBF, f, e));
+            store3(out1 + x * 3, e3, e, e5);
+            store3(out2 + x * 3, select(edgeDH, d, e), e7, select(edgeHF, f, e));
+        }
+#endif
+        for (; x < width; ++x) {
+            uint32_t a = above[x - 1], b = above[x], c = above[x + 1];
+            uint32_t d = center[x - 1], e = center[x], f = center[x + 1];
+            uint32_t g = below[x - 1], h = below[x], i = below[x + 1];
+            bool edgeDB = d == b && b != f && d != h;
+            bool edgeBF = b == f && b != d && f != h;
+            bool edgeDH = d == h && d != b && h != f;
+            bool edgeHF = h == f && d != h && b != f;
+
+            out0[x * 3] = edgeDB ? d : e;
+            out0[x * 3 + 1] = ((edgeDB && e != c) || (edgeBF && e != a)) ? b : e;
+            out0[x * 3 + 2] = edgeBF ? f : e;
+            out1[x * 3] = ((edgeDB && e != g) || (edgeDH && e != a)) ? d : e;
+            out1[x * 3 + 1] = e;
+            out1[x * 3 + 2] = ((edgeBF && e != i) || (edgeHF && e != c)) ? f : e;
+            out2[x * 3] = edgeDH ? d : e;
+            out2[x * 3 + 1] = ((edgeDH && e != i) || (edgeHF && e != g)) ? h : e;
+            out2[x * 3 + 2] = edgeHF ? f : e;
+        }
+    }
+}
+
+// 2xBR level 1. For each corner of the 2x2 block, with F and H the neighbours on its
+// two sides, compare the edge strength along E-I against the one along F-H (weighted
+// YUV distances over the 4x4 area) and blend the corner towards F or H when F-H wins.
+void Scaler::xbrRows(uint32_t* output, int width, int firstRow, int lastRow) {
+    size_t outputWidth = static_cast<size_t>(width) * 2;
+    const int stride = paddedStride;
+
+    // With u and v the steps from E to F and to H, every pair of the E-I sum lies across
+    // the E-I diagonal and every pair of the F-H sum along it, so each sum reads one
+    // diagonal plane at five offsets (a pair's upper pixel), the last weighted four times
+    struct Corner {
+        int f, h;
+        const int16_t* acrossPlane;
+        const int16_t* alongPlane;
+        int across[5];
+        int along[5];
+        int ef, eh; // E-F in distanceRight, E-H in distanceDown
+    };
+    Corner corners[4]; // Top left, top right, bottom left, bottom right
+    for (int k = 0; k < 4; ++k) {
+        int u = k & 1 ? 1 : -1;
+        int v = k & 2 ? stride : -stride;
+        auto upper = [](int p, int q) { return std::min(p, q); };
+        bool falling = (u > 0) == (v > 0); // E-I runs from top left to bottom right
+        corners[k] = { u, v,
+            falling ? distanceDownLeft.data() : distanceDownRight.data(),
+            falling ? distanceDownRight.data() : distanceDownLeft.data(),
+            { upper(0, u - v), upper(0, v - u), upper(u + v, 2 * u), upper(u + v, 2 * v), upper(v, u) },
+            { upper(v, -u), upper(v, u + 2 * v), upper(u, 2 * u + v), upper(u, -v), upper(0, u + v) },
+            upper(0, u), upper(0, v) };
+    }
+    const uint32_t* pixels = padded.data();
+    const int16_t* right = distanceRight.data();
+    const int16_t* down = distanceDown.data();
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        int rowBase = (y + SCALER_PADDING) * stride + SCALER_PADDING;
+        uint32_t* out0 = output + static_cast<size_t>(y) * 2 * outputWidth;
+        uint32_t* out1 = out0 + outputWidth;
+        int x = 0;
+
+#if defined(__AVX2__)
+        for (; x + 8 <= width; x += 8) {
+            int e = rowBase + x;
+            __m256i color = load8(pixels + e);
+            __m256i block[4];
+            for (int k = 0; k < 4; ++k) {
+                const Corner& corner = corners[k];
+                block[k] = color;
+                __m256i f = load8(pixels + e + corner.f), h = load8(pixels + e + corner.h);
+                __m256i flat = _mm256_or_si256(_mm256_cmpeq_epi32(f, color), _mm256_cmpeq_epi32(h, color));
+                if (_mm256_movemask_epi8(flat) == -1) {
+                    continue;
+                }
+                const int16_t* across = corner.acrossPlane + e;
+                const int16_t* along = corner.alongPlane + e;
+                __m256i alongEI = _mm256_add_epi32(
+                    _mm256_add_epi32(loadDistances8(across + corner.across[0]), loadDistances8(across + corner.across[1])),
+                    _mm256_add_epi32(loadDistances8(across + corner.across[2]), loadDistances8(across + corner.across[3])));
+                alongEI = _mm256_add_epi32(alongEI, _mm256_slli_epi32(loadDistances8(across + corner.across[4]), 2));
+                __m256i alongFH = _mm256_add_epi32(
+                    _mm256_add_epi32(loadDistances8(along + corner.along[0]), loadDistances8(along + corner.along[1])),
+                    _mm256_add_epi32(loadDistances8(along + corner.along[2]), loadDistances8(along + corner.along[3])));
+                alongFH = _mm256_add_epi32(alongFH, _mm256_slli_epi32(loadDistances8(along + corner.along[4]), 2));
+                __m256i edge = _mm256_andnot_si256(flat, _mm256_cmpgt_epi32(alongFH, alongEI));
+                if (_mm256_testz_si256(edge, edge)) {
+                    continue;
+                }
+                __m256i towardsH = _mm256_cmpgt_epi32(loadDistances8(right + e + corner.ef), loadDistances8(down + e + corner.eh));
+                block[k] = select(edge, blendHalf(color, select(towardsH, h, f)), color);
+            }
+            store2(out0 + x * 2, block[0], block[1]);
+            store2(out1 + x * 2, block[2], block[3]);
+        }
+#endif
+#if defined(__SSE2__)
+        for (; x + 4 <= width; x += 4) {
+            int e = rowBase + x;
+            __m128i color = load4(pixels + e);
+            __m128i block[4];
+            for (int k = 0; k < 4; ++k) {
+                const Corner& corner = corners[k];
+                block[k] = color;
+                __m128i f = load4(pixels + e + corner.f), h = load4(pixels + e + corner.h);
+                __m128i flat = _mm_or_si128(_mm_cmpeq_epi32(f, color), _mm_cmpeq_epi32(h, color));
+                if (_mm_movemask_epi8(flat) == 0xFFFF) {
+                    continue;
+                }
+                const int16_t* across = corner.acrossPlane + e;
+                const int16_t* along = corner.alongPlane + e;
+                __m128i alongEI = _mm_add_epi32(
+                    _mm_add_epi32(loadDistances4(across + corner.across[0]), loadDistances4(across + corner.across[1])),
+                    _mm_add_epi32(loadDistances4(across + corner.across[2]), loadDistances4(across + corner.across[3])));
+                alongEI = _mm_add_epi32(alongEI, _mm_slli_epi32(loadDistances4(across + corner.across[4]), 2));
+                __m128i alongFH = _mm_add_epi32(
+                    _mm_add_epi32(loadDistances4(along + corner.along[0]), loadDistances4(along + corner.along[1])),
+                    _mm_add_epi32(loadDistances4(along + corner.along[2]), loadDistances4(along + corner.along[3])));
+                alongFH = _mm_add_epi32(alongFH, _mm_slli_epi32(loadDistances4(along + corner.along[4]), 2));
+                __m128i edge = _mm_andnot_si128(flat, _mm_cmpgt_epi32(alongFH, alongEI));
+                if (_mm_movemask_epi8(edge) == 0) {
+                    continue;
+                }
+                __m128i towardsH = _mm_cmpgt_epi32(loadDistances4(right + e + corner.ef), loadDistances4(down + e + corner.eh));
+                block[k] = select(edge, blendHalf(color, select(towardsH, h, f)), color);
+            }
+            store2(out0 + x * 2, block[0], block[1]);
+            store2(out1 + x * 2, block[2], block[3]);
+        }
+#endif
+        for (; x < width; ++x) {
+            int e = rowBase + x;
+            uint32_t color = pixels[e];
+            uint32_t block[4] = { color, color, color, color };
+            for (int k = 0; k < 4; ++k) {
+                const Corner& corner = corners[k];
+                uint32_t f = pixels[e + corner.f], h = pixels[e + corner.h];
+                if (f == color || h == color) {
+                    continue;
+                }
+                const int16_t* across = corner.acrossPlane + e;
+                const int16_t* along = corner.alongPlane + e;
+                int alongEI = across[corner.across[0]] + across[corner.across[1]] + across[corner.across[2]]
+                    + across[corner.across[3]] + 4 * across[corner.across[4]];
+                int alongFH = along[corner.along[0]] + along[corner.along[1]] + along[corner.along[2]]
+                    + along[corner.along[3]] + 4 * along[corner.along[4]];
+                if (alongEI < alongFH) {
+                    block[k] = blendHalf(color, right[e + corner.ef] <= down[e + corner.eh] ? f : h);
+                }
+            }
+            out0[x * 2] = block[0];
+            out0[x * 2 + 1] = block[1];
+            out1[x * 2] = block[2];
+            out1[x * 2 + 1] = block[3];
+        }
+    }
+}
+
+// Split rows into bands and let the pool and the calling thread work through them
+void Scaler::runBands(int rows, const std::function<void(int, int)>& job) {
+    int bandCount = std::max(std::min(rows, workers.size() * BANDS_PER_THREAD), 1);
+    workers.run(rows, (rows + bandCount - 1) / bandCount, job);
+}
@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "workerpool.h"
+
+#ifndef scaler_H
+#define scaler_H
+
+// Upscaling filters for 32-bit frame buffers (GPU output is RGBA)
+enum class ScaleFilter {
+    Nearest, // Integer pixel replication, any factor
+    Scale2x, // AdvMAME2x edge rules
+    Scale3x, // AdvMAME3x edge rules
+    XBR      // 2xBR (level 1) edge detection with half blending
+};
+
+// Post-process stage turning a width x height frame into one scaled by an integer factor.
+// Pixel-art filters run at their native size (2x, 3x) as often as the factor divides by it;
+// whatever is left over is finished with nearest scaling (e.g. Scale3x at 6x = Scale3x + 2x).
+class Scaler {
+private:
+    enum class StageType { Nearest, Scale2x, Scale3x, XBR };
+    struct Stage {
+        StageType type;
+        int factor;
+        int width;  // Input size of this stage
+        int height;
+    };
+    std::vector<Stage> stages;
+    std::vector<std::vector<uint32_t>> intermediate;
+    int factor;
+
+    // Input copy with a replicated 2 pixel border, so filters read neighbours unchecked
+    std::vector<uint32_t> padded;
+    int paddedStride;
+    // YUV of the padded input, then the weighted YUV distance from each padded pixel to its
+    // right, lower, lower right and lower left neighbour (xBR only)
+    std::vector<int16_t> lumaY, chromaU, chromaV;
+    std::vector<int16_t> distanceRight, distanceDown, distanceDownRight, distanceDownLeft;
+
+    // Band workers; the calling thread takes bands too
+    WorkerPool workers;
+
+    void runBands(int rows, const std::function<void(int, int)>& job);
+
+    void runStage(const Stage& stage, const uint32_t* input, uint32_t* output);
+    void padInput(const uint32_t* input, int width, int height);
+    void computeYUV();
+    void computeDistances();
+
+    void nearestRows(const uint32_t* input, uint32_t* output, int width, int scale, int firstRow, int lastRow);
+    void scale2xRows(uint32_t* output, int width, int firstRow, int lastRow);
+    void scale3xRows(uint32_t* output, int width, int firstRow, int lastRow);
+    void xbrRows(uint32_t* output, int width, int firstRow, int lastRow);
+
+public:
+    // Constructor (threads = 1 runs on the calling thread only, 0 uses every hardware thread)
+    Scaler(ScaleFilter filter, int factor, int width, int height, int threads = 1);
+    Scaler(const Scaler&) = delete;
+    Scaler& operator=(const Scaler&) = delete;
+
+    int getFactor() const;
+    int outputWidth() const;
+    int outputHeight() const;
+
+    // Scale one frame: input is width x height pixels, output outputWidth() x outputHeight()
+    void process(const uint8_t* input, uint8_t* output);
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "telemetry.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+// Names in the JSON dump, by TelemetryStage
+static const char* const STAGE_NAMES[TELEMETRY_STAGE_COUNT] = { "frame", "cpu", "ppu", "apu", "output", "wait" };
+
+// Nanoseconds per tick, 0 until calibrated
+static std::atomic<double> tickNanoseconds{ 0.0 };
+static std::once_flag calibrated;
+
+void calibrateTelemetryTicks() {
+    std::call_once(calibrated, [] {
+#if defined(__x86_64__) || defined(__i386__)
+        auto startTime = std::chrono::steady_clock::now();
+        uint64_t startTicks = telemetryTicks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t ticks = telemetryTicks() - startTicks;
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - startTime;
+        tickNanoseconds.store(elapsed.count() / static_cast<double>(ticks), std::memory_order_relaxed);
+#else
+        tickNanoseconds.store(1.0, std::memory_order_relaxed);
+#endif
+    });
+}
+
+double telemetryTickNanoseconds() {
+    double nanoseconds = tickNanoseconds.load(std::memory_order_relaxed);
+    if (nanoseconds == 0.0) {
+        calibrateTelemetryTicks();
+        nanoseconds = tickNanoseconds.load(std::memory_order_relaxed);
+    }
+    return nanoseconds;
+}
+
+// Single writer: a load and a store avoid the locked read-modify-write of fetch_add
+static void increase(std::atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Constructor
+LatencyHistogram::LatencyHistogram() {
+    clear();
+}
+
+// Values below 64 have a bucket each; above that a value with b significant bits lands in
+// block b - 6 (32 buckets), keyed by its top 6 bits
+int LatencyHistogram::bucketIndex(uint64_t value) {
+    value = std::min<uint64_t>(value, (uint64_t(1) << MAX_VALUE_BITS) - 1);
+    int shift = std::max(static_cast<int>(std::bit_width(value)) - SUB_BUCKET_BITS - 1, 0);
+    return (shift << SUB_BUCKET_BITS) + static_cast<int>(value >> shift);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(int index) {
+    int shift = std::max((index >> SUB_BUCKET_BITS) - 1, 0);
+    uint64_t lowest = static_cast<uint64_t>(index - (shift << SUB_BUCKET_BITS)) << shift;
+    return lowest + (uint64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    increase(counts[bucketIndex(value)], 1);
+    increase(count, 1);
+    increase(sum, value);
+    if (value > max.load(std::memory_order_relaxed)) {
+        max.store(value, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other) {
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        increase(counts[i], other.counts[i].load(std::memory_order_relaxed));
+    }
+    increase(count, other.getCount());
+    increase(sum, other.getSum());
+    if (other.getMax() > max.load(std::memory_order_relaxed)) {
+        max.store(other.getMax(), std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::clear() {
+    for (std::atomic<uint64_t>& bucket : counts) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getCount() const {
+    return count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getSum() const {
+    return sum.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getMax() const {
+    return max.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getMean() const {
+    uint64_t samples = getCount();
+    return samples ? static_cast<double>(getSum()) / samples : 0.0;
+}
+
+uint64_t LatencyHistogram::getPercentile(double fraction) const {
+    uint64_t samples = getCount();
+    if (samples == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * samples)), 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return std::min(bucketUpperBound(i), getMax());
+        }
+    }
+    return getMax(); // Buckets read ahead of count during a concurrent record
+}
+
+// Constructor
+FrameTelemetry::FrameTelemetry() : pending{}, runTicks(0), dumpInterval(600), framesSinceDump(0),
+    dumpRequests(0), dumpStopping(false) {
+    calibrateTelemetryTicks();
+}
+
+FrameTelemetry::~FrameTelemetry() {
+    if (dumpThread.joinable()) {
+        dumpStopping.store(true, std::memory_order_release);
+        dumpRequests.fetch_add(1, std::memory_order_release);
+        dumpRequests.notify_one();
+        dumpThread.join();
+    }
+}
+
+void FrameTelemetry::dumpLoop() {
+    uint32_t handled = 0;
+    while (true) {
+        dumpRequests.wait(handled, std::memory_order_acquire);
+        if (dumpStopping.load(std::memory_order_acquire)) {
+            return;
+        }
+        handled = dumpRequests.load(std::memory_order_acquire);
+        dump();
+    }
+}
+
+void FrameTelemetry::endRun(uint64_t ticks, bool frameComplete) {
+    runTicks += ticks;
+    if (!frameComplete) {
+        return;
+    }
+
+    uint64_t measured = 0;
+    for (int stage = static_cast<int>(TelemetryStage::PPU); stage < TELEMETRY_STAGE_COUNT; ++stage) {
+        measured += pending[stage];
+    }
+    pending[static_cast<int>(TelemetryStage::Frame)] = runTicks;
+    pending[static_cast<int>(TelemetryStage::CPU)] = runTicks > measured ? runTicks - measured : 0;
+    for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; ++stage) {
+        histograms[stage].record(pending[stage]);
+        pending[stage] = 0;
+    }
+    runTicks = 0;
+
+    if (dumpThread.joinable() && ++framesSinceDump >= dumpInterval) {
+        framesSinceDump = 0;
+        dumpRequests.fetch_add(1, std::memory_order_release);
+        dumpRequests.notify_one();
+    }
+}
+
+uint64_t FrameTelemetry::getFrames() const {
+    return histograms[static_cast<int>(TelemetryStage::Frame)].getCount();
+}
+
+const LatencyHistogram& FrameTelemetry::getHistogram(TelemetryStage stage) const {
+    return histograms[static_cast<int>(stage)];
+}
+
+double FrameTelemetry::getPercentileMicroseconds(TelemetryStage stage, double fraction) const {
+    return getHistogram(stage).getPercentile(fraction) * telemetryTickNanoseconds() / 1000.0;
+}
+
+double FrameTelemetry::getMeanMicroseconds(TelemetryStage stage) const {
+    return getHistogram(stage).getMean() * telemetryTickNanoseconds() / 1000.0;
+}
+
+void FrameTelemetry::writeJSON(std::ostream& out) const {
+    double microseconds = telemetryTickNanoseconds() / 1000.0;
+    double frameTotal = static_cast<double>(getHistogram(TelemetryStage::Frame).getSum());
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "{\n  \"frames\": " << getFrames() << ",\n  \"stages\": {\n";
+    for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; ++stage) {
+        const LatencyHistogram& histogram = histograms[stage];
+        json << "    \"" << STAGE_NAMES[stage] << "\": {"
+            << " \"count\": " << histogram.getCount()
+            << ", \"mean_us\": " << histogram.getMean() * microseconds
+            << ", \"p50_us\": " << histogram.getPercentile(0.5) * microseconds
+            << ", \"p99_us\": " << histogram.getPercentile(0.99) * microseconds
+            << ", \"p999_us\": " << histogram.getPercentile(0.999) * microseconds
+            << ", \"max_us\": " << histogram.getMax() * microseconds
+            << ", \"share\": " << (frameTotal > 0 ? histogram.getSum() / frameTotal : 0.0)
+            << " }" << (stage + 1 < TELEMETRY_STAGE_COUNT ? ",\n" : "\n");
+    }
+    json << "  }\n}\n";
+    out << json.str();
+}
+
+void FrameTelemetry::clear() {
+    for (LatencyHistogram& histogram : histograms) {
+        histogram.clear();
+    }
+    std::fill(std::begin(pending), std::end(pending), 0);
+    runTicks = 0;
+    framesSinceDump = 0;
+}
+
+void FrameTelemetry::setDumpFile(const std::string& path, int intervalFrames) {
+    {
+        std::lock_guard<std::mutex> lock(dumpMutex);
+        dumpPath = path;
+    }
+    dumpInterval = std::max(intervalFrames, 1);
+    framesSinceDump = 0;
+    if (!path.empty() && !dumpThread.joinable()) {
+        dumpThread = std::thread(&FrameTelemetry::dumpLoop, this);
+    }
+}
+
+// Written next to the target and renamed over it (one writer at a time)
+bool FrameTelemetry::dump() const {
+    std::lock_guard<std::mutex> lock(dumpMutex);
+    if (dumpPath.empty()) {
+        return false;
+    }
+    std::string temporary = dumpPath + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+        writeJSON(file);
+        if (!file.flush()) {
+            return false;
+        }
+    }
+    return std::rename(temporary.c_str(), dumpPath.c_str()) == 0;
+}
@@ -0,0 +1,156 @@
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <ctime>
+#endif
+
+#ifndef telemetry_H
+#define telemetry_H
+
+// Where a frame's time goes. CPU is what is left of Frame after the other stages.
+enum class TelemetryStage : uint8_t {
+    Frame,  // Wall time inside runFrame for one emulated frame
+    CPU,
+    PPU,    // Drawing on the emulation thread (sampled, see TELEMETRY_PPU_STRIDE)
+    APU,    // Sample synthesis
+    Output, // Publishing to an attached FrameExchange/FrameServer, battery save flushes
+    Wait    // Blocked on the render worker
+};
+
+constexpr int TELEMETRY_STAGE_COUNT = 6;
+
+// The PPU is timed on one scanline in this many (rotating with the frame) and scaled up,
+// which keeps timer reads to a handful per frame
+constexpr int TELEMETRY_PPU_STRIDE = 16;
+
+// Raw timestamp: the TSC on x86, CLOCK_MONOTONIC nanoseconds elsewhere
+inline uint64_t telemetryTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000u + now.tv_nsec;
+#endif
+}
+
+// Measure the tick rate against steady_clock (once per process, about 10 ms); FrameTelemetry's
+// constructor does this so scrapes and dumps never wait for it
+void calibrateTelemetryTicks();
+// Nanoseconds per tick (calibrates first if nothing has yet)
+double telemetryTickNanoseconds();
+
+// HDR-style histogram of tick counts: exact below 64, then 32 linear buckets per power of
+// two (under 3.2% relative error) up to 2^40 ticks, which larger values are clamped to.
+// One thread records, any thread may read; reads are relaxed, so a scrape during a
+// frame can be one frame behind in some buckets.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr int MAX_VALUE_BITS = 40;
+    static constexpr int BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> counts;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketUpperBound(int index);
+
+public:
+    // Constructor
+    LatencyHistogram();
+
+    void record(uint64_t value); // Recording thread only
+    void add(const LatencyHistogram& other); // Merge another instance's histogram (e.g. a whole pool)
+    void clear();
+
+    uint64_t getCount() const;
+    uint64_t getSum() const;
+    uint64_t getMax() const;
+    double getMean() const;
+    // Value at or below which the given fraction (0.5, 0.99, 0.999) of the samples lie,
+    // rounded up to its bucket's upper bound; 0 when empty
+    uint64_t getPercentile(double fraction) const;
+};
+
+// Per-machine frame timing (GameBoy::enableTelemetry). The emulation thread adds stage times
+// while a frame runs and records the totals when it completes; anyone may scrape.
+class FrameTelemetry {
+private:
+    std::array<LatencyHistogram, TELEMETRY_STAGE_COUNT> histograms;
+
+    // Current frame (emulation thread only)
+    uint64_t pending[TELEMETRY_STAGE_COUNT];
+    uint64_t runTicks; // Summed over runFrame calls, a breakpoint can split a frame
+
+    // Periodic JSON dump, written by a background thread the emulation thread wakes
+    std::string dumpPath; // Guarded by dumpMutex, which is held while writing
+    mutable std::mutex dumpMutex;
+    int dumpInterval;
+    int framesSinceDump;
+    std::atomic<uint32_t> dumpRequests;
+    std::atomic<bool> dumpStopping;
+    std::thread dumpThread;
+
+    void dumpLoop();
+
+public:
+    // Constructor
+    FrameTelemetry();
+    ~FrameTelemetry();
+
+    // Emulation thread: time spent in a stage during the current frame
+    void addStageTime(TelemetryStage stage, uint64_t ticks) {
+        pending[static_cast<int>(stage)] += ticks;
+    }
+    // Close a runFrame call that took ticks; a completed frame goes into the histograms
+    void endRun(uint64_t ticks, bool frameComplete);
+
+    // Scraping
+    uint64_t getFrames() const;
+    const LatencyHistogram& getHistogram(TelemetryStage stage) const;
+    double getPercentileMicroseconds(TelemetryStage stage, double fraction) const;
+    double getMeanMicroseconds(TelemetryStage stage) const;
+    // Count, mean, p50/p99/p999, max and share of the frame per stage, in microseconds
+    void writeJSON(std::ostream& out) const;
+    void clear(); // Between frames, from the emulation thread
+
+    // Rewrite path with writeJSON every intervalFrames completed frames (empty path stops).
+    // The file is written on a background thread and replaced atomically, so neither the
+    // emulation thread nor a scraper waits on it. Call between frames.
+    void setDumpFile(const std::string& path, int intervalFrames = 600);
+    bool dump() const; // Write the file now, on the calling thread
+};
+
+// Adds the time from construction to destruction to a stage, times scale (no-op without telemetry)
+class StageTimer {
+private:
+    FrameTelemetry* telemetry;
+    TelemetryStage stage;
+    uint64_t scale;
+    uint64_t start;
+
+public:
+    StageTimer(FrameTelemetry* telemetry, TelemetryStage stage, uint64_t scale = 1)
+        : telemetry(telemetry), stage(stage), scale(scale), start(telemetry ? telemetryTicks() : 0) {
+    }
+    ~StageTimer() {
+        if (telemetry) {
+            telemetry->addStageTime(stage, (telemetryTicks() - start) * scale);
+        }
+    }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+};
+
+#endif
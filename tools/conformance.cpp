@@ -0,0 +1,456 @@
+// Single-step conformance runner for the interpreter core.
+//
+//   conformance <directory> [threads]
+//
+// Loads per-opcode test vectors in the common single-step JSON format (one file per
+// opcode, "XX.json" or "cb XX.json", each an array of cases with initial and final
+// register and RAM state and the bus cycles), runs every case through
+// CPU::executeNextInstruction and reports pass/fail per opcode. Cases are parsed and run
+// one at a time straight off the file, files are spread over worker threads. Registers,
+// flags, IME, RAM and the cycle count are checked; the order of bus accesses within an
+// instruction is not, as the CPU executes instructions whole. Exits non-zero if any
+// implemented opcode fails; files for opcodes the CPU does not implement are listed but
+// not run.
+//
+// No vectors are shipped: point it at a checkout of the SingleStepTests sm83 set (its v1
+// directory), whose files are read as they are.
+//
+// Build from the repository root:
+//   g++ -std=c++20 -O2 -I. tools/conformance.cpp $(ls *.cpp | grep -v main.cpp) -lpthread -o conformance
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpu.h"
+#include "referencecpu.h"
+
+constexpr size_t MEMORY_SIZE = 0x10000;
+
+struct RAMByte {
+    uint16_t address;
+    uint8_t value;
+};
+
+struct CaseState {
+    ReferenceState registers;
+    bool ime;
+    bool ei; // EI just executed: IME turns on after the next instruction
+    std::vector<RAMByte> ram;
+};
+
+struct TestCase {
+    std::string name;
+    CaseState initial;
+    CaseState final;
+    int cycles; // T-cycles, four per bus cycle entry
+};
+
+// Pull parser over a whole file: no document tree, each case is read into a reused
+// TestCase and run before the next one is parsed
+class JsonReader {
+private:
+    const char* position;
+    const char* end;
+
+    void skipSpace() {
+        while (position < end && (*position == ' ' || *position == '\n' || *position == '\r' || *position == '\t')) {
+            position++;
+        }
+    }
+
+public:
+    JsonReader(const char* begin, const char* end) : position(begin), end(end) {
+    }
+
+    char peek() {
+        skipSpace();
+        return position < end ? *position : '\0';
+    }
+
+    bool consume(char expected) {
+        if (peek() != expected) {
+            return false;
+        }
+        position++;
+        return true;
+    }
+
+    bool readString(std::string& text) {
+        if (!consume('"')) {
+            return false;
+        }
+        const char* start = position;
+        while (position < end && *position != '"') {
+            position += *position == '\\' ? 2 : 1;
+        }
+        if (position >= end) {
+            return false;
+        }
+        text.assign(start, position++);
+        return true;
+    }
+
+    bool readNumber(long& value) {
+        skipSpace();
+        char* after = nullptr;
+        value = std::strtol(position, &after, 10);
+        if (after == position) {
+            return false;
+        }
+        position = after;
+        return true;
+    }
+
+    // Any value, for fields the runner does not check
+    bool skipValue() {
+        char next = peek();
+        if (next == '"') {
+            std::string ignored;
+            return readString(ignored);
+        }
+        if (next == '[' || next == '{') {
+            char close = next == '[' ? ']' : '}';
+            position++;
+            if (consume(close)) {
+                return true;
+            }
+            do {
+                if (close == '}') {
+                    std::string key;
+                    if (!readString(key) || !consume(':')) {
+                        return false;
+                    }
+                }
+                if (!skipValue()) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(close);
+        }
+        while (position < end && (std::isalnum(static_cast<unsigned char>(*position)) || *position == '-'
+            || *position == '.' || *position == '+')) {
+            position++; // Number, true, false or null
+        }
+        return true;
+    }
+};
+
+static bool readState(JsonReader& reader, CaseState& state) {
+    state.registers = {};
+    state.ime = state.ei = false;
+    state.ram.clear();
+    if (!reader.consume('{')) {
+        return false;
+    }
+    std::string key;
+    do {
+        long value = 0;
+        if (!reader.readString(key) || !reader.consume(':')) {
+            return false;
+        }
+        if (key == "ram") {
+            if (!reader.consume('[')) {
+                return false;
+            }
+            if (!reader.consume(']')) {
+                do {
+                    long address, byte;
+                    if (!reader.consume('[') || !reader.readNumber(address) || !reader.consume(',')
+                        || !reader.readNumber(byte) || !reader.consume(']')) {
+                        return false;
+                    }
+                    state.ram.push_back({ static_cast<uint16_t>(address), static_cast<uint8_t>(byte) });
+                } while (reader.consume(','));
+                if (!reader.consume(']')) {
+                    return false;
+                }
+            }
+            continue;
+        }
+        // ie is not loaded: FFFF is plain memory here, and its byte comes with the ram list
+        if ((key.size() > 2 && key != "ime") || reader.peek() == '"' || reader.peek() == '[') {
+            if (!reader.skipValue()) {
+                return false;
+            }
+            continue;
+        }
+        if (!reader.readNumber(value)) {
+            return false;
+        }
+        ReferenceState& r = state.registers;
+        if (key == "ime") state.ime = value != 0;
+        else if (key == "ei") state.ei = value != 0;
+        else if (key == "a") r.a = value;
+        else if (key == "f") r.f = value;
+        else if (key == "b") r.b = value;
+        else if (key == "c") r.c = value;
+        else if (key == "d") r.d = value;
+        else if (key == "e") r.e = value;
+        else if (key == "h") r.h = value;
+        else if (key == "l") r.l = value;
+        else if (key == "pc") r.pc = value;
+        else if (key == "sp") r.sp = value;
+    } while (reader.consume(','));
+    return reader.consume('}');
+}
+
+static bool readCase(JsonReader& reader, TestCase& test) {
+    if (!reader.consume('{')) {
+        return false;
+    }
+    std::string key;
+    do {
+        if (!reader.readString(key) || !reader.consume(':')) {
+            return false;
+        }
+        bool ok;
+        if (key == "name") ok = reader.readString(test.name);
+        else if (key == "initial") ok = readState(reader, test.initial);
+        else if (key == "final") ok = readState(reader, test.final);
+        else if (key == "cycles") {
+            ok = reader.consume('[');
+            test.cycles = 0;
+            if (ok && !reader.consume(']')) {
+                do {
+                    ok = reader.skipValue();
+                    test.cycles += 4;
+                } while (ok && reader.consume(','));
+                ok = ok && reader.consume(']');
+            }
+        }
+        else ok = reader.skipValue();
+        if (!ok) {
+            return false;
+        }
+    } while (reader.consume(','));
+    return reader.consume('}');
+}
+
+static std::string formatState(const ReferenceState& state) {
+    char text[96];
+    std::snprintf(text, sizeof(text), "A=%02X F=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X SP=%04X PC=%04X",
+        state.a, state.f, state.b, state.c, state.d, state.e, state.h, state.l, state.sp, state.pc);
+    return text;
+}
+
+// CPU with every page of its memory map on one flat buffer
+struct Machine {
+    std::vector<uint8_t> memory;
+    std::unique_ptr<CPU> cpu;
+
+    Machine() : memory(MEMORY_SIZE), cpu(std::make_unique<CPU>()) {
+        for (int page = 0; page < MEMORY_PAGE_COUNT; ++page) {
+            cpu->memoryMap.read[page] = &memory[page << 8];
+            cpu->memoryMap.write[page] = &memory[page << 8];
+        }
+    }
+
+    void load(const ReferenceState& state, bool ime = false, bool ei = false) {
+        cpu->A = state.a;
+        cpu->B = state.b;
+        cpu->C = state.c;
+        cpu->D = state.d;
+        cpu->E = state.e;
+        cpu->H = state.h;
+        cpu->L = state.l;
+        cpu->SP = state.sp;
+        cpu->PC = state.pc;
+        cpu->zeroFlag = state.f & FLAG_Z;
+        cpu->subtractFlag = state.f & FLAG_N;
+        cpu->halfCarryFlag = state.f & FLAG_H;
+        cpu->carryFlag = state.f & FLAG_C;
+        cpu->ime = ime;
+        cpu->pendingIME = ei;
+    }
+
+    ReferenceState state() const {
+        uint8_t f = (cpu->zeroFlag ? FLAG_Z : 0) | (cpu->subtractFlag ? FLAG_N : 0)
+            | (cpu->halfCarryFlag ? FLAG_H : 0) | (cpu->carryFlag ? FLAG_C : 0);
+        return { cpu->A, f, cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L, cpu->SP, cpu->PC };
+    }
+
+    // Empty string if the case passes
+    std::string run(const TestCase& test) {
+        for (const RAMByte& byte : test.initial.ram) {
+            memory[byte.address] = byte.value;
+        }
+        load(test.initial.registers, test.initial.ime, test.initial.ei);
+        uint64_t before = cpu->cycleCount;
+        cpu->executeNextInstruction();
+        int cycles = static_cast<int>(cpu->cycleCount - before);
+
+        ReferenceState expected = test.final.registers;
+        expected.f &= 0xF0;
+        ReferenceState actual = state();
+        // The CPU applies a pending EI at the end of the instruction rather than the next
+        // one, so interrupts are compared as enabled now or after the next instruction
+        bool expectedIME = test.final.ime || test.final.ei;
+        bool actualIME = cpu->ime || cpu->pendingIME;
+        std::string failure;
+        if (std::memcmp(&expected, &actual, sizeof(ReferenceState)) != 0 || cycles != test.cycles
+            || expectedIME != actualIME) {
+            failure = "  expected " + formatState(expected) + " IME " + std::to_string(expectedIME) + " cycles "
+                + std::to_string(test.cycles) + "\n"
+                + "  actual   " + formatState(actual) + " IME " + std::to_string(actualIME) + " cycles "
+                + std::to_string(cycles) + "\n";
+        }
+        for (const RAMByte& byte : test.final.ram) {
+            if (memory[byte.address] != byte.value) {
+                char line[64];
+                std::snprintf(line, sizeof(line), "  (%04X) expected %02X, actual %02X\n", byte.address, byte.value,
+                    memory[byte.address]);
+                failure += line;
+            }
+        }
+
+        // Leave memory clean for the next case
+        for (const RAMByte& byte : test.initial.ram) {
+            memory[byte.address] = 0;
+        }
+        for (const RAMByte& byte : test.final.ram) {
+            memory[byte.address] = 0;
+        }
+        return failure;
+    }
+};
+
+struct FileResult {
+    std::string opcode; // File name without .json
+    bool implemented;
+    int passed;
+    int total;
+    bool parsed;
+    std::string firstFailure;
+};
+
+static void runFile(const std::filesystem::path& path, FileResult& result, Machine& machine) {
+    std::ifstream in(path, std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    JsonReader reader(text.data(), text.data() + text.size());
+
+    result.passed = result.total = 0;
+    result.parsed = reader.consume('[');
+    if (!result.parsed || reader.consume(']')) {
+        return;
+    }
+    TestCase test;
+    do {
+        if (!readCase(reader, test)) {
+            result.parsed = false;
+            return;
+        }
+        result.total++;
+        std::string failure = machine.run(test);
+        if (failure.empty()) {
+            result.passed++;
+        }
+        else if (result.firstFailure.empty()) {
+            result.firstFailure = "  case \"" + test.name + "\" from " + formatState(test.initial.registers) + "\n" + failure;
+        }
+    } while (reader.consume(','));
+    result.parsed = reader.consume(']');
+}
+
+// Opcodes the CPU handles: run each once and watch for its unknown opcode message
+static std::vector<bool> probeOpcodes() {
+    Machine machine;
+    std::vector<bool> implemented(256);
+    std::ostringstream sink;
+    std::streambuf* previous = std::cerr.rdbuf(sink.rdbuf());
+    for (int opcode = 0; opcode < 0x100; ++opcode) {
+        sink.str("");
+        machine.load({ 0, 0, 0, 0, 0, 0, 0xC0, 0x00, 0xD000, 0x0100 });
+        machine.memory[0x0100] = static_cast<uint8_t>(opcode);
+        machine.cpu->executeNextInstruction();
+        implemented[opcode] = sink.str().find("Unknown opcode") == std::string::npos;
+    }
+    std::cerr.rdbuf(previous);
+    return implemented;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: conformance <directory> [threads]\n");
+        return 2;
+    }
+    std::filesystem::path directory = argv[1];
+    unsigned threads = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : std::thread::hardware_concurrency();
+    threads = std::max(threads, 1u);
+
+    std::vector<std::filesystem::path> files;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (entry.path().extension() == ".json") {
+            files.push_back(entry.path());
+        }
+    }
+    if (files.empty()) {
+        std::fprintf(stderr, "no test vectors in %s\n", directory.string().c_str());
+        return 2;
+    }
+    std::sort(files.begin(), files.end());
+
+    // A file's opcode is its leading hex byte(s): "80.json", "cb 11.json"
+    std::vector<bool> implemented = probeOpcodes();
+    std::vector<FileResult> results(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        results[i].opcode = files[i].stem().string();
+        unsigned opcode = static_cast<unsigned>(std::strtoul(results[i].opcode.c_str(), nullptr, 16));
+        results[i].implemented = opcode < 0x100 && implemented[opcode];
+    }
+
+    // Unimplemented opcodes are not run: their results are not counted, and every case
+    // would print an unknown opcode message
+    std::atomic<size_t> nextFile{0};
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min<size_t>(threads, files.size()); ++t) {
+        workers.emplace_back([&]() {
+            Machine machine;
+            for (size_t i; (i = nextFile.fetch_add(1)) < files.size();) {
+                if (results[i].implemented) {
+                    runFile(files[i], results[i], machine);
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    uint64_t cases = 0;
+    int passing = 0, failing = 0, missing = 0;
+    std::string missingList;
+    for (const FileResult& result : results) {
+        cases += result.total;
+        if (!result.implemented) {
+            missing++;
+            missingList += " " + result.opcode;
+            continue;
+        }
+        bool pass = result.parsed && result.passed == result.total;
+        (pass ? passing : failing)++;
+        if (!pass) {
+            std::printf("FAIL %s: %d/%d passed%s\n%s", result.opcode.c_str(), result.passed, result.total,
+                result.parsed ? "" : " (malformed file)", result.firstFailure.c_str());
+        }
+    }
+    if (missing) {
+        std::printf("not implemented by CPU:%s\n", missingList.c_str());
+    }
+    std::printf("%d opcodes pass, %d fail, %d not implemented; %llu cases in %.2f s\n", passing, failing, missing,
+        static_cast<unsigned long long>(cases), elapsed);
+    return failing ? 1 : 0;
+}
@@ -0,0 +1,428 @@
+// Differential fuzzer for the interpreter core.
+//
+//   cpufuzz [seconds] [threads] [seed]
+//   cpufuzz --replay "<state>"
+//
+// Runs random instruction streams from random register and memory states through both
+// ReferenceCPU and CPU::executeNextInstruction over a flat 64 KB memory, comparing
+// registers, flags, cycle counts and memory writes after every instruction (and the
+// whole memory after every program, for stray writes). A mismatch is shrunk to a single
+// instruction with as few non-zero inputs as still reproduce it and printed as a line
+// that --replay accepts. Opcodes the CPU does not implement are listed and skipped.
+//
+// Build from the repository root:
+//   g++ -std=c++20 -O2 -I. tools/cpufuzz.cpp tools/referencecpu.cpp $(ls *.cpp | grep -v main.cpp) -lpthread -o cpufuzz
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cpu.h"
+#include "referencecpu.h"
+
+constexpr size_t MEMORY_SIZE = 0x10000;
+constexpr int PROGRAM_LENGTH = 512;
+
+// xorshift64*
+struct Random {
+    uint64_t state;
+
+    explicit Random(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {
+    }
+
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    // Flag boundaries are where the bugs are, so favour them over uniform bytes
+    uint8_t byte() {
+        static const uint8_t edges[] = { 0x00, 0x01, 0x0F, 0x10, 0x7F, 0x80, 0xF0, 0xFF };
+        uint64_t value = next();
+        return (value & 3) == 0 ? edges[(value >> 2) & 7] : static_cast<uint8_t>(value >> 8);
+    }
+};
+
+// One instruction with the inputs it depends on
+struct Reproducer {
+    ReferenceState state;
+    std::vector<ReferenceCPU::Access> memory; // Opcode, operands and data the reference read
+};
+
+// Reference and CPU under test, each over its own copy of the same flat memory
+struct Machine {
+    std::vector<uint8_t> referenceMemory;
+    std::vector<uint8_t> testMemory;
+    ReferenceCPU reference;
+    std::unique_ptr<CPU> cpu;
+
+    Machine() : referenceMemory(MEMORY_SIZE), testMemory(MEMORY_SIZE), reference(referenceMemory.data()),
+        cpu(std::make_unique<CPU>()) {
+        for (int page = 0; page < MEMORY_PAGE_COUNT; ++page) {
+            cpu->memoryMap.read[page] = &testMemory[page << 8];
+            cpu->memoryMap.write[page] = &testMemory[page << 8];
+        }
+    }
+
+    void load(const ReferenceState& state) {
+        reference.state = state;
+        cpu->A = state.a;
+        cpu->B = state.b;
+        cpu->C = state.c;
+        cpu->D = state.d;
+        cpu->E = state.e;
+        cpu->H = state.h;
+        cpu->L = state.l;
+        cpu->SP = state.sp;
+        cpu->PC = state.pc;
+        cpu->zeroFlag = state.f & FLAG_Z;
+        cpu->subtractFlag = state.f & FLAG_N;
+        cpu->halfCarryFlag = state.f & FLAG_H;
+        cpu->carryFlag = state.f & FLAG_C;
+    }
+
+    ReferenceState testState() const {
+        uint8_t f = (cpu->zeroFlag ? FLAG_Z : 0) | (cpu->subtractFlag ? FLAG_N : 0)
+            | (cpu->halfCarryFlag ? FLAG_H : 0) | (cpu->carryFlag ? FLAG_C : 0);
+        return { cpu->A, f, cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L, cpu->SP, cpu->PC };
+    }
+
+    void poke(uint16_t address, uint8_t value) {
+        referenceMemory[address] = value;
+        testMemory[address] = value;
+    }
+
+    // Run one instruction on both; false if anything differs (details in report)
+    bool step(std::string* report, bool compareMemory) {
+        uint64_t before = cpu->cycleCount;
+        int expectedCycles = reference.step();
+        cpu->executeNextInstruction();
+        int actualCycles = static_cast<int>(cpu->cycleCount - before);
+
+        ReferenceState expected = reference.state;
+        ReferenceState actual = testState();
+        bool registers = std::memcmp(&expected, &actual, sizeof(ReferenceState)) == 0;
+        bool writes = true;
+        for (int i = 0; i < reference.writeCount; ++i) {
+            writes &= testMemory[reference.writes[i].address] == reference.writes[i].value;
+        }
+        int stray = -1;
+        if (writes && compareMemory && std::memcmp(referenceMemory.data(), testMemory.data(), MEMORY_SIZE) != 0) {
+            for (stray = 0; referenceMemory[stray] == testMemory[stray]; ++stray) {
+            }
+        }
+        if (registers && writes && stray < 0 && expectedCycles == actualCycles) {
+            return true;
+        }
+
+        if (report) {
+            std::ostringstream out;
+            out << "  reference: " << format(expected) << " cycles " << expectedCycles << "\n";
+            out << "  cpu:       " << format(actual) << " cycles " << actualCycles << "\n";
+            for (int i = 0; i < reference.writeCount; ++i) {
+                const ReferenceCPU::Access& write = reference.writes[i];
+                char line[64];
+                std::snprintf(line, sizeof(line), "  (%04X): reference %02X, cpu %02X\n", write.address, write.value,
+                    testMemory[write.address]);
+                out << line;
+            }
+            if (stray >= 0) {
+                char line[64];
+                std::snprintf(line, sizeof(line), "  stray write (%04X): %02X, should be %02X\n", stray,
+                    testMemory[stray], referenceMemory[stray]);
+                out << line;
+            }
+            *report = out.str();
+        }
+        return false;
+    }
+
+    // Clean memories holding only the reproducer's inputs; false if the instruction mismatches
+    bool check(const Reproducer& reproducer, std::string* report) {
+        std::memset(referenceMemory.data(), 0, MEMORY_SIZE);
+        std::memset(testMemory.data(), 0, MEMORY_SIZE);
+        for (const ReferenceCPU::Access& byte : reproducer.memory) {
+            poke(byte.address, byte.value);
+        }
+        load(reproducer.state);
+        return step(report, true);
+    }
+
+    static std::string format(const ReferenceState& state) {
+        char text[96];
+        std::snprintf(text, sizeof(text), "A=%02X F=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X SP=%04X PC=%04X",
+            state.a, state.f, state.b, state.c, state.d, state.e, state.h, state.l, state.sp, state.pc);
+        return text;
+    }
+};
+
+static std::string formatReproducer(const Reproducer& reproducer) {
+    std::string text = Machine::format(reproducer.state);
+    for (const ReferenceCPU::Access& byte : reproducer.memory) {
+        char entry[16];
+        std::snprintf(entry, sizeof(entry), " %04X=%02X", byte.address, byte.value);
+        text += entry;
+    }
+    return text;
+}
+
+// Inverse of formatReproducer: KEY=hex tokens, four digit keys are memory
+static bool parseReproducer(const std::string& text, Reproducer& reproducer) {
+    reproducer = {};
+    std::istringstream in(text);
+    std::string token;
+    while (in >> token) {
+        size_t equals = token.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+        std::string key = token.substr(0, equals);
+        unsigned value = static_cast<unsigned>(std::strtoul(token.c_str() + equals + 1, nullptr, 16));
+        ReferenceState& s = reproducer.state;
+        if (key == "A") s.a = value;
+        else if (key == "F") s.f = value & 0xF0;
+        else if (key == "B") s.b = value;
+        else if (key == "C") s.c = value;
+        else if (key == "D") s.d = value;
+        else if (key == "E") s.e = value;
+        else if (key == "H") s.h = value;
+        else if (key == "L") s.l = value;
+        else if (key == "SP") s.sp = value;
+        else if (key == "PC") s.pc = value;
+        else if (key.size() == 4) {
+            uint8_t byte = static_cast<uint8_t>(value);
+            reproducer.memory.push_back({ static_cast<uint16_t>(std::strtoul(key.c_str(), nullptr, 16)), byte, byte });
+        }
+        else return false;
+    }
+    return true;
+}
+
+// Greedily zero every register and input byte that the mismatch does not need
+static void shrink(Machine& machine, Reproducer& reproducer) {
+    uint8_t* registers[] = { &reproducer.state.a, &reproducer.state.f, &reproducer.state.b, &reproducer.state.c,
+        &reproducer.state.d, &reproducer.state.e, &reproducer.state.h, &reproducer.state.l };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint8_t* reg : registers) {
+            uint8_t saved = *reg;
+            if (saved == 0) continue;
+            *reg = 0;
+            if (machine.check(reproducer, nullptr)) *reg = saved;
+            else changed = true;
+        }
+        if (reproducer.state.sp != 0) {
+            uint16_t saved = reproducer.state.sp;
+            reproducer.state.sp = 0;
+            if (machine.check(reproducer, nullptr)) reproducer.state.sp = saved;
+            else changed = true;
+        }
+        for (size_t i = 1; i < reproducer.memory.size(); ++i) { // Keep the opcode
+            ReferenceCPU::Access saved = reproducer.memory[i];
+            reproducer.memory.erase(reproducer.memory.begin() + i);
+            if (machine.check(reproducer, nullptr)) reproducer.memory.insert(reproducer.memory.begin() + i, saved);
+            else { changed = true; --i; }
+        }
+    }
+}
+
+// Run-wide state shared by the workers
+struct Campaign {
+    bool fuzzed[256] = {};
+    std::atomic<bool> reported[256] = {};
+    std::atomic<uint64_t> instructions{0};
+    std::atomic<int> mismatches{0};
+    std::atomic<bool> stop{false};
+    std::mutex output;
+    std::vector<uint8_t> opcodes;
+};
+
+// Print a shrunk reproducer for the instruction, once per opcode
+static void reportMismatch(Campaign& campaign, Machine& scratch, Reproducer reproducer, const std::string& context) {
+    uint8_t opcode = reproducer.memory[0].value;
+    if (campaign.reported[opcode].exchange(true)) {
+        return;
+    }
+    std::string report;
+    bool isolated = !scratch.check(reproducer, nullptr);
+    if (isolated) {
+        shrink(scratch, reproducer);
+        scratch.check(reproducer, &report);
+    }
+    else {
+        report = context; // Depends on more than this instruction's inputs
+    }
+
+    std::lock_guard<std::mutex> lock(campaign.output);
+    campaign.mismatches++;
+    std::printf("MISMATCH opcode %02X%s\n  replay:    %s\n%s", opcode, isolated ? "" : " (not reproducible in isolation)",
+        formatReproducer(reproducer).c_str(), report.c_str());
+    std::fflush(stdout);
+}
+
+static uint8_t pickOpcode(Campaign& campaign, Random& random) {
+    for (;;) {
+        uint8_t opcode = campaign.opcodes[random.next() % campaign.opcodes.size()];
+        if (!campaign.reported[opcode].load(std::memory_order_relaxed)) {
+            return opcode;
+        }
+    }
+}
+
+// A program: fresh registers at a random PC, then instructions written just ahead of PC
+// as it goes, so jumps and calls land on new code.
+enum class Outcome { Match, Reported, MemoryDiffers };
+
+static Outcome runProgram(Campaign& campaign, Machine& machine, Machine& scratch, uint64_t seed, bool replay,
+    std::vector<ReferenceCPU::Access>& undo) {
+    Random random(seed);
+    ReferenceState start = { random.byte(), static_cast<uint8_t>(random.byte() & 0xF0), random.byte(), random.byte(),
+        random.byte(), random.byte(), random.byte(), random.byte(), static_cast<uint16_t>(random.next()),
+        static_cast<uint16_t>(random.next()) };
+    machine.load(start);
+    std::string report;
+
+    for (int i = 0; i < PROGRAM_LENGTH; ++i) {
+        uint16_t pc = machine.reference.state.pc;
+        uint8_t opcode = pickOpcode(campaign, random);
+        uint8_t operand1 = random.byte(), operand2 = random.byte();
+        undo.push_back({ pc, opcode, machine.referenceMemory[pc] });
+        undo.push_back({ static_cast<uint16_t>(pc + 1), operand1, machine.referenceMemory[static_cast<uint16_t>(pc + 1)] });
+        undo.push_back({ static_cast<uint16_t>(pc + 2), operand2, machine.referenceMemory[static_cast<uint16_t>(pc + 2)] });
+        machine.poke(pc, opcode);
+        machine.poke(pc + 1, operand1);
+        machine.poke(pc + 2, operand2);
+
+        ReferenceState before = machine.reference.state;
+        bool same = machine.step(&report, replay);
+        for (int w = 0; w < machine.reference.writeCount; ++w) {
+            undo.push_back(machine.reference.writes[w]);
+        }
+        if (!same) {
+            Reproducer reproducer{ before, std::vector<ReferenceCPU::Access>(machine.reference.reads,
+                machine.reference.reads + machine.reference.readCount) };
+            reportMismatch(campaign, scratch, reproducer, report);
+            return Outcome::Reported;
+        }
+    }
+    bool same = replay || std::memcmp(machine.referenceMemory.data(), machine.testMemory.data(), MEMORY_SIZE) == 0;
+    return same ? Outcome::Match : Outcome::MemoryDiffers;
+}
+
+static void worker(Campaign& campaign, uint64_t seed) {
+    Machine machine, scratch;
+    Random random(seed);
+    for (size_t i = 0; i < MEMORY_SIZE; ++i) {
+        machine.poke(static_cast<uint16_t>(i), random.byte());
+    }
+
+    std::vector<ReferenceCPU::Access> undo;
+    undo.reserve(PROGRAM_LENGTH * 6);
+    while (!campaign.stop.load(std::memory_order_relaxed)) {
+        uint64_t programSeed = random.next();
+        undo.clear();
+        Outcome outcome = runProgram(campaign, machine, scratch, programSeed, false, undo);
+        if (outcome == Outcome::MemoryDiffers) {
+            // Stray write somewhere in the program: rewind and replay comparing all memory
+            // after every instruction to find the one responsible
+            for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+                machine.referenceMemory[it->address] = it->previous;
+            }
+            machine.testMemory = machine.referenceMemory;
+            undo.clear();
+            runProgram(campaign, machine, scratch, programSeed, true, undo);
+        }
+        if (outcome != Outcome::Match) {
+            machine.testMemory = machine.referenceMemory; // Carry on from a consistent state
+        }
+        campaign.instructions.fetch_add(PROGRAM_LENGTH, std::memory_order_relaxed);
+    }
+}
+
+// Opcodes the CPU handles: run each once and watch for its unknown opcode message
+static std::vector<uint8_t> probeOpcodes(std::vector<uint8_t>& missing) {
+    Machine machine;
+    std::vector<uint8_t> opcodes;
+    std::ostringstream sink;
+    std::streambuf* previous = std::cerr.rdbuf(sink.rdbuf());
+    for (int opcode = 0; opcode < 0x100; ++opcode) {
+        if (!ReferenceCPU::supports(static_cast<uint8_t>(opcode))) {
+            continue;
+        }
+        sink.str("");
+        machine.load({ 0, 0, 0, 0, 0, 0, 0xC0, 0x00, 0xD000, 0x0100 });
+        machine.poke(0x0100, static_cast<uint8_t>(opcode));
+        machine.cpu->executeNextInstruction();
+        (sink.str().find("Unknown opcode") == std::string::npos ? opcodes : missing).push_back(static_cast<uint8_t>(opcode));
+    }
+    std::cerr.rdbuf(previous);
+    return opcodes;
+}
+
+static int replay(const std::string& text) {
+    Reproducer reproducer;
+    if (!parseReproducer(text, reproducer) || reproducer.memory.empty()) {
+        std::fprintf(stderr, "cannot parse reproducer\n");
+        return 2;
+    }
+    Machine machine;
+    std::string report;
+    bool same = machine.check(reproducer, &report);
+    std::printf("%s\n%s", same ? "match" : "MISMATCH", report.c_str());
+    return same ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2 && std::strcmp(argv[1], "--replay") == 0) {
+        return replay(argv[2]);
+    }
+    double seconds = argc > 1 ? std::atof(argv[1]) : 10.0;
+    unsigned threads = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : std::thread::hardware_concurrency();
+    uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 0)
+        : static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    threads = threads ? threads : 1;
+
+    Campaign campaign;
+    std::vector<uint8_t> missing;
+    campaign.opcodes = probeOpcodes(missing);
+    std::printf("seed %llu, %u threads, %zu opcodes fuzzed\n", static_cast<unsigned long long>(seed), threads,
+        campaign.opcodes.size());
+    if (!missing.empty()) {
+        std::printf("not implemented by CPU, skipped:");
+        for (uint8_t opcode : missing) {
+            std::printf(" %02X", opcode);
+        }
+        std::printf("\n");
+    }
+    if (campaign.opcodes.empty()) {
+        return 1;
+    }
+
+    std::vector<std::thread> workers;
+    Random seeds(seed);
+    auto begin = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back(worker, std::ref(campaign), seeds.next());
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    campaign.stop = true;
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    uint64_t instructions = campaign.instructions.load();
+    std::printf("%llu instructions in %.1f s (%.1f M/s), %d mismatching opcodes\n",
+        static_cast<unsigned long long>(instructions), elapsed, instructions / elapsed / 1e6, campaign.mismatches.load());
+    return campaign.mismatches.load() ? 1 : 0;
+}
@@ -0,0 +1,89 @@
+// Reads frames published by a FrameServer in another process.
+//
+//   framedump <name> [frames] [png directory]
+//
+// Prints one line per frame (number and checksum), or writes frame_<number>.png files
+// when a directory is given. Frames are read in place from the shared ring and only
+// kept if the slot was not redrawn meanwhile.
+//
+// Build from the repository root:
+//   g++ -std=c++20 -O2 -I. tools/framedump.cpp $(ls *.cpp | grep -v main.cpp) -lpthread -o framedump
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "frameserver.h"
+#include "framesink.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <name> [frames] [png directory]\n", argv[0]);
+        return 1;
+    }
+    std::string name = argv[1];
+    uint64_t limit = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0; // 0 = until the producer goes away
+    std::string directory = argc > 3 ? argv[3] : "";
+
+    FrameClient client;
+    while (!client.open(name)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100)); // Wait for the producer
+    }
+    std::fprintf(stderr, "%s: %dx%d\n", name.c_str(), client.getWidth(), client.getHeight());
+
+    uint64_t lastFrame = 0;
+    uint64_t frames = 0, missed = 0, torn = 0;
+    auto lastSeen = std::chrono::steady_clock::now();
+
+    while (limit == 0 || frames < limit) {
+        SharedFrameView view;
+        if (!client.acquire(view) || view.frameNumber == lastFrame) {
+            if (std::chrono::steady_clock::now() - lastSeen > std::chrono::seconds(2)) {
+                break; // Producer stopped publishing
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+            continue;
+        }
+
+        // Use the pixels where they are, then make sure the producer did not lap us
+        std::vector<uint8_t> png;
+        uint32_t checksum = 2166136261u; // FNV-1a
+        if (directory.empty()) {
+            for (size_t i = 0; i < FRAME_BUFFER_SIZE; ++i) {
+                checksum = (checksum ^ view.pixels[i]) * 16777619u;
+            }
+        }
+        else {
+            png = encodePNG(view.pixels, client.getWidth(), client.getHeight());
+        }
+        if (!client.isValid(view)) {
+            torn++;
+            continue;
+        }
+
+        if (lastFrame != 0 && view.frameNumber > lastFrame + 1) {
+            missed += view.frameNumber - lastFrame - 1;
+        }
+        lastFrame = view.frameNumber;
+        lastSeen = std::chrono::steady_clock::now();
+        frames++;
+
+        if (directory.empty()) {
+            std::printf("frame %llu %08x\n", static_cast<unsigned long long>(view.frameNumber), checksum);
+        }
+        else {
+            char file[32];
+            std::snprintf(file, sizeof(file), "/frame_%08llu.png", static_cast<unsigned long long>(view.frameNumber));
+            if (FILE* out = std::fopen((directory + file).c_str(), "wb")) {
+                std::fwrite(png.data(), 1, png.size(), out);
+                std::fclose(out);
+            }
+        }
+    }
+
+    std::fprintf(stderr, "%llu frames read, %llu missed, %llu torn reads discarded\n",
+        static_cast<unsigned long long>(frames), static_cast<unsigned long long>(missed),
+        static_cast<unsigned long long>(torn));
+    return 0;
+}
@@ -0,0 +1,365 @@
+#include "referencecpu.h"
+
+// Constructor
+ReferenceCPU::ReferenceCPU(uint8_t* memory) : state{}, memory(memory), readCount(0), writeCount(0) {
+}
+
+bool ReferenceCPU::supports(uint8_t opcode) {
+    switch (opcode) {
+        case 0x10: case 0x76: case 0xCB: case 0xD9: case 0xF3: case 0xFB: // STOP HALT prefix RETI DI EI
+        case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: // Unused opcodes
+        case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+            return false;
+        default:
+            return true;
+    }
+}
+
+uint8_t ReferenceCPU::read(uint16_t address) {
+    uint8_t value = memory[address];
+    if (readCount < 8) {
+        reads[readCount++] = {address, value, value};
+    }
+    return value;
+}
+
+void ReferenceCPU::write(uint16_t address, uint8_t value) {
+    writes[writeCount++] = {address, value, memory[address]};
+    memory[address] = value;
+}
+
+uint8_t ReferenceCPU::immediate() {
+    return read(state.pc++);
+}
+
+uint16_t ReferenceCPU::immediate16() {
+    uint8_t low = immediate();
+    uint8_t high = immediate();
+    return static_cast<uint16_t>(low | (high << 8));
+}
+
+uint8_t ReferenceCPU::getOperand(int index) {
+    switch (index) {
+        case 0: return state.b;
+        case 1: return state.c;
+        case 2: return state.d;
+        case 3: return state.e;
+        case 4: return state.h;
+        case 5: return state.l;
+        case 6: return read(getPair(2));
+        default: return state.a;
+    }
+}
+
+void ReferenceCPU::setOperand(int index, uint8_t value) {
+    switch (index) {
+        case 0: state.b = value; break;
+        case 1: state.c = value; break;
+        case 2: state.d = value; break;
+        case 3: state.e = value; break;
+        case 4: state.h = value; break;
+        case 5: state.l = value; break;
+        case 6: write(getPair(2), value); break;
+        default: state.a = value; break;
+    }
+}
+
+uint16_t ReferenceCPU::getPair(int index) {
+    switch (index) {
+        case 0: return static_cast<uint16_t>((state.b << 8) | state.c);
+        case 1: return static_cast<uint16_t>((state.d << 8) | state.e);
+        case 2: return static_cast<uint16_t>((state.h << 8) | state.l);
+        default: return state.sp;
+    }
+}
+
+void ReferenceCPU::setPair(int index, uint16_t value) {
+    switch (index) {
+        case 0: state.b = value >> 8; state.c = value & 0xFF; break;
+        case 1: state.d = value >> 8; state.e = value & 0xFF; break;
+        case 2: state.h = value >> 8; state.l = value & 0xFF; break;
+        default: state.sp = value; break;
+    }
+}
+
+bool ReferenceCPU::condition(int index) {
+    switch (index) {
+        case 0: return !(state.f & FLAG_Z);
+        case 1: return state.f & FLAG_Z;
+        case 2: return !(state.f & FLAG_C);
+        default: return state.f & FLAG_C;
+    }
+}
+
+void ReferenceCPU::push(uint16_t value) {
+    write(--state.sp, value >> 8);
+    write(--state.sp, value & 0xFF);
+}
+
+uint16_t ReferenceCPU::pop() {
+    uint8_t low = read(state.sp++);
+    uint8_t high = read(state.sp++);
+    return static_cast<uint16_t>(low | (high << 8));
+}
+
+void ReferenceCPU::setFlags(bool z, bool n, bool h, bool c) {
+    state.f = (z ? FLAG_Z : 0) | (n ? FLAG_N : 0) | (h ? FLAG_H : 0) | (c ? FLAG_C : 0);
+}
+
+// ADD ADC SUB SBC AND XOR OR CP
+void ReferenceCPU::alu(int operation, uint8_t value) {
+    int a = state.a;
+    int carry = (state.f & FLAG_C) ? 1 : 0;
+    int result;
+    switch (operation) {
+        case 0:
+            result = a + value;
+            setFlags((result & 0xFF) == 0, false, (a & 0x0F) + (value & 0x0F) > 0x0F, result > 0xFF);
+            state.a = result & 0xFF;
+            break;
+        case 1:
+            result = a + value + carry;
+            setFlags((result & 0xFF) == 0, false, (a & 0x0F) + (value & 0x0F) + carry > 0x0F, result > 0xFF);
+            state.a = result & 0xFF;
+            break;
+        case 2:
+            result = a - value;
+            setFlags((result & 0xFF) == 0, true, (a & 0x0F) < (value & 0x0F), result < 0);
+            state.a = result & 0xFF;
+            break;
+        case 3:
+            result = a - value - carry;
+            setFlags((result & 0xFF) == 0, true, (a & 0x0F) - (value & 0x0F) - carry < 0, result < 0);
+            state.a = result & 0xFF;
+            break;
+        case 4:
+            state.a = a & value;
+            setFlags(state.a == 0, false, true, false);
+            break;
+        case 5:
+            state.a = a ^ value;
+            setFlags(state.a == 0, false, false, false);
+            break;
+        case 6:
+            state.a = a | value;
+            setFlags(state.a == 0, false, false, false);
+            break;
+        default:
+            result = a - value;
+            setFlags((result & 0xFF) == 0, true, (a & 0x0F) < (value & 0x0F), result < 0);
+            break;
+    }
+}
+
+int ReferenceCPU::step() {
+    readCount = 0;
+    writeCount = 0;
+    uint8_t opcode = immediate();
+
+    // LD r,r' and the ALU block are regular enough to decode from the bits
+    if (opcode >= 0x40 && opcode < 0x80) {
+        int source = opcode & 7, destination = (opcode >> 3) & 7;
+        setOperand(destination, getOperand(source));
+        return source == 6 || destination == 6 ? 8 : 4;
+    }
+    if (opcode >= 0x80 && opcode < 0xC0) {
+        alu((opcode >> 3) & 7, getOperand(opcode & 7));
+        return (opcode & 7) == 6 ? 8 : 4;
+    }
+
+    int y = (opcode >> 3) & 7; // Register, condition or ALU operation field
+    int p = y >> 1;            // Register pair field
+    switch (opcode) {
+        case 0x00: return 4;
+
+        // 16 bit loads and arithmetic
+        case 0x01: case 0x11: case 0x21: case 0x31:
+            setPair(p, immediate16());
+            return 12;
+        case 0x03: case 0x13: case 0x23: case 0x33:
+            setPair(p, getPair(p) + 1);
+            return 8;
+        case 0x0B: case 0x1B: case 0x2B: case 0x3B:
+            setPair(p, getPair(p) - 1);
+            return 8;
+        case 0x09: case 0x19: case 0x29: case 0x39: {
+            int hl = getPair(2), value = getPair(p);
+            int result = hl + value;
+            state.f = (state.f & FLAG_Z) | (((hl & 0x0FFF) + (value & 0x0FFF)) > 0x0FFF ? FLAG_H : 0)
+                | (result > 0xFFFF ? FLAG_C : 0);
+            setPair(2, result & 0xFFFF);
+            return 8;
+        }
+        case 0x08: {
+            uint16_t address = immediate16();
+            write(address, state.sp & 0xFF);
+            write(address + 1, state.sp >> 8);
+            return 20;
+        }
+        case 0xE8: case 0xF8: {
+            int offset = static_cast<int8_t>(immediate());
+            int sp = state.sp;
+            setFlags(false, false, (sp & 0x0F) + (offset & 0x0F) > 0x0F, (sp & 0xFF) + (offset & 0xFF) > 0xFF);
+            if (opcode == 0xE8) {
+                state.sp = (sp + offset) & 0xFFFF;
+                return 16;
+            }
+            setPair(2, (sp + offset) & 0xFFFF);
+            return 12;
+        }
+        case 0xF9:
+            state.sp = getPair(2);
+            return 8;
+
+        // Indirect loads
+        case 0x02: write(getPair(0), state.a); return 8;
+        case 0x12: write(getPair(1), state.a); return 8;
+        case 0x0A: state.a = read(getPair(0)); return 8;
+        case 0x1A: state.a = read(getPair(1)); return 8;
+        case 0x22: write(getPair(2), state.a); setPair(2, getPair(2) + 1); return 8;
+        case 0x32: write(getPair(2), state.a); setPair(2, getPair(2) - 1); return 8;
+        case 0x2A: state.a = read(getPair(2)); setPair(2, getPair(2) + 1); return 8;
+        case 0x3A: state.a = read(getPair(2)); setPair(2, getPair(2) - 1); return 8;
+        case 0xEA: write(immediate16(), state.a); return 16;
+        case 0xFA: state.a = read(immediate16()); return 16;
+        case 0xE0: write(0xFF00 | immediate(), state.a); return 12;
+        case 0xF0: state.a = read(0xFF00 | immediate()); return 12;
+        case 0xE2: write(0xFF00 | state.c, state.a); return 8;
+        case 0xF2: state.a = read(0xFF00 | state.c); return 8;
+
+        // 8 bit immediates, INC and DEC
+        case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E:
+            setOperand(y, immediate());
+            return y == 6 ? 12 : 8;
+        case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C: {
+            uint8_t value = getOperand(y) + 1;
+            setOperand(y, value);
+            state.f = (state.f & FLAG_C) | (value == 0 ? FLAG_Z : 0) | ((value & 0x0F) == 0 ? FLAG_H : 0);
+            return y == 6 ? 12 : 4;
+        }
+        case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D: {
+            uint8_t value = getOperand(y) - 1;
+            setOperand(y, value);
+            state.f = (state.f & FLAG_C) | FLAG_N | (value == 0 ? FLAG_Z : 0) | ((value & 0x0F) == 0x0F ? FLAG_H : 0);
+            return y == 6 ? 12 : 4;
+        }
+        case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+            alu(y, immediate());
+            return 8;
+
+        // Accumulator rotates and flag operations
+        case 0x07: {
+            int carry = state.a >> 7;
+            state.a = static_cast<uint8_t>((state.a << 1) | carry);
+            setFlags(false, false, false, carry);
+            return 4;
+        }
+        case 0x0F: {
+            int carry = state.a & 1;
+            state.a = static_cast<uint8_t>((state.a >> 1) | (carry << 7));
+            setFlags(false, false, false, carry);
+            return 4;
+        }
+        case 0x17: {
+            int carry = state.a >> 7;
+            state.a = static_cast<uint8_t>((state.a << 1) | ((state.f & FLAG_C) ? 1 : 0));
+            setFlags(false, false, false, carry);
+            return 4;
+        }
+        case 0x1F: {
+            int carry = state.a & 1;
+            state.a = static_cast<uint8_t>((state.a >> 1) | ((state.f & FLAG_C) ? 0x80 : 0));
+            setFlags(false, false, false, carry);
+            return 4;
+        }
+        case 0x27: {
+            int a = state.a;
+            bool carry = state.f & FLAG_C;
+            if (state.f & FLAG_N) {
+                if (carry) a -= 0x60;
+                if (state.f & FLAG_H) a -= 0x06;
+            }
+            else {
+                if (carry || a > 0x99) { a += 0x60; carry = true; }
+                if ((state.f & FLAG_H) || (a & 0x0F) > 0x09) a += 0x06;
+            }
+            state.a = a & 0xFF;
+            state.f = (state.f & FLAG_N) | (state.a == 0 ? FLAG_Z : 0) | (carry ? FLAG_C : 0);
+            return 4;
+        }
+        case 0x2F:
+            state.a = ~state.a;
+            state.f |= FLAG_N | FLAG_H;
+            return 4;
+        case 0x37:
+            state.f = (state.f & FLAG_Z) | FLAG_C;
+            return 4;
+        case 0x3F:
+            state.f = (state.f & (FLAG_Z | FLAG_C)) ^ FLAG_C;
+            return 4;
+
+        // Jumps, calls and the stack
+        case 0x18:
+            state.pc += static_cast<int8_t>(immediate());
+            return 12;
+        case 0x20: case 0x28: case 0x30: case 0x38: {
+            int offset = static_cast<int8_t>(immediate());
+            if (!condition(y - 4)) return 8;
+            state.pc += offset;
+            return 12;
+        }
+        case 0xC3:
+            state.pc = immediate16();
+            return 16;
+        case 0xE9:
+            state.pc = getPair(2);
+            return 4;
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA: {
+            uint16_t address = immediate16();
+            if (!condition(y)) return 12;
+            state.pc = address;
+            return 16;
+        }
+        case 0xCD: {
+            uint16_t address = immediate16();
+            push(state.pc);
+            state.pc = address;
+            return 24;
+        }
+        case 0xC4: case 0xCC: case 0xD4: case 0xDC: {
+            uint16_t address = immediate16();
+            if (!condition(y)) return 12;
+            push(state.pc);
+            state.pc = address;
+            return 24;
+        }
+        case 0xC9:
+            state.pc = pop();
+            return 16;
+        case 0xC0: case 0xC8: case 0xD0: case 0xD8:
+            if (!condition(y)) return 8;
+            state.pc = pop();
+            return 20;
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+            push(state.pc);
+            state.pc = opcode & 0x38;
+            return 16;
+        case 0xC5: case 0xD5: case 0xE5:
+            push(getPair(p));
+            return 16;
+        case 0xF5:
+            push(static_cast<uint16_t>((state.a << 8) | state.f));
+            return 16;
+        case 0xC1: case 0xD1: case 0xE1:
+            setPair(p, pop());
+            return 12;
+        case 0xF1: {
+            uint16_t value = pop();
+            state.a = value >> 8;
+            state.f = value & 0xF0;
+            return 12;
+        }
+        default:
+            return 0; // Not covered, see supports()
+    }
+}
@@ -0,0 +1,65 @@
+#include <cstdint>
+
+#ifndef referencecpu_H
+#define referencecpu_H
+
+// Register file of the reference interpreter (F holds Z N H C in bits 7-4)
+struct ReferenceState {
+    uint8_t a, f, b, c, d, e, h, l;
+    uint16_t sp, pc;
+};
+
+// Flag bits of F
+constexpr uint8_t FLAG_Z = 0x80;
+constexpr uint8_t FLAG_N = 0x40;
+constexpr uint8_t FLAG_H = 0x20;
+constexpr uint8_t FLAG_C = 0x10;
+
+// Deliberately plain LR35902 interpreter used as the oracle for cpufuzz: one flat 64 KB
+// memory, no I/O, no interrupts, written from the opcode tables rather than from CPU.
+// Covers the base opcode set except HALT, STOP, DI, EI, RETI and the CB prefix.
+class ReferenceCPU {
+public:
+    struct Access {
+        uint16_t address;
+        uint8_t value;
+        uint8_t previous; // Byte a write replaced, so a run can be rewound
+    };
+
+    ReferenceState state;
+    uint8_t* memory; // 64 KB, owned by the caller
+
+    // Accesses made by the last step, in order (reads include the opcode and operands)
+    Access reads[8];
+    int readCount;
+    Access writes[2];
+    int writeCount;
+
+    // Constructor
+    explicit ReferenceCPU(uint8_t* memory);
+
+    static bool supports(uint8_t opcode);
+
+    // Execute one instruction, returns the T-cycles it took
+    int step();
+
+private:
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t value);
+    uint8_t immediate();
+    uint16_t immediate16();
+
+    // Operand encoding of the opcode tables: B C D E H L (HL) A
+    uint8_t getOperand(int index);
+    void setOperand(int index, uint8_t value);
+    uint16_t getPair(int index); // BC DE HL SP
+    void setPair(int index, uint16_t value);
+    bool condition(int index);   // NZ Z NC C
+
+    void push(uint16_t value);
+    uint16_t pop();
+    void setFlags(bool z, bool n, bool h, bool c);
+    void alu(int operation, uint8_t value);
+};
+
+#endif
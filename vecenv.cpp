@@ -0,0 +1,140 @@
+#include "vecenv.h"
+#include <algorithm>
+#include <cstring>
+
+// Instances handed to a worker at a time
+constexpr int CHUNK_SIZE = 4;
+
+// Constructor
+VectorEnvironment::VectorEnvironment(int count, const std::string& romPath, int framesPerStep,
+    ObservationFormat format, int threads) : pool(count, Cartridge::load(romPath)),
+    framesPerStep(std::max(framesPerStep, 1)), format(format),
+    actions(nullptr), observations(nullptr), infos(nullptr), resetting(false),
+    workers(threads) {
+
+    // Every instance shares the pool's ROM image and resets to its template
+    GameBoy& pristine = pool.getTemplate();
+    pristine.cpu.connectAPU(nullptr); // No audio for headless training
+    pristine.gpu.setFrameSkip(0);
+
+    for (int i = 0; i < count; ++i) {
+        machines.push_back(pool.acquire());
+    }
+}
+
+void VectorEnvironment::addRAMSlice(uint16_t address, uint16_t length) {
+    ramSlices.push_back({ address, length });
+}
+
+int VectorEnvironment::size() const {
+    return static_cast<int>(machines.size());
+}
+
+size_t VectorEnvironment::screenSize() const {
+    return format == ObservationFormat::Indexed ? SCREEN_WIDTH * SCREEN_HEIGHT
+        : (SCREEN_WIDTH / 2) * (SCREEN_HEIGHT / 2);
+}
+
+size_t VectorEnvironment::observationSize() const {
+    size_t size = screenSize();
+    for (const RAMSlice& slice : ramSlices) {
+        size += slice.length;
+    }
+    return size;
+}
+
+GameBoy& VectorEnvironment::getMachine(int index) {
+    return *machines[index];
+}
+
+void VectorEnvironment::reset(uint8_t* observations, EnvironmentInfo* infos) {
+    this->actions = nullptr;
+    this->observations = observations;
+    this->infos = infos;
+    resetting = true;
+    runBatch();
+}
+
+void VectorEnvironment::step(const uint8_t* actions, uint8_t* observations, EnvironmentInfo* infos) {
+    this->actions = actions;
+    this->observations = observations;
+    this->infos = infos;
+    resetting = false;
+    runBatch();
+}
+
+// Step the instances in small chunks across the pool and the calling thread
+void VectorEnvironment::runBatch() {
+    workers.run(size(), CHUNK_SIZE, [this](int first, int last) {
+        for (int i = first; i < last; ++i) {
+            stepOne(i);
+        }
+    });
+}
+
+void VectorEnvironment::stepOne(int index) {
+    GameBoy& machine = *machines[index];
+
+    if (resetting) {
+        pool.reset(machine);
+    }
+    else {
+        machine.setInput(actions[index]);
+    }
+
+    // Only the last frame of the step is drawn
+    int frames = resetting ? 1 : framesPerStep;
+    for (int frame = 0; frame < frames; ++frame) {
+        if (frame == frames - 1) {
+            machine.gpu.requestFrame();
+        }
+        machine.runFrame();
+    }
+
+    writeObservation(index, observations + index * observationSize());
+    if (infos) {
+        infos[index] = { machine.gpu.getFrameCount(), machine.cpu.cycleCount };
+    }
+}
+
+// Convert the RGBA frame into the requested layout, then append the RAM slices
+void VectorEnvironment::writeObservation(int index, uint8_t* out) {
+    GameBoy& machine = *machines[index];
+    const uint8_t* frame = machine.gpu.getFrameBuffer();
+
+    auto luminance = [frame](int x, int y) {
+        const uint8_t* pixel = frame + (y * SCREEN_WIDTH + x) * 4;
+        return (pixel[0] * 77 + pixel[1] * 150 + pixel[2] * 29) >> 8;
+    };
+
+    if (format == ObservationFormat::Indexed) {
+        // Match pixels against the shade colours in frame buffer byte order (R, G, B, A), so
+        // the index is exact whatever colour scheme the machine draws with
+        uint32_t shades[4];
+        for (int shade = 0; shade < 4; ++shade) {
+            uint32_t color = machine.gpu.getShadeColors()[shade];
+            uint8_t bytes[4] = { static_cast<uint8_t>(color >> 16), static_cast<uint8_t>(color >> 8),
+                static_cast<uint8_t>(color), static_cast<uint8_t>(color >> 24) };
+            std::memcpy(&shades[shade], bytes, sizeof(bytes));
+        }
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; ++i) {
+            uint32_t pixel;
+            std::memcpy(&pixel, frame + i * 4, sizeof(pixel));
+            *out++ = pixel == shades[3] ? 3 : pixel == shades[2] ? 2 : pixel == shades[1] ? 1 : 0;
+        }
+    }
+    else {
+        for (int y = 0; y < SCREEN_HEIGHT; y += 2) {
+            for (int x = 0; x < SCREEN_WIDTH; x += 2) {
+                int sum = luminance(x, y) + luminance(x + 1, y) + luminance(x, y + 1) + luminance(x + 1, y + 1);
+                *out++ = static_cast<uint8_t>(sum >> 2);
+            }
+        }
+    }
+
+    for (const RAMSlice& slice : ramSlices) {
+        for (uint32_t i = 0; i < slice.length; ++i) {
+            *out++ = machine.cpu.read8(static_cast<uint16_t>(slice.address + i));
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "pool.h"
+#include "workerpool.h"
+
+#ifndef vecenv_H
+#define vecenv_H
+
+// Observation layouts written into the caller's buffer
+enum class ObservationFormat {
+    Indexed,            // 160x144, one byte per pixel, shade 0 (lightest) to 3
+    DownscaledGrayscale // 80x72, 2x2 averaged luminance
+};
+
+// Per instance information returned by step/reset
+struct EnvironmentInfo {
+    uint64_t frame;
+    uint64_t cycles;
+};
+
+// Steps M machines by K frames per call across a pool of worker threads
+class VectorEnvironment {
+private:
+    MachinePool pool;
+    std::vector<GameBoy*> machines;
+    int framesPerStep;
+    ObservationFormat format;
+
+    // RAM slices appended to every observation
+    struct RAMSlice {
+        uint16_t address;
+        uint16_t length;
+    };
+    std::vector<RAMSlice> ramSlices;
+
+    // Current batch
+    const uint8_t* actions;
+    uint8_t* observations;
+    EnvironmentInfo* infos;
+    bool resetting;
+
+    // Thread pool (the calling thread works too)
+    WorkerPool workers;
+
+    void runBatch();
+    void stepOne(int index);
+    void writeObservation(int index, uint8_t* out);
+
+public:
+    // Constructor (threads = 0 uses every hardware thread)
+    VectorEnvironment(int count, const std::string& romPath, int framesPerStep = 4,
+        ObservationFormat format = ObservationFormat::Indexed, int threads = 0);
+
+    // Append the bytes at address .. address + length to each observation
+    void addRAMSlice(uint16_t address, uint16_t length);
+
+    int size() const;
+    size_t screenSize() const;
+    size_t observationSize() const;
+    GameBoy& getMachine(int index);
+
+    // Reset every instance and write its first observation
+    void reset(uint8_t* observations, EnvironmentInfo* infos);
+    // Apply actions[M] (JOYPAD_* bits), run K frames and write observations[M]
+    void step(const uint8_t* actions, uint8_t* observations, EnvironmentInfo* infos);
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "workerpool.h"
+#include <algorithm>
+
+// Constructor
+WorkerPool::WorkerPool(int threads) : generation(0), activeWorkers(0), stopping(false), job(nullptr),
+    count(0), chunk(1), nextIndex(0) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 1; i < threads; ++i) {
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int WorkerPool::size() const {
+    return static_cast<int>(workers.size()) + 1;
+}
+
+// Wake the pool, work alongside it and wait for the run to finish
+void WorkerPool::run(int count, int chunk, const std::function<void(int, int)>& job) {
+    if (workers.empty()) {
+        if (count > 0) {
+            job(0, count);
+        }
+        return;
+    }
+
+    this->job = &job;
+    this->count = count;
+    this->chunk = std::max(chunk, 1);
+    nextIndex = 0;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        generation++;
+        activeWorkers = static_cast<int>(workers.size());
+    }
+    workReady.notify_all();
+
+    processChunks();
+
+    std::unique_lock<std::mutex> lock(poolMutex);
+    workDone.wait(lock, [this] { return activeWorkers == 0; });
+    this->job = nullptr;
+}
+
+void WorkerPool::workerLoop() {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            workReady.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        processChunks();
+
+        std::lock_guard<std::mutex> lock(poolMutex);
+        if (--activeWorkers == 0) {
+            workDone.notify_one();
+        }
+    }
+}
+
+// Claim ranges until none are left
+void WorkerPool::processChunks() {
+    while (true) {
+        int first = nextIndex.fetch_add(chunk, std::memory_order_relaxed);
+        if (first >= count) {
+            return;
+        }
+        (*job)(first, std::min(first + chunk, count));
+    }
+}
@@ -0,0 +1,46 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef workerpool_H
+#define workerpool_H
+
+// Fixed set of threads that work through a range of indices alongside the calling thread
+class WorkerPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex poolMutex;
+    std::condition_variable workReady;
+    std::condition_variable workDone;
+    uint64_t generation;
+    int activeWorkers;
+    bool stopping;
+
+    // Current run
+    const std::function<void(int, int)>* job;
+    int count;
+    int chunk;
+    std::atomic<int> nextIndex;
+
+    void workerLoop();
+    void processChunks();
+
+public:
+    // Constructor (threads counts the calling thread: 1 starts none, 0 uses every hardware thread)
+    explicit WorkerPool(int threads);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int size() const; // Threads taking part in a run, the calling one included
+
+    // Call job(first, last) over 0 .. count in ranges of at most chunk indices, claimed by
+    // whichever thread is free; returns once every range is done
+    void run(int count, int chunk, const std::function<void(int, int)>& job);
+};
+
+#endif